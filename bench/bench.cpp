@@ -0,0 +1,300 @@
+/* Copyright (c) 2024-2025, CK Tan.
+ * https://github.com/cktan/csvc17/blob/main/LICENSE
+ */
+#include "../src/csv.hpp"
+#include "../src/csvc17.h"
+#include "gen.h"
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+/*
+ *  Measure the throughput of the parse APIs on synthetic documents.
+ *  Prints one JSON object per shape and API on stdout.
+ *
+ *  Usage: bench [-m MB] [-r REPEAT] [-k KERNEL] [SHAPE ...]
+ */
+
+namespace {
+
+// Time stamp counter. On x86_64, this is the TSC, which ticks at the
+// nominal frequency of the cpu. 0 if not available.
+uint64_t cycles() {
+#ifdef __x86_64__
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct result_t {
+  double seconds = 1e300;
+  uint64_t cycles = 0;
+  int64_t rows = 0;
+};
+
+// What the callbacks touch, so that the work is not optimized away.
+struct context_t : csv_parser_t {
+  const char *ptr = 0; // feed() reads ptr[off..len)
+  int64_t len = 0, off = 0;
+  int64_t rows = 0;
+  int64_t bytes = 0;
+};
+
+int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int64_t n = ctx->len - ctx->off;
+  if (n > bufsz) {
+    n = bufsz;
+  }
+  memcpy(buf, ctx->ptr + ctx->off, n);
+  ctx->off += n;
+  return n;
+}
+
+int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+           int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  ctx->rows++;
+  for (int i = 0; i < n; i++) {
+    ctx->bytes += value[i].len;
+  }
+  return 0;
+}
+
+int perbatch(void *ctx_, const csv_batch_t *batch, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  ctx->rows += batch->nrow;
+  for (int c = 0; c < batch->ncol; c++) {
+    const int *len = batch->column[c].len;
+    for (int r = 0; r < batch->nrow; r++) {
+      ctx->bytes += len[r];
+    }
+  }
+  return 0;
+}
+
+struct api_t {
+  const char *name;
+  // parse the doc in ctx or in path; return 0 on success.
+  int (*run)(context_t &ctx, const csv_config_t &conf, const char *path,
+             std::string &errmsg);
+};
+
+int run_c(context_t &ctx, const csv_config_t &conf, const char *path,
+          std::string &errmsg, int (*fn)(csv_t *, context_t &, const char *)) {
+  csv_t csv = csv_open(&conf);
+  int ret = csv.ok ? fn(&csv, ctx, path) : -1;
+  errmsg = csv.errmsg;
+  csv_close(&csv);
+  return ret;
+}
+
+const api_t APIS[] = {
+    {"csv_parse",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       return run_c(ctx, conf, path, errmsg,
+                    [](csv_t *csv, context_t &ctx, const char *) {
+                      return csv_parse(csv, &ctx, feed, perrow);
+                    });
+     }},
+    {"csv_parse_batch",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       return run_c(ctx, conf, path, errmsg,
+                    [](csv_t *csv, context_t &ctx, const char *) {
+                      return csv_parse_batch(csv, &ctx, feed, perbatch);
+                    });
+     }},
+    {"csv_parse_file",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       return run_c(ctx, conf, path, errmsg,
+                    [](csv_t *csv, context_t &ctx, const char *path) {
+                      FILE *fp = fopen(path, "r");
+                      if (!fp) {
+                        snprintf(csv->errmsg, sizeof(csv->errmsg),
+                                 "fopen %s failed", path);
+                        return -1;
+                      }
+                      // csv_close() closes fp
+                      return csv_parse_file(csv, fp, &ctx, perrow);
+                    });
+     }},
+    {"csv_parse_file_ex",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       return run_c(ctx, conf, path, errmsg,
+                    [](csv_t *csv, context_t &ctx, const char *path) {
+                      return csv_parse_file_ex(csv, path, &ctx, perrow);
+                    });
+     }},
+    {"csv_parse_mmap",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       return run_c(ctx, conf, path, errmsg,
+                    [](csv_t *csv, context_t &ctx, const char *path) {
+                      return csv_parse_mmap(csv, path, &ctx, perrow);
+                    });
+     }},
+    {"csv_parser_t",
+     [](context_t &ctx, const csv_config_t &conf, const char *path,
+        std::string &errmsg) {
+       ctx.set_escape(conf.esc).set_kernel(conf.kernel);
+       bool ok = ctx.parse_file(path, perrow);
+       errmsg = ctx.errmsg();
+       return ok ? 0 : -1;
+     }},
+};
+
+void usage() {
+  fprintf(stderr,
+          "Usage: bench [-m MB] [-r REPEAT] [-k KERNEL] [SHAPE ...]\n\n"
+          "  -m MB      size of each document; default 64\n"
+          "  -r REPEAT  run each API this many times, and report the best;\n"
+          "             default 5\n"
+          "  -k KERNEL  sse2, avx2, avx512bw or neon; default auto\n\n"
+          "Shapes:\n");
+  for (int i = 0; i < GEN_NSHAPE; i++) {
+    fprintf(stderr, "  %-10s %s\n", GEN_SHAPES[i].name, GEN_SHAPES[i].desc);
+  }
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int64_t mb = 64;
+  int repeat = 5;
+  csv_kernel_t kernel = CSV_KERNEL_AUTO;
+  const char *kernels[] = {"auto", "sse2", "avx2", "avx512bw", "neon"};
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:r:k:h")) != -1) {
+    switch (opt) {
+    case 'm':
+      mb = atoll(optarg);
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 'k': {
+      int i = 0;
+      while (i < 5 && strcmp(optarg, kernels[i])) {
+        i++;
+      }
+      if (i == 5) {
+        usage();
+      }
+      kernel = (csv_kernel_t)i;
+      break;
+    }
+    default:
+      usage();
+    }
+  }
+  if (mb <= 0 || repeat <= 0) {
+    usage();
+  }
+
+  std::vector<const gen_shape_t *> shapes;
+  for (int i = optind; i < argc; i++) {
+    const gen_shape_t *shape = gen_shape(argv[i]);
+    if (!shape) {
+      usage();
+    }
+    shapes.push_back(shape);
+  }
+  if (shapes.empty()) {
+    for (int i = 0; i < GEN_NSHAPE; i++) {
+      shapes.push_back(&GEN_SHAPES[i]);
+    }
+  }
+
+  char path[] = "/tmp/csvc17_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  int status = 0;
+  for (const gen_shape_t *shape : shapes) {
+    gen_t doc = gen_doc(shape, mb * 1024 * 1024, 1);
+    FILE *fp = fopen(path, "w");
+    if (!fp || (int64_t)fwrite(doc.ptr, 1, doc.len, fp) != doc.len ||
+        fclose(fp)) {
+      perror(path);
+      return 1;
+    }
+
+    csv_config_t conf = csv_default_config();
+    conf.esc = shape->esc;
+    conf.kernel = kernel;
+    csv_t csv = csv_open(&conf);
+    std::string kname = csv.ok ? csv_kernel_name(&csv) : "none";
+    csv_close(&csv);
+
+    for (const api_t &api : APIS) {
+      result_t best;
+      std::string errmsg;
+      for (int i = 0; i < repeat && errmsg.empty(); i++) {
+        context_t ctx;
+        ctx.ptr = doc.ptr;
+        ctx.len = doc.len;
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = cycles();
+        int ret = api.run(ctx, conf, path, errmsg);
+        uint64_t c1 = cycles();
+        auto t1 = std::chrono::steady_clock::now();
+        if (ret) {
+          break;
+        }
+        errmsg.clear();
+        double sec = std::chrono::duration<double>(t1 - t0).count();
+        if (sec < best.seconds) {
+          best.seconds = sec;
+          best.cycles = c1 - c0;
+          best.rows = ctx.rows;
+        }
+      }
+
+      if (!errmsg.empty()) {
+        printf("{\"shape\":\"%s\",\"api\":\"%s\",\"error\":\"%s\"}\n",
+               shape->name, api.name, errmsg.c_str());
+        status = 1;
+        continue;
+      }
+      char cpb[32] = "null";
+      if (best.cycles) {
+        snprintf(cpb, sizeof(cpb), "%.3f", (double)best.cycles / doc.len);
+      }
+      printf("{\"shape\":\"%s\",\"api\":\"%s\",\"kernel\":\"%s\","
+             "\"bytes\":%" PRId64 ",\"rows\":%" PRId64 ",\"seconds\":%.6f,"
+             "\"gbps\":%.3f,\"rows_per_sec\":%.0f,\"cycles_per_byte\":%s}\n",
+             shape->name, api.name, kname.c_str(), doc.len, best.rows,
+             best.seconds, doc.len / best.seconds / 1e9,
+             best.rows / best.seconds, cpb);
+      fflush(stdout);
+    }
+    free(doc.ptr);
+  }
+
+  unlink(path);
+  return status;
+}
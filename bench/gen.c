@@ -0,0 +1,37 @@
+/* Copyright (c) 2024-2025, CK Tan.
+ * https://github.com/cktan/csvc17/blob/main/LICENSE
+ */
+#include "gen.h"
+
+/*
+ *  Write a synthetic csv document to stdout.
+ *
+ *  Usage: gen SHAPE [MB [SEED]]
+ */
+static void usage(void) {
+  fprintf(stderr, "Usage: gen SHAPE [MB [SEED]]\n\nShapes:\n");
+  for (int i = 0; i < GEN_NSHAPE; i++) {
+    fprintf(stderr, "  %-10s %s\n", GEN_SHAPES[i].name, GEN_SHAPES[i].desc);
+  }
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 4) {
+    usage();
+  }
+  const gen_shape_t *shape = gen_shape(argv[1]);
+  if (!shape) {
+    usage();
+  }
+  int64_t mb = (argc > 2 ? atoll(argv[2]) : 100);
+  uint64_t seed = (argc > 3 ? strtoull(argv[3], 0, 10) : 1);
+
+  gen_t gen = gen_doc(shape, mb * 1024 * 1024, seed);
+  if ((int64_t)fwrite(gen.ptr, 1, gen.len, stdout) != gen.len) {
+    fprintf(stderr, "write failed\n");
+    return 1;
+  }
+  free(gen.ptr);
+  return 0;
+}
@@ -0,0 +1,225 @@
+/* Copyright (c) 2024-2025, CK Tan.
+ * https://github.com/cktan/csvc17/blob/main/LICENSE
+ */
+#pragma once
+
+/*
+ *  Deterministic generator of synthetic csv documents. The same shape,
+ *  size and seed always produce the same bytes, so that benchmark
+ *  numbers are comparable across builds and machines.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct gen_t gen_t;
+struct gen_t {
+  char *ptr; // ptr[0..len) is the document
+  int64_t len, max;
+  uint64_t seed;
+};
+
+typedef struct gen_shape_t gen_shape_t;
+struct gen_shape_t {
+  const char *name;
+  const char *desc;
+  char esc;                // the escape char of the document
+  void (*row)(gen_t *gen); // append one row
+};
+
+// xorshift64
+static inline uint64_t gen_rand(gen_t *gen) {
+  uint64_t x = gen->seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return gen->seed = x;
+}
+
+static inline int gen_range(gen_t *gen, int lo, int hi) {
+  return lo + (int)(gen_rand(gen) % (uint64_t)(hi - lo + 1));
+}
+
+static inline void gen_putc(gen_t *gen, char ch) {
+  if (gen->len == gen->max) {
+    gen->max = gen->max ? gen->max * 2 : 1024 * 1024;
+    gen->ptr = (char *)realloc(gen->ptr, gen->max);
+    if (!gen->ptr) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  gen->ptr[gen->len++] = ch;
+}
+
+static inline void gen_puts(gen_t *gen, const char *s) {
+  while (*s) {
+    gen_putc(gen, *s++);
+  }
+}
+
+static inline void gen_int(gen_t *gen, int lo, int hi) {
+  char tmp[24];
+  snprintf(tmp, sizeof(tmp), "%d", gen_range(gen, lo, hi));
+  gen_puts(gen, tmp);
+}
+
+// Append n random chars, none of which is special.
+static inline void gen_text(gen_t *gen, int n) {
+  static const char alpha[] = "abcdefghijklmnopqrstuvwxyz ABCDEFG0123456789";
+  for (int i = 0; i < n; i++) {
+    gen_putc(gen, alpha[gen_rand(gen) % (sizeof(alpha) - 1)]);
+  }
+}
+
+// narrow: 6 numeric columns
+static void gen_narrow(gen_t *gen) {
+  gen_int(gen, 0, 1000000);
+  gen_putc(gen, ',');
+  gen_int(gen, -500, 500);
+  gen_putc(gen, ',');
+  gen_int(gen, 0, 99999);
+  gen_putc(gen, '.');
+  gen_int(gen, 10, 99);
+  gen_putc(gen, ',');
+  gen_int(gen, 0, 9);
+  gen_putc(gen, ',');
+  gen_int(gen, 1000, 9999);
+  gen_putc(gen, ',');
+  gen_int(gen, 0, 999);
+  gen_putc(gen, '.');
+  gen_int(gen, 0, 9);
+  gen_putc(gen, '\n');
+}
+
+// wide: 1000 short columns
+static void gen_wide(gen_t *gen) {
+  for (int i = 0; i < 1000; i++) {
+    if (i) {
+      gen_putc(gen, ',');
+    }
+    gen_int(gen, 0, 999);
+  }
+  gen_putc(gen, '\n');
+}
+
+// quoted: every value quoted, with embedded delims and "" escapes
+static void gen_quoted(gen_t *gen) {
+  for (int i = 0; i < 8; i++) {
+    if (i) {
+      gen_putc(gen, ',');
+    }
+    gen_putc(gen, '"');
+    int n = gen_range(gen, 5, 30);
+    for (int j = 0; j < n; j++) {
+      int r = gen_range(gen, 0, 15);
+      if (r == 0) {
+        gen_puts(gen, "\"\"");
+      } else if (r == 1) {
+        gen_putc(gen, ',');
+      } else {
+        gen_text(gen, 1);
+      }
+    }
+    gen_putc(gen, '"');
+  }
+  gen_putc(gen, '\n');
+}
+
+// multiline: long quoted text with newlines and "" escapes
+static void gen_multiline(gen_t *gen) {
+  gen_int(gen, 0, 1000000);
+  gen_puts(gen, ",\"");
+  int n = gen_range(gen, 500, 4000);
+  for (int j = 0; j < n; j++) {
+    int r = gen_range(gen, 0, 99);
+    if (r == 0) {
+      gen_puts(gen, "\"\"");
+    } else if (r < 3) {
+      gen_putc(gen, '\n');
+    } else {
+      gen_text(gen, 1);
+    }
+  }
+  gen_puts(gen, "\",");
+  gen_int(gen, 0, 1000000);
+  gen_putc(gen, '\n');
+}
+
+// crlf: mixed text and numbers, rows end with \r\n
+static void gen_crlf(gen_t *gen) {
+  for (int i = 0; i < 10; i++) {
+    if (i) {
+      gen_putc(gen, ',');
+    }
+    if (i % 2) {
+      gen_int(gen, 0, 1000000);
+    } else {
+      gen_text(gen, gen_range(gen, 3, 20));
+    }
+  }
+  gen_puts(gen, "\r\n");
+}
+
+// backslash: quoted values with \" and \\ escapes
+static void gen_backslash(gen_t *gen) {
+  for (int i = 0; i < 6; i++) {
+    if (i) {
+      gen_putc(gen, ',');
+    }
+    gen_putc(gen, '"');
+    int n = gen_range(gen, 5, 30);
+    for (int j = 0; j < n; j++) {
+      int r = gen_range(gen, 0, 15);
+      if (r == 0) {
+        gen_puts(gen, "\\\"");
+      } else if (r == 1) {
+        gen_puts(gen, "\\\\");
+      } else if (r == 2) {
+        gen_putc(gen, ',');
+      } else {
+        gen_text(gen, 1);
+      }
+    }
+    gen_putc(gen, '"');
+  }
+  gen_putc(gen, '\n');
+}
+
+static const gen_shape_t GEN_SHAPES[] = {
+    {"narrow", "6 numeric columns", '"', gen_narrow},
+    {"wide", "1000 numeric columns", '"', gen_wide},
+    {"quoted", "8 quoted columns with delims and \"\" escapes", '"',
+     gen_quoted},
+    {"multiline", "long quoted text with newlines", '"', gen_multiline},
+    {"crlf", "10 text and numeric columns, \\r\\n line endings", '"',
+     gen_crlf},
+    {"backslash", "6 quoted columns with \\\" and \\\\ escapes", '\\',
+     gen_backslash},
+};
+#define GEN_NSHAPE ((int)(sizeof(GEN_SHAPES) / sizeof(GEN_SHAPES[0])))
+
+// Return the shape of name, or NULL if not found.
+static inline const gen_shape_t *gen_shape(const char *name) {
+  for (int i = 0; i < GEN_NSHAPE; i++) {
+    if (0 == strcmp(GEN_SHAPES[i].name, name)) {
+      return &GEN_SHAPES[i];
+    }
+  }
+  return 0;
+}
+
+// Generate whole rows of shape until there are at least nbytes. The
+// caller must free() gen->ptr.
+static inline gen_t gen_doc(const gen_shape_t *shape, int64_t nbytes,
+                            uint64_t seed) {
+  gen_t gen;
+  memset(&gen, 0, sizeof(gen));
+  gen.seed = seed ? seed : 1;
+  while (gen.len < nbytes) {
+    shape->row(&gen);
+  }
+  return gen;
+}
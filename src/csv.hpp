@@ -1,9 +1,13 @@
 #pragma once
 
 #include "csvc17.h"
+#include <algorithm>
+#include <climits>
 #include <string>
 #include <string_view>
 #include <cstring>
+#include <memory_resource>
+#include <vector>
 
 /**
  * Note: in this implementation of csv_parser_t, the context to the callback functions is always
@@ -23,12 +27,45 @@
 
 class csv_parser_t {
 private:
+  // Rewind the handle for a new parse. It keeps its warmed-up buffers
+  // unless the configuration has changed since csv_open().
   void reset() {
-    csv_close(&m_csv);
-    m_csv = csv_open(&m_conf);
+    if (m_reopen || csv_reset(&m_csv)) {
+      csv_close(&m_csv);
+      size_scale();
+      m_csv = csv_open(&m_conf);
+      m_reopen = false;
+    }
+    m_pushing = false;
+  }
+  // Point m_conf at a copy of the scale of set_scale() the size of the
+  // schema: padded with 0, or cut short.
+  void size_scale() {
+    m_openscale.clear();
+    if (!m_scale.empty()) {
+      m_openscale = m_scale;
+      m_openscale.resize(m_schema.size(), 0);
+    }
+    m_conf.scale = m_openscale.empty() ? nullptr : m_openscale.data();
+    m_conf.nscale = m_openscale.size();
+  }
+  // csv_allocator_t hooks on a std::pmr::memory_resource
+  static void* mr_alloc(void* mr, size_t size, size_t align) {
+    try {
+      return ((std::pmr::memory_resource*)mr)->allocate(size, align);
+    } catch (...) {
+      return nullptr;
+    }
+  }
+  static void mr_free(void* mr, void* ptr, size_t size, size_t align) {
+    ((std::pmr::memory_resource*)mr)->deallocate(ptr, size, align);
   }
 public:
   csv_parser_t() {}
+  // the memory of the parser comes from mr, which must outlive it
+  explicit csv_parser_t(std::pmr::memory_resource* mr) {
+    set_memory_resource(mr);
+  }
   ~csv_parser_t() { csv_close(&m_csv); }
 
   csv_parser_t(csv_parser_t&) = delete;
@@ -42,18 +79,22 @@ public:
   // set parameters
   csv_parser_t& set_skip_header(bool flag) {
     m_conf.skip_header = flag;
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_delim(char delim) {
     m_conf.delim = delim;
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_quote(char qte) {
     m_conf.qte = qte;
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_escape(char esc) {
     m_conf.esc = esc;
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_nullstr(std::string_view nullstr) {
@@ -63,16 +104,78 @@ public:
     }
     std::memcpy(m_conf.nullstr, nullstr.data(), sz);
     m_conf.nullstr[sz] = '\0';
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_initbufsz(int n) {
     m_conf.initbufsz = n;
+    m_reopen = true;
     return *this;
   }
   csv_parser_t& set_maxbufsz(int n) {
     m_conf.maxbufsz = n;
+    m_reopen = true;
+    return *this;
+  }
+  csv_parser_t& set_kernel(csv_kernel_t kernel) {
+    m_conf.kernel = kernel;
+    m_reopen = true;
+    return *this;
+  }
+  csv_parser_t& set_batchsz(int n) {
+    m_conf.batchsz = n;
+    m_reopen = true;
+    return *this;
+  }
+  // call feed on a thread of its own, n buffers ahead of the parse
+  csv_parser_t& set_readahead(int n) {
+    m_conf.readahead = n;
+    m_reopen = true;
+    return *this;
+  }
+  // take memory from mr, or from the C library if mr is null
+  csv_parser_t& set_memory_resource(std::pmr::memory_resource* mr) {
+    m_conf.allocator = {};
+    if (mr) {
+      m_conf.allocator.alloc = mr_alloc;
+      m_conf.allocator.free = mr_free;
+      m_conf.allocator.context = mr;
+    }
+    m_reopen = true;
+    return *this;
+  }
+  // pass only these fields (0-based) to the callbacks, in this order
+  csv_parser_t& set_select(std::vector<int> cols) {
+    m_select = std::move(cols);
+    m_conf.select = m_select.empty() ? nullptr : m_select.data();
+    m_conf.nselect = m_select.size();
+    m_reopen = true;
+    return *this;
+  }
+  // decode value i passed to the callbacks as types[i]; see csv_type_t
+  csv_parser_t& set_schema(std::vector<csv_type_t> types) {
+    m_schema = std::move(types);
+    m_conf.schema = m_schema.empty() ? nullptr : m_schema.data();
+    m_conf.nschema = m_schema.size();
+    m_reopen = true;
     return *this;
   }
+  // scale[i] of a CSV_TYPE_DECIMAL value i; see csv_config_t. Values
+  // past the schema are ignored, and those missing are 0.
+  csv_parser_t& set_scale(std::vector<int> scale) {
+    m_scale = std::move(scale);
+    m_reopen = true;
+    return *this;
+  }
+  // CSV_DECIMAL_xxx of CSV_TYPE_DECIMAL values
+  csv_parser_t& set_decimal_mode(int mode) {
+    m_conf.decimal_mode = mode;
+    m_reopen = true;
+    return *this;
+  }
+
+  // name of the SIMD kernel used by the last parse
+  const char* kernel_name() const { return csv_kernel_name(&m_csv); }
 
   // really parse the csv data
   bool parse_file(FILE* fp, csv_perrow_t* perrow) {
@@ -83,13 +186,70 @@ public:
     reset();
     return 0 == csv_parse_file_ex(&m_csv, path.data(), this, perrow);
   }
+  // values passed to perrow are not NUL-terminated; see csv_parse_mmap()
+  bool parse_mmap(std::string_view path, csv_perrow_t* perrow) {
+    reset();
+    return 0 == csv_parse_mmap(&m_csv, path.data(), this, perrow);
+  }
+  // values passed to perrow are not NUL-terminated; see csv_parse_mem()
+  bool parse_mem(std::string_view doc, csv_perrow_t* perrow) {
+    reset();
+    return 0 == csv_parse_mem(&m_csv, doc.data(), doc.size(), this, perrow);
+  }
+  // rows of chunk i go to perrow with context[i]; see csv_parse_parallel()
+  bool parse_parallel(std::string_view path, int nthread, void* context[],
+                      csv_perrow_t* perrow) {
+    reset();
+    return 0 == csv_parse_parallel(&m_csv, path.data(), nthread, context,
+                                   perrow);
+  }
+  // values passed to perrow are not NUL-terminated; see csv_parse_segments()
+  bool parse_segments(csv_segfeed_t* feed, csv_release_t* release,
+                      csv_perrow_t* perrow) {
+    reset();
+    return 0 == csv_parse_segments(&m_csv, this, feed, release, perrow);
+  }
   bool parse(csv_feed_t* feed, csv_perrow_t* perrow) {
     reset();
     return 0 == csv_parse(&m_csv, this, feed, perrow);
   }
+  bool parse_batch(csv_feed_t* feed, csv_perbatch_t* perbatch) {
+    reset();
+    return 0 == csv_parse_batch(&m_csv, this, feed, perbatch);
+  }
+  // push-style parse; the first push() starts a new parse, and
+  // finish() ends it. See csv_push().
+  bool push(std::string_view data, csv_perrow_t* perrow) {
+    if (!m_pushing) {
+      reset();
+      m_pushing = true;
+    }
+    // csv_push() takes an int length; push a larger piece in parts
+    do {
+      const size_t n = std::min<size_t>(data.size(), INT_MAX);
+      if (csv_push(&m_csv, data.data(), (int)n, this, perrow)) {
+        return false;
+      }
+      data.remove_prefix(n);
+    } while (!data.empty());
+    return true;
+  }
+  bool finish(csv_perrow_t* perrow) {
+    if (!m_pushing) {
+      reset();
+    }
+    m_pushing = false;
+    return 0 == csv_finish(&m_csv, this, perrow);
+  }
   
 private:
   csv_t m_csv = {};
   csv_config_t m_conf = csv_default_config();
+  std::vector<int> m_select;
+  std::vector<csv_type_t> m_schema;
+  std::vector<int> m_scale;
+  std::vector<int> m_openscale; // m_scale sized to m_schema
+  bool m_pushing = false; // true between push() and finish()
+  bool m_reopen = true;   // m_conf changed; csv_open() again
 };
 
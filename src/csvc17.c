@@ -1,6 +1,10 @@
 /* Copyright (c) 2024-2025, CK Tan.
  * https://github.com/cktan/csvc17/blob/main/LICENSE
  */
+// for mmap(), madvise() and memfd_create()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "csvc17.h"
 #ifdef __x86_64__
 #include "scan_x86.h"
@@ -10,11 +14,22 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "decode.h"
+#include "number.h"
+#include "uring.h"
 
 /**
  *  Unquote a value and return a NUL-terminated string.
@@ -22,6 +37,14 @@
  */
 static void unquote(scan_t *scan, csv_value_t *value, const csv_config_t *conf);
 
+/**
+ *  Decode value as type into row r of col, using the int64 decoder of
+ *  kernel.
+ */
+static void decode_value(const scan_kernel_t *kernel, const csv_config_t *conf,
+                         csv_type_t type, int scale, const csv_value_t *value,
+                         csv_column_t *col, int r);
+
 #define DO(x)                                                                  \
   if (x)                                                                       \
     return -1;                                                                 \
@@ -40,7 +63,64 @@ typedef struct status_t status_t;
 struct status_t {
   int64_t lineno; // current line number
   int64_t rowno;  // current row number
-  // note: current column number is (csvx_t::value.top + 1)
+  // note: current column number is (csvx_t::value.top + 1), or
+  // (csvx_t::select.field + 1) with a projection.
+};
+
+/*
+ *  Read-ahead for csv_parse(). A producer thread calls feed() to fill
+ *  a bounded queue of buffers, while the caller parses. ahead_read()
+ *  is the feed of the parse on the other end of the queue.
+ */
+#define AHEAD_BUFSZ (256 * 1024)
+
+typedef struct ahead_slot_t ahead_slot_t;
+struct ahead_slot_t {
+  char *ptr; // buffer of AHEAD_BUFSZ bytes
+  int len;
+};
+
+typedef struct ahead_t ahead_t;
+struct ahead_t {
+  csv_feed_t *feed; // runs on tid
+  void *context;
+  csv_allocator_t al; // of the handle; used on the caller's thread only
+
+  pthread_t tid;
+  bool started; // true if running on tid
+  pthread_mutex_t mu;
+  pthread_cond_t cond; // signaled when count, eof, error or stop changes
+
+  // The queue. slot[head .. head+count) (mod nslot) are filled. The
+  // producer owns the others.
+  ahead_slot_t *slot;
+  int nslot;
+  int head, count;
+  int pos; // slot[head].ptr[pos..len) is yet to be consumed
+
+  bool eof;   // feed() returned 0
+  bool error; // feed() returned -1, with a message in errmsg[]
+  bool stop;  // set by the consumer to end the thread
+  char errmsg[200];
+};
+
+/*
+ *  Storage on the stack of csv_parse_mem(), used before the heap, so
+ *  that a small document is parsed without any allocation. value[],
+ *  tmp[], sidx[] and buf[] may point into it during the parse; they are
+ *  never realloc'd or freed then, and are detached by end_mem().
+ */
+#define MEM_NVALUE 64
+#define MEM_NSIDX 1024
+#define MEM_TMPSZ 1024
+#define MEM_TAILSZ 1024
+
+typedef struct mem_t mem_t;
+struct mem_t {
+  csv_value_t value[MEM_NVALUE];
+  uint32_t sidx[MEM_NSIDX];
+  char tmp[MEM_TMPSZ];
+  char tail[MEM_TAILSZ]; // the last row, if not terminated; see copy_tail()
 };
 
 // Control block
@@ -57,8 +137,28 @@ struct csvx_t {
   struct {
     char *ptr; // buf of size max where [bot..top) is valid
     int bot, top, max;
+    bool mapped; // true if ptr points into map.ptr[] and is not owned
+    bool ring;   // true if ptr[] is a mirrored ring of max bytes; see
+                 // ring_alloc()
   } buf;
 
+  // The memory parsed in place by csv_parse_mmap(). buf[] is a window
+  // that slides over map.ptr[0..len), so the data is never copied.
+  struct {
+    char *ptr;
+    int64_t len;
+    int window; // max size of buf[]
+    bool owned; // munmap() in csv_close()
+  } map;
+
+  // If set, buf[] must not be modified, and values are unquoted into
+  // tmp[] instead of in place. Reset for every row.
+  bool readonly;
+  struct {
+    char *ptr;
+    int top, max;
+  } tmp;
+
   // value[] stores each value of a row. Appended by onerow().
   // Will be sent to perrow().
   struct {
@@ -66,10 +166,153 @@ struct csvx_t {
     int top, max;
   } value;
 
+  // Projection, built from conf.select by csv_open(). Only the fields
+  // selected are appended to value[], in the order of the fields. They
+  // are put in the order of conf.select by project().
+  struct {
+    int *col;         // copy of conf.select
+    bool *map;        // map[f] is true if field f is selected
+    int nmap;         // fields >= nmap are not selected
+    int *rank;        // column k is value[rank[k]]
+    csv_value_t *out; // out[0..conf.nselect) is sent to perrow()
+    int field;        // #fields in the row so far
+  } select;
+
+  // Copies of conf.schema and conf.scale, made by csv_open().
+  csv_type_t *schema;
+  int *scale;
+
+  // SIMD kernel picked by csv_open(), and the scans on it. begin_parse()
+  // starts each parse from a copy of these.
+  const scan_kernel_t *kernel;
+  scan_t scan_row;     // qte, delim, \n and esc
+  scan_t scan_unquote; // qte and esc
+  bool opened;         // csv_open() succeeded; see csv_reset()
+
+  // Structural index of buf[], built by index_buf() and consumed by
+  // onerow_indexed(). Used instead of onerow() when esc == qte.
+  bool indexed;
+  struct {
+    uint32_t *ptr; // offsets of qte, \n and unquoted delim in buf.ptr[]
+    int next, top; // ptr[next..top) are yet to be consumed
+    int max;
+    int scanned;      // buf.ptr[..scanned) has been indexed
+    uint64_t inquote; // all 1s if buf.ptr[scanned-1] is inside quotes
+  } sidx;
+
+  // A row in progress. When onerow() or onerow_indexed() runs out of
+  // data in the middle of a row, it saves its state here and resumes
+  // from it after the next fill_buf(), so that no byte is scanned
+  // twice. Partial values of the row stay in value[0..top).
+  struct {
+    int state;         // ROW_xxx
+    int scanoff;       // resume scanning at buf.ptr[scanoff]
+    csv_value_t value; // the value being scanned
+    bool inquote;      // onerow_indexed(): true if inside quotes
+  } row;
+
+  // Rows collected for csv_parse_batch(). Each column holds
+  // conf.batchsz values.
+  csv_perbatch_t *perbatch; // set by csv_parse_batch()
+  csv_batch_t batch;        // batch.column[0..colmax) are allocated
+  int colmax;
+  int colcap; // batch.column[] has room for colcap columns
+
   // This is a hack for csv_parse_file().
   FILE *fp; // file ptr if not NULL
+
+  // Reader of csv_parse_file_ex(), if io_uring is available. Used as
+  // the context of uring_read() like fp above.
+  uring_t *uring;
+
+  // Decoder of csv_parse_file_ex(), if the file is compressed. Used
+  // as the context of decode_read() like fp above.
+  decode_t *decode;
+
+  // Read-ahead thread of csv_parse(), if conf.readahead is set or the
+  // input is decoded.
+  ahead_t *ahead;
+
+  // Stack storage of csv_parse_mem(), if running.
+  mem_t *mem;
+
+  // Set by the parallel parses to a flag shared by the chunks. A chunk
+  // that fails sets it, and the others then fail before their next
+  // row, with stopped set.
+  int *stop;
+  bool stopped;
+};
+
+// True if p points into cb->mem.
+static inline bool in_mem(const csvx_t *cb, const void *p) {
+  const char *m = (const char *)cb->mem;
+  return m && m <= (const char *)p && (const char *)p < m + sizeof(mem_t);
+}
+
+/*
+ *  The memory of a handle comes from conf.allocator if it is set, and
+ *  from the C library otherwise. Everything is XALIGN-aligned, which is
+ *  what malloc() gives on the supported platforms, and what the SIMD
+ *  loads of buf[] prefer. The size of every block is kept, for free().
+ */
+#define XALIGN 16
+
+static inline bool has_allocator(const csv_allocator_t *al) {
+  return al->alloc && al->free;
+}
+
+static void *xalloc(const csv_allocator_t *al, size_t size) {
+  if (has_allocator(al)) {
+    return al->alloc(al->context, size, XALIGN);
+  }
+  return malloc(size);
+}
+
+static void *xrealloc(const csv_allocator_t *al, void *ptr, size_t oldsize,
+                      size_t size) {
+  if (!has_allocator(al)) {
+    return realloc(ptr, size);
+  }
+  if (!ptr) {
+    return al->alloc(al->context, size, XALIGN);
+  }
+  if (al->realloc) {
+    return al->realloc(al->context, ptr, oldsize, size, XALIGN);
+  }
+  void *p = al->alloc(al->context, size, XALIGN);
+  if (p) {
+    memcpy(p, ptr, oldsize < size ? oldsize : size);
+    al->free(al->context, ptr, oldsize, XALIGN);
+  }
+  return p;
+}
+
+static void xfree(const csv_allocator_t *al, void *ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  if (has_allocator(al)) {
+    al->free(al->context, ptr, size, XALIGN);
+  } else {
+    free(ptr);
+  }
+}
+
+// States of csvx_t::row.
+enum {
+  ROW_START = 0, // not in a row
+  ROW_STARTVAL,  // onerow(): at the start of a value
+  ROW_UNQUOTED,  // onerow(): in a value, outside of quotes
+  ROW_QUOTED,    // onerow(): in a value, inside quotes
+  ROW_INDEXED,   // onerow_indexed(): in a value
 };
 
+/**
+ *  Unquote a value without modifying it. The result is not
+ *  NUL-terminated.
+ */
+static void unquote_readonly(csvx_t *cb, scan_t *scan, csv_value_t *value);
+
 // True if EOF and buffer is empty
 static inline bool finished(const csvx_t *cb) {
   return cb->eof && (cb->buf.bot == cb->buf.top);
@@ -87,6 +330,141 @@ static int read_file(void *context, char *buf, int bufsz, char *errmsg,
   return N;
 }
 
+/////////////////
+// The read-ahead thread.
+static void *ahead_main(void *arg) {
+  ahead_t *ah = (ahead_t *)arg;
+  pthread_mutex_lock(&ah->mu);
+  for (;;) {
+    while (ah->count == ah->nslot && !ah->stop) {
+      pthread_cond_wait(&ah->cond, &ah->mu);
+    }
+    if (ah->stop) {
+      break;
+    }
+
+    // The slot past the tail of the queue is ours; fill it unlocked.
+    int i = (ah->head + ah->count) % ah->nslot;
+    pthread_mutex_unlock(&ah->mu);
+    int N = ah->feed(ah->context, ah->slot[i].ptr, AHEAD_BUFSZ, ah->errmsg,
+                     sizeof(ah->errmsg));
+    pthread_mutex_lock(&ah->mu);
+
+    if (N < 0) {
+      ah->error = true;
+    } else if (N == 0) {
+      ah->eof = true;
+    } else {
+      ah->slot[i].len = N;
+      ah->count++;
+    }
+    pthread_cond_broadcast(&ah->cond);
+    if (ah->error || ah->eof) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ah->mu);
+  return 0;
+}
+
+// A csv_feed_t on the ahead_t in context.
+static int ahead_read(void *context, char *buf, int bufsz, char *errbuf,
+                      int errsz) {
+  ahead_t *ah = (ahead_t *)context;
+  pthread_mutex_lock(&ah->mu);
+  while (ah->count == 0 && !ah->eof && !ah->error) {
+    pthread_cond_wait(&ah->cond, &ah->mu);
+  }
+  bool empty = (ah->count == 0);
+  bool error = ah->error;
+  pthread_mutex_unlock(&ah->mu);
+  if (empty) {
+    // The data before an error has been consumed.
+    if (error) {
+      snprintf(errbuf, errsz, "%s", ah->errmsg);
+      return -1;
+    }
+    return 0;
+  }
+
+  // slot[head] is ours until count is decremented.
+  int h = ah->head;
+  int N = ah->slot[h].len - ah->pos;
+  if (N > bufsz) {
+    N = bufsz;
+  }
+  memcpy(buf, ah->slot[h].ptr + ah->pos, N);
+  ah->pos += N;
+  if (ah->pos == ah->slot[h].len) {
+    pthread_mutex_lock(&ah->mu);
+    ah->pos = 0;
+    ah->head = (h + 1) % ah->nslot;
+    ah->count--;
+    pthread_cond_broadcast(&ah->cond);
+    pthread_mutex_unlock(&ah->mu);
+  }
+  return N;
+}
+
+// Stop the read-ahead thread and release it. The thread finishes the
+// feed() in progress, if any.
+static void ahead_close(ahead_t *ah) {
+  if (!ah) {
+    return;
+  }
+  if (ah->started) {
+    pthread_mutex_lock(&ah->mu);
+    ah->stop = true;
+    pthread_cond_broadcast(&ah->cond);
+    pthread_mutex_unlock(&ah->mu);
+    pthread_join(ah->tid, 0);
+  }
+  pthread_mutex_destroy(&ah->mu);
+  pthread_cond_destroy(&ah->cond);
+  const csv_allocator_t al = ah->al;
+  for (int i = 0; i < ah->nslot; i++) {
+    xfree(&al, ah->slot[i].ptr, AHEAD_BUFSZ);
+  }
+  xfree(&al, ah->slot, ah->nslot * sizeof(*ah->slot));
+  xfree(&al, ah, sizeof(*ah));
+}
+
+// Start a thread that reads nslot buffers ahead with feed(context).
+// The memory comes from al. Return NULL if out of memory or threads.
+static ahead_t *ahead_open(const csv_allocator_t *al, int nslot,
+                           csv_feed_t *feed, void *context) {
+  ahead_t *ah = (ahead_t *)xalloc(al, sizeof(*ah));
+  if (!ah) {
+    return 0;
+  }
+  memset(ah, 0, sizeof(*ah));
+  pthread_mutex_init(&ah->mu, 0);
+  pthread_cond_init(&ah->cond, 0);
+  ah->feed = feed;
+  ah->context = context;
+  ah->al = *al;
+  ah->slot = (ahead_slot_t *)xalloc(al, nslot * sizeof(*ah->slot));
+  if (!ah->slot) {
+    ahead_close(ah);
+    return 0;
+  }
+  memset(ah->slot, 0, nslot * sizeof(*ah->slot));
+  ah->nslot = nslot;
+  for (int i = 0; i < nslot; i++) {
+    ah->slot[i].ptr = (char *)xalloc(al, AHEAD_BUFSZ);
+    if (!ah->slot[i].ptr) {
+      ahead_close(ah);
+      return 0;
+    }
+  }
+  ah->started = (0 == pthread_create(&ah->tid, 0, ahead_main, ah));
+  if (!ah->started) {
+    ahead_close(ah);
+    return 0;
+  }
+  return ah;
+}
+
 /*
  *  Format an error into ebuf[]. Always return -1.
  */
@@ -95,8 +473,9 @@ static int RETERROR(csvx_t *cb, const char *fmt, ...) {
   va_start(args, fmt);
   char *p = cb->ebuf.ptr;
   char *q = p + cb->ebuf.len;
+  int col = (cb->select.map ? cb->select.field : cb->value.top) + 1;
   snprintf(p, q - p, "(line %" PRId64 ", row %" PRId64 ", col %d)",
-           cb->status.lineno, cb->status.rowno, cb->value.top + 1);
+           cb->status.lineno, cb->status.rowno, col);
   p += strlen(p);
   vsnprintf(p, q - p, fmt, args);
   return -1;
@@ -114,9 +493,24 @@ static int expand_value(csvx_t *cb) {
   if (max < 0) {
     return RETERROR(cb, "%s", "buffer overflow");
   }
+  if (cb->mem && !cb->value.ptr) {
+    cb->value.ptr = cb->mem->value;
+    cb->value.max = MEM_NVALUE;
+    return 0;
+  }
 
-  csv_value_t *newval =
-      (csv_value_t *)realloc(cb->value.ptr, max * sizeof(*newval));
+  const csv_allocator_t *al = &cb->conf.allocator;
+  csv_value_t *newval;
+  if (in_mem(cb, cb->value.ptr)) {
+    newval = (csv_value_t *)xalloc(al, max * sizeof(*newval));
+    if (newval) {
+      memcpy(newval, cb->value.ptr, cb->value.top * sizeof(*newval));
+    }
+  } else {
+    newval = (csv_value_t *)xrealloc(al, cb->value.ptr,
+                                     cb->value.max * sizeof(*newval),
+                                     max * sizeof(*newval));
+  }
   if (!newval) {
     return RETERROR(cb, "%s", "out of memory");
   }
@@ -135,71 +529,336 @@ static inline int ensure_value(csvx_t *cb) {
   return 0;
 }
 
+//////////////////
+// make sure cb->value[] can accomodate at least one value, and append
+// value to it.
+static inline int append_value(csvx_t *cb, csv_value_t value) {
+  if (cb->select.map) {
+    // drop the fields not selected
+    int f = cb->select.field++;
+    if (f >= cb->select.nmap || !cb->select.map[f]) {
+      return 0;
+    }
+  }
+  DO(ensure_value(cb));
+  cb->value.ptr[cb->value.top++] = value;
+  return 0;
+}
+
+//////////////////
+// Put the values of a row in the order of conf.select. Columns that are
+// missing from the row are NULL.
+static void project(csvx_t *cb) {
+  csv_value_t *out = cb->select.out;
+  for (int k = 0; k < cb->conf.nselect; k++) {
+    int r = cb->select.rank[k];
+    if (r < cb->value.top) {
+      out[k] = cb->value.ptr[r];
+    } else {
+      memset(&out[k], 0, sizeof(out[k]));
+    }
+  }
+}
+
+//////////////////
+// The data in buf[] moved by delta bytes in memory, and by shift bytes
+// in offset. Adjust the row in progress to match.
+static void move_row(csvx_t *cb, intptr_t delta, int shift) {
+  cb->sidx.scanned -= shift;
+  if (cb->row.state == ROW_START) {
+    return;
+  }
+  // the structural index is fully consumed when a row is suspended
+  assert(cb->sidx.next == cb->sidx.top);
+  cb->row.scanoff -= shift;
+  cb->row.value.ptr += delta;
+  for (int i = 0; i < cb->value.top; i++) {
+    cb->value.ptr[i].ptr += delta;
+  }
+}
+
+// The smallest buf[] that is a ring.
+#define RING_MINSZ (1024 * 1024)
+
+//////////////////
+// Map a ring of sz bytes twice, back to back, so that ptr[i] and
+// ptr[sz + i] are the same byte. sz must be a multiple of the page
+// size. Return NULL on failure, e.g. when memfd_create() fails with
+// ENOSYS or EMFILE; the caller then uses the heap.
+//
+// buf[] is such a ring, so that the data in buf[bot..top) is always
+// contiguous, even when it wraps around. It never has to be squeezed
+// to the front of buf[], which would copy the row in progress again
+// on every refill. The memfd and the three mmap() calls cost more
+// than that copy for a small buf[], so it is a ring only from
+// RING_MINSZ up.
+static char *ring_alloc(int64_t sz) {
+#ifdef __linux__
+  int fd = memfd_create("csvc17", MFD_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  char *ptr = 0;
+  // reserve 2*sz of address space, and map the memfd over both halves
+  void *p = mmap(0, 2 * sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED) {
+    char *lo = (char *)p;
+    char *hi = lo + sz;
+    const int prot = PROT_READ | PROT_WRITE;
+    // The mappings are MAP_SHARED; keep them out of a fork() child,
+    // which would otherwise write into our buf[].
+    if (0 == ftruncate(fd, sz) &&
+        lo == mmap(lo, sz, prot, MAP_SHARED | MAP_FIXED, fd, 0) &&
+        hi == mmap(hi, sz, prot, MAP_SHARED | MAP_FIXED, fd, 0) &&
+        0 == madvise(lo, 2 * sz, MADV_DONTFORK)) {
+      ptr = lo;
+    } else {
+      munmap(p, 2 * sz);
+    }
+  }
+  close(fd);
+  return ptr;
+#else
+  (void)sz;
+  return 0;
+#endif
+}
+
+// The size of the heap block of a buf[] of max bytes.
+#define BUFSIZE(max) (((size_t)(max) + XALIGN - 1) & ~(size_t)(XALIGN - 1))
+
+//////////////////
+// Release buf[].
+static void free_buf(csvx_t *cb) {
+  if (cb->buf.ring) {
+    munmap(cb->buf.ptr, 2 * (int64_t)cb->buf.max);
+  } else if (!cb->buf.mapped) {
+    xfree(&cb->conf.allocator, cb->buf.ptr, BUFSIZE(cb->buf.max));
+  }
+}
+
+//////////////////
+// #bytes that can be appended to buf[] at top.
+static inline int buf_room(const csvx_t *cb) {
+  if (cb->buf.ring) {
+    return cb->buf.bot + cb->buf.max - cb->buf.top;
+  }
+  return cb->buf.max - cb->buf.top;
+}
+
+//////////////////
+// Replace buf[] with a new one of max bytes, holding buf[bot..top) at
+// its front.
+static int grow_buf(csvx_t *cb, int64_t max) {
+  const int N = cb->buf.top - cb->buf.bot;
+  char *newbuf = 0;
+  bool ring = false;
+  // The offsets into a ring go up to 2*max.
+  const int64_t page = sysconf(_SC_PAGESIZE);
+  // Memory from conf.allocator is never a ring.
+  if (RING_MINSZ <= max && max <= INT_MAX / 2 && max % page == 0 &&
+      !has_allocator(&cb->conf.allocator)) {
+    newbuf = ring_alloc(max);
+    ring = (newbuf != 0);
+  }
+  if (!newbuf) {
+    newbuf = (char *)xalloc(&cb->conf.allocator, BUFSIZE(max));
+    if (!newbuf) {
+      return RETERROR(cb, "%s", "out of memory");
+    }
+  }
+
+  char *p = cb->buf.ptr + cb->buf.bot;
+  if (N) {
+    memcpy(newbuf, p, N);
+  }
+  move_row(cb, (intptr_t)newbuf - (intptr_t)p, cb->buf.bot);
+  free_buf(cb);
+  cb->buf.ptr = newbuf;
+  cb->buf.bot = 0;
+  cb->buf.top = N;
+  cb->buf.max = max;
+  cb->buf.ring = ring;
+  return 0;
+}
+
 //////////////////
 // squeeze or grow cb->buf[]
 static int ensure_buf(csvx_t *cb) {
-  int N = cb->buf.top - cb->buf.bot;
-  // first, see if a squeeze is sufficient
-  if (cb->buf.bot) {
-    memmove(cb->buf.ptr, cb->buf.ptr + cb->buf.bot, N);
+  if (cb->buf.ring) {
+    // Once bot passes into the second mapping, move the offsets back
+    // by max. The bytes stay where they are.
+    if (cb->buf.bot >= cb->buf.max) {
+      int shift = cb->buf.max;
+      cb->buf.bot -= shift;
+      cb->buf.top -= shift;
+      move_row(cb, -shift, shift);
+    }
+  } else if (cb->buf.bot) {
+    // first, see if a squeeze is sufficient
+    int N = cb->buf.top - cb->buf.bot;
+    int shift = cb->buf.bot;
+    memmove(cb->buf.ptr, cb->buf.ptr + shift, N);
     cb->buf.bot = 0;
     cb->buf.top = N;
+    move_row(cb, -shift, shift);
+    return 0;
+  }
+
+  // still have room for feed()? Note: 1 byte is reserved for a \n.
+  if (buf_room(cb) > 1) {
     return 0;
   }
 
   // grow buf[]
-  if (cb->buf.max == cb->conf.maxbufsz) {
-    return RETERROR(cb, "%s",
-                    "max row size is larger than maxbufsz of %d bytes",
+  if (cb->buf.max >= cb->conf.maxbufsz) {
+    return RETERROR(cb, "max row size is larger than maxbufsz of %d bytes",
                     cb->conf.maxbufsz);
   }
   int64_t max = cb->buf.max;
   max = (0 == max ? cb->conf.initbufsz : max * 1.5);
+  // whole pages, so that buf[] can be a ring
+  const int64_t page = sysconf(_SC_PAGESIZE);
+  max = (max + page - 1) / page * page;
   if (max > cb->conf.maxbufsz) {
     max = cb->conf.maxbufsz;
   }
+  return grow_buf(cb, max);
+}
 
-  // 16-byte aligned for SIMD
-  void *newbuf = aligned_alloc(16, max);
-  if (!newbuf) {
-    return RETERROR(cb, "%s", "out of memory");
+//////////////////
+// The last row in the mapping is not terminated by a \n. Copy
+// buf[bot..] to the heap and append a \n.
+static int copy_tail(csvx_t *cb) {
+  char *p = cb->buf.ptr + cb->buf.bot;
+  int N = cb->map.ptr + cb->map.len - p;
+  char *newbuf;
+  if (cb->mem && N + 16 <= MEM_TAILSZ) {
+    newbuf = cb->mem->tail;
+  } else {
+    newbuf = (char *)xalloc(&cb->conf.allocator, BUFSIZE(N + 16));
+    if (!newbuf) {
+      return RETERROR(cb, "%s", "out of memory");
+    }
   }
+  memcpy(newbuf, p, N);
+  newbuf[N] = '\n';
+  move_row(cb, newbuf - p, cb->buf.bot);
+  cb->buf.ptr = newbuf;
+  cb->buf.bot = 0;
+  cb->buf.top = N + 1;
+  cb->buf.max = N + 16;
+  cb->buf.mapped = false;
+  cb->eof = true;
+  return 0;
+}
 
-  memcpy(newbuf, cb->buf.ptr, N);
-  free(cb->buf.ptr);
-  cb->buf.ptr = (char *)newbuf;
-  cb->buf.max = max;
+//////////////////
+// Slide buf[] over the mapping so that it starts at the first
+// unconsumed byte and covers up to map.window bytes. Nothing is
+// copied; the row in progress is only rebased.
+static int slide_map(csvx_t *cb) {
+  char *p = cb->buf.ptr + cb->buf.bot;
+  char *end = cb->map.ptr + cb->map.len;
+  int N = cb->buf.top - cb->buf.bot;
+  int64_t len = end - p;
+  if (len > cb->map.window) {
+    len = cb->map.window;
+    if (len == N) {
+      // the row in progress fills the window; widen it.
+      if (cb->map.window == INT_MAX) {
+        return RETERROR(cb, "max row size is larger than %d bytes", INT_MAX);
+      }
+      int64_t window = (int64_t)cb->map.window * 2;
+      cb->map.window = (window > INT_MAX ? INT_MAX : window);
+      len = (end - p < cb->map.window ? end - p : cb->map.window);
+    }
+  }
+
+  bool eof = (p + len == end);
+  if (eof && end[-1] != '\n') {
+    // Stop the window after the last \n. Whatever follows it is the
+    // last row, which goes to the heap so that a \n can be appended.
+    char *nl = p + len - 1;
+    while (nl >= p + N && *nl != '\n') {
+      nl--;
+    }
+    if (nl < p + N) {
+      return copy_tail(cb);
+    }
+    len = nl + 1 - p;
+    eof = false;
+  }
+
+  move_row(cb, 0, cb->buf.bot);
+  cb->buf.ptr = p;
+  cb->buf.bot = 0;
+  cb->buf.top = len;
+  cb->buf.max = len;
+  cb->eof = eof;
   return 0;
 }
 
+///////////////
+// The context to call feed() with.
+static void *feed_context(csvx_t *cb, csv_feed_t *feed, void *context) {
+  (void)feed;
+  if (cb->fp) {
+    // HACK: this is a hack for csv_parse_file.
+    // If cb->fp is set, use this as context to call read_file().
+    assert((void *)feed == (void *)read_file);
+    return cb->fp;
+  }
+  if (cb->uring) {
+    assert((void *)feed == (void *)uring_read);
+    return cb->uring;
+  }
+  if (cb->decode) {
+    assert((void *)feed == (void *)decode_read);
+    return cb->decode;
+  }
+  return context;
+}
+
+///////////////
+// At EOF, add a newline if the last row is not terminated properly.
+// buf[] always has 1 byte reserved for it.
+static void end_buf(csvx_t *cb) {
+  // value of last byte in buf[]
+  int finbyte = (cb->buf.bot < cb->buf.top ? cb->buf.ptr[cb->buf.top - 1] : 0);
+
+  // if last byte is not \n, then: add a newline
+  if (finbyte && finbyte != '\n') {
+    assert(buf_room(cb) > 0);
+    cb->buf.ptr[cb->buf.top++] = '\n';
+  }
+}
+
 ///////////////
 // fill cb->buf[]. Return 0 on success, -1 otherwise.
 static int fill_buf(csvx_t *cb, void *context, csv_feed_t *feed) {
   assert(!cb->eof);
+  if (cb->map.ptr) {
+    return slide_map(cb);
+  }
   DO(ensure_buf(cb));
   char *p = cb->buf.ptr + cb->buf.top;
-  char *q = cb->buf.ptr + cb->buf.max;
-  if (cb->fp) {
-    // HACK: this is a hack for csv_parse_file.
-    // If cb->fp is set, use this as context to call read_file().
-    assert((void *)feed == (void *)read_file);
-    context = cb->fp;
+  if (cb->ahead) {
+    // feed() runs on the read-ahead thread.
+    feed = ahead_read;
+    context = cb->ahead;
+  } else {
+    context = feed_context(cb, feed, context);
   }
-  int N = q - p;
   // reserve 1 byte to add a \n if last row not terminated properly
-  N = feed(context, p, N - 1, cb->ebuf.ptr, cb->ebuf.len);
+  int N = feed(context, p, buf_room(cb) - 1, cb->ebuf.ptr, cb->ebuf.len);
   if (N < 0) {
     return -1;
   }
   cb->eof = (N == 0);
   cb->buf.top += N;
-
-  // value of last byte in buf[]
-  int finbyte = (cb->buf.bot < cb->buf.top ? cb->buf.ptr[cb->buf.top - 1] : 0);
-
-  // if at EOF and last byte is not \n, then: add a newline
-  if (cb->eof && finbyte && finbyte != '\n') {
-    cb->buf.ptr[cb->buf.top++] = '\n';
+  if (cb->eof) {
+    end_buf(cb);
   }
   return 0;
 }
@@ -223,27 +882,48 @@ static int fill_buf(csvx_t *cb, void *context, csv_feed_t *feed) {
 
 */
 // Scan one row. Return 1 on success, 0 if there are not enough data
-// to make a row, or -1 on error.  This call will corrupt cb->status
-// on error.
-static int onerow(scan_t *scan, csvx_t *cb) {
+// to make a row, or -1 on error. On success, *rowend is set to the
+// offset in buf.ptr[] just past the row.
+//
+// When the data runs out in the middle of a row, the state is saved in
+// cb->row, and the next call resumes from it. The caller must then
+// reset the scan at cb->row.scanoff.
+static int onerow(scan_t *scan, csvx_t *cb, int *rowend) {
   const char esc = cb->conf.esc;
   const char qte = cb->conf.qte;
   const char delim = cb->conf.delim;
 
   const char *pp = 0; // current
   char ch;            // char at *pp
+  csv_value_t value;  // current value
+
+  switch (cb->row.state) {
+  case ROW_STARTVAL:
+    goto STARTVAL;
+  case ROW_UNQUOTED:
+    value = cb->row.value;
+    goto UNQUOTED;
+  case ROW_QUOTED:
+    value = cb->row.value;
+    goto QUOTED;
+  }
 
+  if (scan->p >= scan->q) {
+    return 0;
+  }
   cb->value.top = 0;
+  cb->select.field = 0;
   cb->status.rowno++;
   cb->status.lineno++;
 
 STARTVAL:
   pp = scan->p;
   if (pp >= scan->q) {
-    return 0;
+    // out of data...
+    cb->row.state = ROW_STARTVAL;
+    goto SUSPEND;
   }
 
-  csv_value_t value;
   memset(&value, 0, sizeof(value));
   value.ptr = (char *)pp;
   goto UNQUOTED;
@@ -254,7 +934,8 @@ UNQUOTED:
   // ch in [0, \n, delim, qte, or esc]
   if (ch == 0) {
     // out of data...
-    return cb->eof ? RETERROR(cb, "%s", "unterminated row") : 0;
+    cb->row.state = ROW_UNQUOTED;
+    goto SUSPEND;
   }
 
   if (ch == qte)
@@ -276,7 +957,8 @@ QUOTED:
   // ch in [0, \n, delim, qte, or esc]
   if (ch == 0) {
     // out of data...
-    return cb->eof ? RETERROR(cb, "%s", "unterminated quote") : 0;
+    cb->row.state = ROW_QUOTED;
+    goto SUSPEND;
   }
   if (ch == '\n') {
     cb->status.lineno++;
@@ -286,10 +968,20 @@ QUOTED:
     goto QUOTED;
   }
 
-  // eq or ee: escape the next char
-  if (ch == esc && (scan_match(scan, esc) || scan_match(scan, qte))) {
-    (void)scan_next(scan); // escaped
-    goto QUOTED;
+  if (ch == esc) {
+    // need the next char to decide; rescan the esc when more data
+    // arrives.
+    if (scan->p >= scan->q && !cb->eof) {
+      scan->p = pp;
+      cb->row.state = ROW_QUOTED;
+      goto SUSPEND;
+    }
+    // eq or ee: escape the next char
+    if (scan->p < scan->q &&
+        (scan_match(scan, esc) || scan_match(scan, qte))) {
+      (void)scan_next(scan); // escaped
+      goto QUOTED;
+    }
   }
 
   // q: exit QUOTED state
@@ -306,8 +998,7 @@ QUOTED:
 ENDVAL:
   // record the val
   value.len = pp - value.ptr;
-  DO(ensure_value(cb));
-  cb->value.ptr[cb->value.top++] = value;
+  DO(append_value(cb, value));
 
   // start next val
   goto STARTVAL;
@@ -320,177 +1011,1768 @@ ENDROW:
   }
 
   // record the val
-  DO(ensure_value(cb));
-  cb->value.ptr[cb->value.top++] = value;
+  DO(append_value(cb, value));
 
+  cb->row.state = ROW_START;
+  *rowend = scan->p - cb->buf.ptr;
   return 1;
+
+SUSPEND:
+  if (cb->eof) {
+    return RETERROR(cb, "%s",
+                    cb->row.state == ROW_QUOTED ? "unterminated quote"
+                                                : "unterminated row");
+  }
+  cb->row.scanoff = scan->p - cb->buf.ptr;
+  cb->row.value = value;
+  return 0;
 }
 
-int csv_parse(csv_t *csv, void *context, csv_feed_t *feed,
-              csv_perrow_t *perrow) {
-  if (!csv->ok) {
-    assert(csv->errmsg[0]);
-    return -1;
+//////////////////
+// Empty tmp[] and make sure it can hold at least n bytes.
+static int ensure_tmp(csvx_t *cb, int64_t n) {
+  cb->tmp.top = 0;
+  if (n <= cb->tmp.max) {
+    return 0;
   }
-  csv->ok = false;
-  csv->errmsg[0] = 0;
+  if (cb->mem && !cb->tmp.ptr && n <= MEM_TMPSZ) {
+    cb->tmp.ptr = cb->mem->tmp;
+    cb->tmp.max = MEM_TMPSZ;
+    return 0;
+  }
+  int64_t max = cb->tmp.max * 1.5;
+  if (max < n) {
+    max = n;
+  }
+  if (max > INT_MAX) {
+    return RETERROR(cb, "%s", "buffer overflow");
+  }
+  // tmp[] holds nothing yet, so there is nothing to copy from mem.
+  const csv_allocator_t *al = &cb->conf.allocator;
+  char *newtmp =
+      (char *)(in_mem(cb, cb->tmp.ptr)
+                   ? xalloc(al, max)
+                   : xrealloc(al, cb->tmp.ptr, cb->tmp.max, max));
+  if (!newtmp) {
+    return RETERROR(cb, "%s", "out of memory");
+  }
+  cb->tmp.ptr = newtmp;
+  cb->tmp.max = max;
+  return 0;
+}
 
-  csvx_t *cb = (csvx_t *)csv->__internal;
-  cb->ebuf.ptr = csv->errmsg;
-  cb->ebuf.len = sizeof(csv->errmsg);
+// The size of the block of a column of n rows.
+#define COLSIZE(n, typed)                                                      \
+  ((size_t)(n) * (sizeof(char *) + sizeof(int) + 1 +                           \
+                  ((typed) ? sizeof(int64_t) + 1 : 0)))
 
-  // Set up the scan on rows. Special chars are qte, esc, delim, and newline.
-  char accept[5] = {0};
-  {
-    int i = 0;
-    accept[i++] = cb->conf.qte;
-    accept[i++] = cb->conf.delim;
-    accept[i++] = '\n';
-    accept[i++] = (cb->conf.qte != cb->conf.esc) ? cb->conf.esc : 0;
+//////////////////
+// make sure batch.column[] has at least ncol columns.
+static int ensure_columns(csvx_t *cb, int ncol) {
+  csv_batch_t *b = &cb->batch;
+  const csv_allocator_t *al = &cb->conf.allocator;
+  int n = cb->conf.batchsz;
+  if (!b->lineno) {
+    b->lineno = (int64_t *)xalloc(al, n * sizeof(*b->lineno));
+    if (!b->lineno) {
+      return RETERROR(cb, "%s", "out of memory");
+    }
   }
-  scan_t scan_row = scan_init(accept);
-
-  // Set up the scan for unquote. Special chars are qte and esc only.
-  {
-    int i = 0;
-    accept[i++] = cb->conf.qte;
-    accept[i++] = (cb->conf.qte != cb->conf.esc) ? cb->conf.esc : 0;
-    accept[i++] = 0;
+  if (ncol <= cb->colmax) {
+    return 0;
   }
-  scan_t scan_unquote = scan_init(accept);
-  bool skip_header = (cb->conf.skip_header && cb->status.rowno == 0);
 
-  // keep scanning until EOF
-  while (!finished(cb)) {
-    int N;
-    if (!cb->eof) {
-      // Get more data from source
-      if (fill_buf(cb, context, feed)) {
+  int max = cb->colmax * 1.5 + 10;
+  if (max < ncol) {
+    max = ncol;
+  }
+  csv_column_t *newcol = (csv_column_t *)xrealloc(
+      al, b->column, cb->colcap * sizeof(*newcol), max * sizeof(*newcol));
+  if (!newcol) {
+    return RETERROR(cb, "%s", "out of memory");
+  }
+  b->column = newcol;
+  cb->colcap = max;
+  for (; cb->colmax < max; cb->colmax++) {
+    // one block for ptr[], i64[], len[], quoted[] and flag[]
+    const int i = cb->colmax;
+    const bool typed = (i < cb->conf.nschema && cb->schema[i]);
+    char *mem = (char *)xalloc(al, COLSIZE(n, typed));
+    if (!mem) {
+      return RETERROR(cb, "%s", "out of memory");
+    }
+    csv_column_t *col = &b->column[i];
+    col->ptr = (char **)mem;
+    col->i64 = typed ? (int64_t *)(col->ptr + n) : 0;
+    col->len = typed ? (int *)(col->i64 + n) : (int *)(col->ptr + n);
+    col->quoted = (bool *)(col->len + n);
+    col->flag = typed ? (uint8_t *)(col->quoted + n) : 0;
+  }
+  return 0;
+}
+
+//////////////////
+// Deliver the rows in batch[] to perbatch().
+static int flush_batch(csvx_t *cb, void *context) {
+  if (cb->batch.nrow == 0) {
+    return 0;
+  }
+  int ret = cb->perbatch(context, &cb->batch, cb->ebuf.ptr, cb->ebuf.len);
+  cb->batch.nrow = 0;
+  if (ret) {
+    // Make up an error message if user did not supply one
+    if (!cb->ebuf.ptr[0]) {
+      RETERROR(cb, "%s", "perbatch callback failed");
+    }
+    return -1;
+  }
+  return 0;
+}
+
+//////////////////
+// Append a row to batch[]. Deliver the batch when it is full, or
+// before a row with a different number of values.
+static int add_batch(csvx_t *cb, void *context, const csv_value_t *value,
+                     int ncol) {
+  csv_batch_t *b = &cb->batch;
+  if (b->nrow && b->ncol != ncol) {
+    DO(flush_batch(cb, context));
+  }
+  if (b->nrow == 0) {
+    DO(ensure_columns(cb, ncol));
+    b->ncol = ncol;
+    b->rowno = cb->status.rowno - (cb->conf.skip_header ? 1 : 0);
+  }
+
+  const int r = b->nrow++;
+  b->lineno[r] = cb->status.lineno;
+  for (int i = 0; i < ncol; i++) {
+    csv_column_t *col = &b->column[i];
+    col->ptr[r] = value[i].ptr;
+    col->len[r] = value[i].len;
+    col->quoted[r] = value[i].quoted;
+    if (col->flag) {
+      decode_value(cb->kernel, &cb->conf, cb->schema[i],
+                   cb->scale ? cb->scale[i] : 0, &value[i], col, r);
+    }
+  }
+
+  if (b->nrow == cb->conf.batchsz) {
+    DO(flush_batch(cb, context));
+  }
+  return 0;
+}
+
+/*
+ *  Stage 1: classify buf[] 64 bytes at a time, and append the offsets
+ *  of qte, newline and delims outside of quotes to cb->sidx.ptr[]. See
+ *  __scan_index() in scan.h.
+ *
+ *  This indexes buf.ptr[scanned..top) until either the data or the
+ *  room in sidx.ptr[] runs out.
+ */
+static void index_buf(csvx_t *cb) {
+  cb->sidx.next = 0;
+  cb->sidx.top = cb->kernel->index(cb->buf.ptr, &cb->sidx.scanned,
+                                   cb->buf.top, cb->conf.qte, cb->conf.delim,
+                                   &cb->sidx.inquote, cb->sidx.ptr,
+                                   cb->sidx.max);
+}
+
+/*
+ *  Stage 2: turn the offsets built by index_buf() into one row of
+ *  values. Same return values as onerow(). On success, *rowend is set
+ *  to the offset in buf.ptr[] just past the row.
+ *
+ *  When the data runs out in the middle of a row, the state is saved
+ *  in cb->row. Since stage 1 continues from sidx.scanned, the next
+ *  call resumes without rescanning.
+ */
+static int onerow_indexed(csvx_t *cb, int *rowend) {
+  const char delim = cb->conf.delim;
+  char *const buf = cb->buf.ptr;
+  bool inquote = false;
+  csv_value_t value;
+
+  if (cb->row.state == ROW_INDEXED) {
+    // resume a suspended row
+    value = cb->row.value;
+    inquote = cb->row.inquote;
+  } else {
+    if (cb->buf.bot >= cb->buf.top) {
+      return 0;
+    }
+    cb->value.top = 0;
+    cb->select.field = 0;
+    cb->status.rowno++;
+    cb->status.lineno++;
+    memset(&value, 0, sizeof(value));
+    value.ptr = buf + cb->buf.bot;
+  }
+
+  // keep the index cursor in locals; appending to value[] would
+  // otherwise force a reload on every iteration.
+  const uint32_t *const idx = cb->sidx.ptr;
+  int next = cb->sidx.next;
+  int top = cb->sidx.top;
+  for (;;) {
+    if (next == top) {
+      if (cb->sidx.scanned == cb->buf.top) {
+        // out of data...
+        cb->sidx.next = next;
+        if (!cb->eof) {
+          cb->row.state = ROW_INDEXED;
+          cb->row.value = value;
+          cb->row.inquote = inquote;
+          return 0;
+        }
+        return RETERROR(cb, "%s",
+                        inquote ? "unterminated quote" : "unterminated row");
+      }
+      index_buf(cb);
+      next = cb->sidx.next;
+      top = cb->sidx.top;
+      continue;
+    }
+
+    int off = idx[next++];
+    char ch = buf[off];
+    if (ch == delim) {
+      value.len = buf + off - value.ptr;
+      DO(append_value(cb, value));
+      value.ptr = buf + off + 1;
+      value.quoted = false;
+      continue;
+    }
+
+    if (ch == '\n') {
+      if (inquote) {
+        cb->status.lineno++;
+        continue;
+      }
+      // handle \r\n
+      value.len = buf + off - value.ptr;
+      if (value.len && value.ptr[value.len - 1] == '\r') {
+        value.len--;
+      }
+      DO(append_value(cb, value));
+      cb->sidx.next = next;
+      cb->row.state = ROW_START;
+      *rowend = off + 1;
+      return 1;
+    }
+
+    assert(ch == cb->conf.qte);
+    value.quoted = true;
+    inquote = !inquote;
+  }
+}
+
+//////////////////
+// Get csv ready for a call to csv_parse() or csv_push(), and set up
+// the scans on rows and for unquote. Return 0 on success, -1
+// otherwise.
+static int begin_parse(csv_t *csv, scan_t *scan_row, scan_t *scan_unquote) {
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    return -1;
+  }
+  csv->ok = false;
+  csv->errmsg[0] = 0;
+
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  cb->ebuf.ptr = csv->errmsg;
+  cb->ebuf.len = sizeof(csv->errmsg);
+
+  *scan_row = cb->scan_row;
+  *scan_unquote = cb->scan_unquote;
+
+  // The structural index holds offsets into buf.ptr[].
+  if (cb->indexed && !cb->sidx.ptr && cb->mem) {
+    cb->sidx.ptr = cb->mem->sidx;
+    cb->sidx.max = MEM_NSIDX;
+  }
+  if (cb->indexed && !cb->sidx.ptr) {
+    cb->sidx.max = 4096;
+    cb->sidx.ptr = (uint32_t *)xalloc(&cb->conf.allocator,
+                                      cb->sidx.max * sizeof(*cb->sidx.ptr));
+    if (!cb->sidx.ptr) {
+      return RETERROR(cb, "%s", "out of memory");
+    }
+  }
+  return 0;
+}
+
+//////////////////
+// Deliver the whole rows in buf[bot..top) to perrow(), or to
+// add_batch() if cb->perbatch is set. A partial row at the end is
+// suspended in cb->row. Return 0 on success, -1 otherwise.
+static int parse_rows(csvx_t *cb, scan_t *scan_row, scan_t *scan_unquote,
+                      void *context, csv_perrow_t *perrow) {
+  // Set up a scan of the cb->buf[], resuming the row in progress if
+  // any. Note: the structural index resumes by itself.
+  if (!cb->indexed) {
+    int off = (cb->row.state == ROW_START ? cb->buf.bot : cb->row.scanoff);
+    scan_reset(scan_row, cb->buf.ptr + off, cb->buf.top - off);
+    assert(scan_row->p <= scan_row->q);
+  }
+
+  // Scan buf[] row by row
+  for (;;) {
+    int rowend = 0;
+
+    // Get one row
+    int N = cb->indexed ? onerow_indexed(cb, &rowend)
+                        : onerow(scan_row, cb, &rowend);
+    if (N <= 0) {
+      // On 0, there is insufficient data in cb->buf[] to fill one
+      // row. The caller will fill the buffer and resume.
+      return N;
+    }
+
+    // Got a value! Advance the buffer.
+    assert(N == 1);
+    int rowsz = rowend - cb->buf.bot;
+    cb->buf.bot = rowend;
+
+    // The header is the first row of the input.
+    if (cb->conf.skip_header && cb->status.rowno == 1) {
+      continue;
+    }
+
+    // Unquote the values.
+    if (cb->conf.unquote_values) {
+      if (cb->readonly) {
+        // Values copied into tmp[] must stay until delivered. Each
+        // takes len + 1 bytes.
+        int64_t need = rowsz + cb->value.top;
+        if (cb->batch.nrow == 0) {
+          cb->tmp.top = 0;
+        }
+        if (cb->tmp.top + need > cb->tmp.max) {
+          // tmp[] may move
+          DO(flush_batch(cb, context));
+          DO(ensure_tmp(cb, need));
+        }
+        for (int i = 0; i < cb->value.top; i++) {
+          unquote_readonly(cb, scan_unquote, &cb->value.ptr[i]);
+        }
+      } else {
+        for (int i = 0; i < cb->value.top; i++) {
+          unquote(scan_unquote, &cb->value.ptr[i], &cb->conf);
+        }
+      }
+    }
+
+    // The row to deliver
+    csv_value_t *row = cb->value.ptr;
+    int ncol = cb->value.top;
+    if (cb->select.map) {
+      project(cb);
+      row = cb->select.out;
+      ncol = cb->conf.nselect;
+    }
+    if (cb->perbatch) {
+      DO(add_batch(cb, context, row, ncol));
+      continue;
+    }
+
+    if (cb->stop && __atomic_load_n(cb->stop, __ATOMIC_ACQUIRE)) {
+      cb->stopped = true;
+      return RETERROR(cb, "%s", "stopped by an error in another chunk");
+    }
+
+    // Invoke the callback to process the current row
+    if (perrow(context, ncol, row, cb->status.lineno,
+               cb->status.rowno - (cb->conf.skip_header ? 1 : 0),
+               cb->ebuf.ptr, cb->ebuf.len)) {
+      // Make up an error message if user did not supply one
+      if (!cb->ebuf.ptr[0]) {
+        RETERROR(cb, "%s", "perrow callback failed");
+      }
+      if (cb->stop) {
+        // at once, as the rows of the other chunks have side effects
+        __atomic_store_n(cb->stop, 1, __ATOMIC_RELEASE);
+      }
+      return -1;
+    }
+  }
+}
+
+int csv_parse(csv_t *csv, void *context, csv_feed_t *feed,
+              csv_perrow_t *perrow) {
+  int rc = -1;
+  csvx_t *cb = 0;
+  scan_t scan_row, scan_unquote;
+  if (begin_parse(csv, &scan_row, &scan_unquote)) {
+    goto bail;
+  }
+  cb = (csvx_t *)csv->__internal;
+
+  {
+    int nslot = cb->conf.readahead;
+    if (nslot <= 0 && cb->decode) {
+      // decode on a thread of its own, so that it overlaps the scan
+      nslot = DECODE_AHEAD;
+    }
+    if (nslot > 0 && !cb->eof && !cb->map.ptr) {
+      cb->ahead = ahead_open(&cb->conf.allocator, nslot, feed,
+                             feed_context(cb, feed, context));
+      if (!cb->ahead) {
+        RETERROR(cb, "%s", "cannot start read-ahead thread");
         goto bail;
       }
-      assert(cb->buf.bot <= cb->buf.top);
     }
 
-    // Set up a scan of the cb->buf[]
-    scan_reset(&scan_row, cb->buf.ptr + cb->buf.bot, cb->buf.top - cb->buf.bot);
-    assert(scan_row.p <= scan_row.q);
+    // keep scanning until EOF
+    while (!finished(cb)) {
+      if (!cb->eof) {
+        // Get more data from source. The values of a pending batch
+        // point into buf[], which may move; deliver them first.
+        if (flush_batch(cb, context) || fill_buf(cb, context, feed)) {
+          goto bail;
+        }
+        assert(cb->buf.bot <= cb->buf.top);
+      }
+
+      if (parse_rows(cb, &scan_row, &scan_unquote, context, perrow)) {
+        goto bail;
+      }
+    }
+
+    if (flush_batch(cb, context)) {
+      goto bail;
+    }
+  }
+  rc = 0;
+
+bail:
+  // Every exit stops the read-ahead thread; it would otherwise go on
+  // calling feed() with context after we return.
+  if (cb) {
+    ahead_close(cb->ahead);
+    cb->ahead = 0;
+  }
+  assert(rc == 0 || csv->errmsg[0]);
+  csv->ok = (rc == 0);
+  return rc;
+}
+
+//////////////////
+// Check that the handle can take more input from csv_push() or
+// csv_finish(), named by fn, and say why not otherwise.
+static int check_push(csvx_t *cb, const char *fn) {
+  if (cb->readonly || cb->map.ptr) {
+    return RETERROR(cb, "%s() cannot continue a parse of a mapping or "
+                        "memory; call csv_reset() first",
+                    fn);
+  }
+  if (cb->fp) {
+    return RETERROR(cb, "%s() cannot continue a parse of a FILE; call "
+                        "csv_reset() first",
+                    fn);
+  }
+  if (cb->eof) {
+    return RETERROR(cb, "%s() requires a handle not at EOF; call "
+                        "csv_reset() first",
+                    fn);
+  }
+  return 0;
+}
+
+int csv_push(csv_t *csv, const char *buf, int len, void *context,
+             csv_perrow_t *perrow) {
+  scan_t scan_row, scan_unquote;
+  if (begin_parse(csv, &scan_row, &scan_unquote)) {
+    goto bail;
+  }
+
+  {
+    csvx_t *cb = (csvx_t *)csv->__internal;
+    if (check_push(cb, "csv_push")) {
+      goto bail;
+    }
+    if (len < 0) {
+      RETERROR(cb, "%s", "csv_push() given a negative len");
+      goto bail;
+    }
+
+    // Copy buf[] into cb->buf[] as room permits, and deliver the rows
+    // completed by each piece.
+    while (len > 0) {
+      if (ensure_buf(cb)) {
+        goto bail;
+      }
+      // reserve 1 byte to add a \n if last row not terminated properly
+      int n = buf_room(cb) - 1;
+      if (n <= 0) {
+        // ensure_buf() only squeezed; it will grow buf[] next time.
+        continue;
+      }
+      if (n > len) {
+        n = len;
+      }
+      memcpy(cb->buf.ptr + cb->buf.top, buf, n);
+      cb->buf.top += n;
+      buf += n;
+      len -= n;
+      if (parse_rows(cb, &scan_row, &scan_unquote, context, perrow)) {
+        goto bail;
+      }
+    }
+  }
+
+  csv->ok = true;
+  return 0;
+
+bail:
+  assert(csv->errmsg[0]);
+  csv->ok = false;
+  return -1;
+}
+
+int csv_finish(csv_t *csv, void *context, csv_perrow_t *perrow) {
+  scan_t scan_row, scan_unquote;
+  if (begin_parse(csv, &scan_row, &scan_unquote)) {
+    goto bail;
+  }
+
+  {
+    csvx_t *cb = (csvx_t *)csv->__internal;
+    if (check_push(cb, "csv_finish")) {
+      goto bail;
+    }
+    cb->eof = true;
+    end_buf(cb);
+    if (parse_rows(cb, &scan_row, &scan_unquote, context, perrow)) {
+      goto bail;
+    }
+    assert(finished(cb));
+  }
+
+  csv->ok = true;
+  return 0;
+
+bail:
+  assert(csv->errmsg[0]);
+  csv->ok = false;
+  return -1;
+}
+
+//////////////////
+// Build cb->select from conf.select. Return 0 on success, -1 otherwise
+// with a message in errbuf[].
+static int open_select(csvx_t *cb, char *errbuf, int errsz) {
+  const int n = cb->conf.nselect;
+  int nmap = 0;
+  for (int k = 0; k < n; k++) {
+    int c = cb->conf.select[k];
+    if (c < 0) {
+      snprintf(errbuf, errsz, "invalid column %d in select", c);
+      return -1;
+    }
+    if (c >= nmap) {
+      nmap = c + 1;
+    }
+  }
+
+  // keep a copy of conf.select, which is not owned
+  const csv_allocator_t *al = &cb->conf.allocator;
+  int *col = (int *)xalloc(al, n * sizeof(int));
+  cb->select.map = (bool *)xalloc(al, nmap * sizeof(bool));
+  cb->select.rank = (int *)xalloc(al, n * sizeof(int));
+  cb->select.out = (csv_value_t *)xalloc(al, n * sizeof(csv_value_t));
+  cb->select.col = col;
+  cb->select.nmap = nmap;
+  if (!col || !cb->select.map || !cb->select.rank || !cb->select.out) {
+    snprintf(errbuf, errsz, "%s", "out of memory");
+    return -1;
+  }
+  memset(cb->select.map, 0, nmap * sizeof(bool));
+  memcpy(col, cb->conf.select, n * sizeof(int));
+  cb->conf.select = col;
+  for (int k = 0; k < n; k++) {
+    cb->select.map[col[k]] = true;
+  }
+  // The selected fields are stored in field order, so column k is at
+  // #selected fields before col[k].
+  for (int k = 0; k < n; k++) {
+    int r = 0;
+    for (int f = 0; f < col[k]; f++) {
+      r += cb->select.map[f];
+    }
+    cb->select.rank[k] = r;
+  }
+  return 0;
+}
+
+//////////////////
+// Check conf.schema, and keep a copy of it. Return 0 on success, -1
+// otherwise.
+static int open_schema(csvx_t *cb, char *errbuf, int errsz) {
+  const int n = cb->conf.nschema;
+  if (cb->conf.scale && cb->conf.nscale != n) {
+    snprintf(errbuf, errsz, "nscale %d does not match nschema %d",
+             cb->conf.nscale, n);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    const csv_type_t t = cb->conf.schema[i];
+    if (t < CSV_TYPE_TEXT || t > CSV_TYPE_DECIMAL) {
+      snprintf(errbuf, errsz, "invalid type %d in schema", (int)t);
+      return -1;
+    }
+    // the largest scale of which 1 fits in an int64
+    const int scale = cb->conf.scale ? cb->conf.scale[i] : 0;
+    if (scale < 0 || scale > 18) {
+      snprintf(errbuf, errsz, "invalid scale %d in schema", scale);
+      return -1;
+    }
+  }
+  if (!cb->conf.unquote_values) {
+    snprintf(errbuf, errsz, "%s", "schema requires unquote_values");
+    return -1;
+  }
+  cb->schema =
+      (csv_type_t *)xalloc(&cb->conf.allocator, n * sizeof(csv_type_t));
+  if (!cb->schema) {
+    snprintf(errbuf, errsz, "%s", "out of memory");
+    return -1;
+  }
+  memcpy(cb->schema, cb->conf.schema, n * sizeof(csv_type_t));
+  cb->conf.schema = cb->schema;
+  if (cb->conf.scale) {
+    cb->scale = (int *)xalloc(&cb->conf.allocator, n * sizeof(int));
+    if (!cb->scale) {
+      snprintf(errbuf, errsz, "%s", "out of memory");
+      return -1;
+    }
+    memcpy(cb->scale, cb->conf.scale, n * sizeof(int));
+    cb->conf.scale = cb->scale;
+  }
+  return 0;
+}
+
+csv_t csv_open(const csv_config_t *conf) {
+  csv_t ret;
+  memset(&ret, 0, sizeof(ret));
+  csv_allocator_t al;
+  memset(&al, 0, sizeof(al));
+  if (conf) {
+    al = conf->allocator;
+  }
+  csvx_t *cb = (csvx_t *)xalloc(&al, sizeof(*cb));
+  if (!cb) {
+    snprintf(ret.errmsg, sizeof(ret.errmsg), "%s", "out of memory");
+    return ret;
+  }
+  memset(cb, 0, sizeof(*cb));
+  ret.__internal = cb;
+
+  cb->conf = conf ? *conf : csv_default_config();
+  cb->indexed = (cb->conf.qte == cb->conf.esc);
+  cb->kernel = scan_kernel(cb->conf.kernel);
+  if (!cb->kernel) {
+    snprintf(ret.errmsg, sizeof(ret.errmsg), "%s",
+             "SIMD kernel not supported by this cpu");
+    return ret;
+  }
+
+  // Set up the scan on rows. Special chars are qte, esc, delim, and newline.
+  char accept[5] = {0};
+  {
+    int i = 0;
+    accept[i++] = cb->conf.qte;
+    accept[i++] = cb->conf.delim;
+    accept[i++] = '\n';
+    accept[i++] = (cb->conf.qte != cb->conf.esc) ? cb->conf.esc : 0;
+  }
+  cb->scan_row = scan_init(accept, cb->kernel);
+
+  // Set up the scan for unquote. Special chars are qte and esc only.
+  {
+    int i = 0;
+    accept[i++] = cb->conf.qte;
+    accept[i++] = (cb->conf.qte != cb->conf.esc) ? cb->conf.esc : 0;
+    accept[i++] = 0;
+  }
+  cb->scan_unquote = scan_init(accept, cb->kernel);
+
+  if (cb->conf.select && cb->conf.nselect > 0) {
+    if (open_select(cb, ret.errmsg, sizeof(ret.errmsg))) {
+      return ret;
+    }
+  } else {
+    cb->conf.select = 0;
+    cb->conf.nselect = 0;
+  }
+  if (cb->conf.schema && cb->conf.nschema > 0) {
+    if (open_schema(cb, ret.errmsg, sizeof(ret.errmsg))) {
+      return ret;
+    }
+  } else {
+    cb->conf.schema = 0;
+    cb->conf.nschema = 0;
+    cb->conf.scale = 0;
+    cb->conf.nscale = 0;
+  }
+  cb->opened = true;
+  ret.ok = true;
+  return ret;
+}
+
+//////////////////
+// Stop the read-ahead thread, and close the input of
+// csv_parse_file() or csv_parse_file_ex().
+static void close_input(csvx_t *cb) {
+  // first, as the thread may be reading fp, uring or decode
+  ahead_close(cb->ahead);
+  cb->ahead = 0;
+  if (cb->fp) {
+    fclose(cb->fp);
+    cb->fp = 0;
+  }
+  if (cb->uring) {
+    uring_close(cb->uring);
+    xfree(&cb->conf.allocator, cb->uring, sizeof(uring_t));
+    cb->uring = 0;
+  }
+  if (cb->decode) {
+    xfree(&cb->conf.allocator, cb->decode->in, DECODE_INSZ);
+    decode_close(cb->decode);
+    xfree(&cb->conf.allocator, cb->decode, sizeof(decode_t));
+    cb->decode = 0;
+  }
+}
+
+int csv_reset(csv_t *csv) {
+  csvx_t *cb = (csvx_t *)(csv ? csv->__internal : 0);
+  if (!cb || !cb->opened) {
+    // csv_open() failed; keep its errmsg
+    return -1;
+  }
+  close_input(cb);
+
+  // Keep a buf[] of our own, emptied. Forget one that points into a
+  // mapping or a segment.
+  if (cb->buf.mapped) {
+    memset(&cb->buf, 0, sizeof(cb->buf));
+  }
+  cb->buf.bot = cb->buf.top = 0;
+  if (cb->map.owned) {
+    munmap(cb->map.ptr, cb->map.len);
+  }
+  memset(&cb->map, 0, sizeof(cb->map));
+
+  // Keep the arrays, and rewind everything else.
+  cb->tmp.top = 0;
+  cb->value.top = 0;
+  cb->select.field = 0;
+  cb->sidx.next = cb->sidx.top = cb->sidx.scanned = 0;
+  cb->sidx.inquote = 0;
+  memset(&cb->row, 0, sizeof(cb->row));
+  cb->row.state = ROW_START;
+  cb->perbatch = 0;
+  cb->batch.nrow = cb->batch.ncol = 0;
+  cb->batch.rowno = 0;
+  memset(&cb->status, 0, sizeof(cb->status));
+  memset(&cb->ebuf, 0, sizeof(cb->ebuf));
+  cb->eof = false;
+  cb->readonly = false;
+  assert(!cb->mem);
+
+  csv->ok = true;
+  csv->errmsg[0] = 0;
+  return 0;
+}
+
+void csv_close(csv_t *csv) {
+  if (csv && csv->__internal) {
+    csvx_t *cb = (csvx_t *)csv->__internal;
+    close_input(cb);
+    free_buf(cb);
+    if (cb->map.owned) {
+      munmap(cb->map.ptr, cb->map.len);
+    }
+    // cb itself is freed last, so keep a copy of the allocator
+    const csv_allocator_t al = cb->conf.allocator;
+    xfree(&al, cb->tmp.ptr, cb->tmp.max);
+    for (int i = 0; i < cb->colmax; i++) {
+      const bool typed = (cb->batch.column[i].flag != 0);
+      xfree(&al, cb->batch.column[i].ptr, COLSIZE(cb->conf.batchsz, typed));
+    }
+    xfree(&al, cb->batch.column, cb->colcap * sizeof(csv_column_t));
+    xfree(&al, cb->batch.lineno, cb->conf.batchsz * sizeof(int64_t));
+    xfree(&al, cb->value.ptr, cb->value.max * sizeof(csv_value_t));
+    const int nselect = cb->conf.nselect;
+    xfree(&al, cb->select.col, nselect * sizeof(int));
+    xfree(&al, cb->select.map, cb->select.nmap * sizeof(bool));
+    xfree(&al, cb->select.rank, nselect * sizeof(int));
+    xfree(&al, cb->select.out, nselect * sizeof(csv_value_t));
+    xfree(&al, cb->sidx.ptr, cb->sidx.max * sizeof(uint32_t));
+    xfree(&al, cb->schema, cb->conf.nschema * sizeof(csv_type_t));
+    xfree(&al, cb->scale, cb->conf.nscale * sizeof(int));
+    xfree(&al, cb, sizeof(*cb));
+    csv->__internal = NULL;
+  }
+}
+
+const char *csv_kernel_name(const csv_t *csv) {
+  const csvx_t *cb = (const csvx_t *)csv->__internal;
+  return (cb && cb->kernel) ? cb->kernel->name : "";
+}
+
+int csv_parse_batch(csv_t *csv, void *context, csv_feed_t *feed,
+                    csv_perbatch_t *perbatch) {
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    return -1;
+  }
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  if (cb->conf.batchsz <= 0) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s",
+             "batchsz must be positive");
+    csv->ok = false;
+    return -1;
+  }
+  cb->perbatch = perbatch;
+  return csv_parse(csv, context, feed, 0);
+}
+
+int csv_parse_file(csv_t *csv, FILE *fp, void *context, csv_perrow_t *perrow) {
+  /* Note: we own fp now. Make sure it is closed here or
+   * in csv_close(). */
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    fclose(fp);
+    return -1;
+  }
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  cb->ebuf.ptr = csv->errmsg;
+  cb->ebuf.len = sizeof(csv->errmsg);
+
+  if (cb->fp) {
+    fclose(cb->fp);
+    cb->fp = 0;
+  }
+
+  cb->fp = fp;
+  return csv_parse(csv, context, read_file, perrow);
+}
+
+int csv_parse_file_ex(csv_t *csv, const char *path, void *context,
+                      csv_perrow_t *perrow) {
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    return -1;
+  }
+
+  // Decode a compressed file. Otherwise, read ahead through io_uring if
+  // possible, or use stdio.
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  if (!cb->fp && !cb->uring && !cb->decode) {
+    const csv_allocator_t *al = &cb->conf.allocator;
+    decode_t *d = (decode_t *)xalloc(al, sizeof(*d));
+    if (!d) {
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+      csv->ok = false;
+      return -1;
+    }
+    int rc = decode_open(d, path, csv->errmsg, sizeof(csv->errmsg));
+    if (rc > 0) {
+      d->in = (char *)xalloc(al, DECODE_INSZ);
+      if (d->in) {
+        cb->decode = d;
+        return csv_parse(csv, context, decode_read, perrow);
+      }
+      decode_close(d);
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+      rc = -1;
+    }
+    xfree(al, d, sizeof(*d));
+    if (rc < 0) {
+      csv->ok = false;
+      return -1;
+    }
+
+    uring_t *ur = (uring_t *)xalloc(al, sizeof(*ur));
+    if (ur && 0 == uring_open(ur, path)) {
+      cb->uring = ur;
+      return csv_parse(csv, context, uring_read, perrow);
+    }
+    xfree(al, ur, sizeof(*ur));
+  }
+
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "fopen failed - %s",
+             strerror(errno));
+    csv->ok = false;
+    return -1;
+  }
+
+  return csv_parse_file(csv, fp, context, perrow);
+}
+
+//////////////////
+// Map the file at path into memory. On success, *ptr and *len are set;
+// *ptr is NULL for an empty file. Return 0 on success, -1 otherwise.
+static int map_file(csv_t *csv, const char *path, char **ptr, int64_t *len) {
+  *ptr = 0;
+  *len = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "open failed - %s",
+             strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "fstat failed - %s",
+             strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size > 0) {
+    void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "mmap failed - %s",
+               strerror(errno));
+      close(fd);
+      return -1;
+    }
+    // These are hints only; ignore failures.
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(p, st.st_size, MADV_HUGEPAGE);
+#endif
+    *ptr = (char *)p;
+    *len = st.st_size;
+  }
+  // the mapping stays valid after close()
+  close(fd);
+  return 0;
+}
+
+//////////////////
+// True if csv has not been used by any parse since csv_open() or
+// csv_reset(). The empty buf[] kept by csv_reset() does not count.
+static bool is_new(const csv_t *csv) {
+  const csvx_t *cb = (const csvx_t *)csv->__internal;
+  return !(cb->map.ptr || cb->buf.mapped || cb->buf.top || cb->eof ||
+           cb->status.lineno);
+}
+
+//////////////////
+// Parse ptr[0..len) in place. The memory is not modified, and is not
+// owned by csv.
+static int parse_range(csv_t *csv, char *ptr, int64_t len, void *context,
+                       csv_perrow_t *perrow) {
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  // The range is scanned in place; drop a buf[] kept by csv_reset().
+  free_buf(cb);
+  memset(&cb->buf, 0, sizeof(cb->buf));
+  if (len == 0) {
+    cb->eof = true;
+  } else {
+    cb->map.ptr = ptr;
+    cb->map.len = len;
+    cb->map.window = cb->conf.maxbufsz;
+    cb->buf.ptr = ptr;
+    cb->buf.mapped = true;
+  }
+  cb->readonly = true;
+  return csv_parse(csv, context, 0, perrow);
+}
+
+int csv_parse_mmap(csv_t *csv, const char *path, void *context,
+                   csv_perrow_t *perrow) {
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    return -1;
+  }
+  if (!is_new(csv)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s",
+             "csv_parse_mmap() requires a new handle");
+    csv->ok = false;
+    return -1;
+  }
+
+  char *ptr;
+  int64_t len;
+  if (map_file(csv, path, &ptr, &len)) {
+    csv->ok = false;
+    return -1;
+  }
+  int ret = parse_range(csv, ptr, len, context, perrow);
+  ((csvx_t *)csv->__internal)->map.owned = (ptr != 0);
+  return ret;
+}
+
+//////////////////
+// Detach everything that points into cb->mem, which is about to go
+// out of scope.
+static void end_mem(csvx_t *cb) {
+  if (in_mem(cb, cb->value.ptr)) {
+    cb->value.ptr = 0;
+    cb->value.top = cb->value.max = 0;
+  }
+  if (in_mem(cb, cb->tmp.ptr)) {
+    cb->tmp.ptr = 0;
+    cb->tmp.top = cb->tmp.max = 0;
+  }
+  if (in_mem(cb, cb->sidx.ptr)) {
+    cb->sidx.ptr = 0;
+    cb->sidx.next = cb->sidx.top = cb->sidx.max = 0;
+  }
+  if (in_mem(cb, cb->buf.ptr)) {
+    cb->buf.ptr = 0;
+    cb->buf.bot = cb->buf.top = cb->buf.max = 0;
+  }
+  cb->mem = 0;
+}
+
+int csv_parse_mem(csv_t *csv, const char *ptr, size_t len, void *context,
+                  csv_perrow_t *perrow) {
+  if (!csv->ok) {
+    assert(csv->errmsg[0]);
+    return -1;
+  }
+  if (!is_new(csv)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s",
+             "csv_parse_mem() requires a new handle");
+    csv->ok = false;
+    return -1;
+  }
+  if (len > INT64_MAX) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "len is too large");
+    csv->ok = false;
+    return -1;
+  }
+
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  mem_t mem;
+  cb->mem = &mem;
+  int ret = parse_range(csv, (char *)ptr, len, context, perrow);
+  end_mem(cb);
+  return ret;
+}
+
+/*
+ *  csv_parse_parallel() splits a range of memory into chunks of whole
+ *  rows, and parses the chunks on separate threads.
+ *
+ *  Pass 1 counts the quotes and newlines of each nominal chunk in
+ *  parallel. Since esc == qte, the prefix sums of the counts tell
+ *  whether the start of each chunk is inside quotes, and how many
+ *  lines and rows precede it. Each chunk is then moved forward to just
+ *  past its first newline outside of quotes.
+ *
+ *  Pass 2 parses each chunk with its own csv_t, with lineno and rowno
+ *  preset so that they are global.
+ */
+#define MIN_CHUNK (64 * 1024)
+
+typedef struct chunk_t chunk_t;
+struct chunk_t {
+  char *ptr; // chunk is ptr[0..len)
+  int64_t len;
+  const scan_kernel_t *kernel;
+  char qte;
+  scan_count_t count; // pass 1 result
+
+  csv_t csv; // pass 2
+  int64_t lineno, rowno;
+  void *context;
+  csv_perrow_t *perrow;
+  int ret;
+  int *stop;    // shared by the chunks; set by those that fail
+  bool stopped; // failed only because another chunk did
+
+  pthread_t tid;
+  bool started; // true if running on tid
+};
+
+static void *count_chunk(void *arg) {
+  chunk_t *ck = (chunk_t *)arg;
+  ck->kernel->count(ck->ptr, ck->len, ck->qte, &ck->count);
+  return 0;
+}
+
+static void *parse_chunk(void *arg) {
+  chunk_t *ck = (chunk_t *)arg;
+  csvx_t *cb = (csvx_t *)ck->csv.__internal;
+  cb->status.lineno = ck->lineno;
+  cb->status.rowno = ck->rowno;
+  cb->stop = ck->stop;
+  cb->stopped = false;
+  ck->ret = parse_range(&ck->csv, ck->ptr, ck->len, ck->context, ck->perrow);
+  if (ck->ret) {
+    __atomic_store_n(ck->stop, 1, __ATOMIC_RELEASE);
+  }
+  ck->stopped = cb->stopped;
+  cb->stop = 0;
+  return 0;
+}
+
+// Run fn(chunk[i]) for each chunk, one thread per chunk. If a thread
+// cannot be created, run fn on the caller's thread instead.
+static void run_chunks(chunk_t *chunk, int n, void *(*fn)(void *)) {
+  // chunk[0] always runs on the caller's thread.
+  for (int i = 1; i < n; i++) {
+    chunk_t *ck = &chunk[i];
+    ck->started = (0 == pthread_create(&ck->tid, 0, fn, ck));
+  }
+  for (int i = 0; i < n; i++) {
+    if (!chunk[i].started) {
+      fn(&chunk[i]);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (chunk[i].started) {
+      pthread_join(chunk[i].tid, 0);
+      chunk[i].started = false;
+    }
+  }
+}
+
+// Pass 1 on ptr[0..len), which starts a row outside of quotes: split
+// it into chunk[0..n) of whole rows, with lineno and rowno counted
+// from *lineno and *rowno. Unless last is set, the rows end at the
+// last \n outside of quotes, and the row that is not whole is left
+// out. Return the length of the rows, and advance *lineno and *rowno
+// past them.
+static int64_t split_chunks(const csvx_t *cb, chunk_t *chunk, int n,
+                            char *ptr, int64_t len, bool last,
+                            int64_t *lineno, int64_t *rowno) {
+  const char qte = cb->conf.qte;
+
+  // Count nominal chunks of equal size.
+  for (int i = 0; i < n; i++) {
+    int64_t bot = len * i / n;
+    int64_t top = len * (i + 1) / n;
+    chunk[i].ptr = ptr + bot;
+    chunk[i].len = top - bot;
+    chunk[i].kernel = cb->kernel;
+    chunk[i].qte = qte;
+    memset(&chunk[i].count, 0, sizeof(chunk[i].count));
+  }
+  run_chunks(chunk, n, count_chunk);
+
+  // Align each chunk to a row. Counters are for ptr[0..start).
+  char *const end = ptr + len;
+  bool inquote = false;
+  int64_t nnl = *lineno, nrow = *rowno;
+  for (int i = 0; i < n; i++) {
+    // find the first newline outside of quotes at or after chunk[i].ptr
+    char *p = chunk[i].ptr;
+    int64_t lineno = nnl;
+    int64_t rowno = nrow;
+    if (i > 0) {
+      bool q = inquote;
+      for (; p < end; p++) {
+        if (*p == qte) {
+          q = !q;
+        } else if (*p == '\n') {
+          lineno++;
+          if (!q) {
+            rowno++;
+            p++;
+            break;
+          }
+        }
+      }
+    }
+
+    const scan_count_t *c = &chunk[i].count;
+    nnl += c->nnl;
+    nrow += (inquote ? c->nnl - c->nrow : c->nrow);
+    inquote ^= (c->nqte & 1);
+
+    chunk[i].ptr = p;
+    chunk[i].lineno = lineno;
+    chunk[i].rowno = rowno;
+  }
+
+  // Find the last \n outside of quotes backwards from the quote parity
+  // at the end. The newlines after it are all inside quotes.
+  char *stop = end;
+  int64_t ntail = 0; // #newlines in stop[0..end)
+  if (!last) {
+    bool q = inquote;
+    for (; stop > ptr; stop--) {
+      if (stop[-1] == '\n') {
+        if (!q) {
+          break;
+        }
+        ntail++;
+      } else if (stop[-1] == qte) {
+        q = !q;
+      }
+    }
+  }
+
+  // chunk[i] ends where chunk[i+1] starts
+  for (int i = 0; i < n; i++) {
+    if (chunk[i].ptr > stop) {
+      chunk[i].ptr = stop;
+    }
+  }
+  for (int i = 0; i + 1 < n; i++) {
+    chunk[i].len = chunk[i + 1].ptr - chunk[i].ptr;
+  }
+  chunk[n - 1].len = stop - chunk[n - 1].ptr;
+
+  *lineno = nnl - ntail;
+  *rowno = nrow;
+  return stop - ptr;
+}
+
+// Pass 2: parse chunk[0..n) on their handles, passing the rows of
+// chunk i to perrow() with context[i]. A chunk that fails stops the
+// others before their next row. Return 0 on success, or -1 with the
+// error of the first chunk that failed by itself in csv->errmsg.
+static int parse_chunks(csv_t *csv, chunk_t *chunk, int n, void *context[],
+                        csv_perrow_t *perrow) {
+  int stop = 0;
+  for (int i = 0; i < n; i++) {
+    chunk[i].context = context[i];
+    chunk[i].perrow = perrow;
+    chunk[i].stop = &stop;
+  }
+  run_chunks(chunk, n, parse_chunk);
+  for (int i = 0; i < n; i++) {
+    if (chunk[i].ret && !chunk[i].stopped) {
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", chunk[i].csv.errmsg);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int parse_parallel(csv_t *csv, char *ptr, int64_t len, int nthread,
+                          void *context[], csv_perrow_t *perrow) {
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  int n = nthread;
+  if (n > len / MIN_CHUNK) {
+    n = len / MIN_CHUNK;
+  }
+  if (!cb->indexed || n <= 1) {
+    // single chunk, or escaped quotes break the quote parity.
+    return parse_range(csv, ptr, len, context[0], perrow);
+  }
 
-    // Scan buf[] row by row
-    for (;;) {
-      status_t saved_status = cb->status;
-      const char *saved_p = scan_row.p;
+  const csv_allocator_t *al = &cb->conf.allocator;
+  chunk_t *chunk = (chunk_t *)xalloc(al, n * sizeof(*chunk));
+  if (!chunk) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+    return -1;
+  }
+  memset(chunk, 0, n * sizeof(*chunk));
 
-      // Get one row
-      N = onerow(&scan_row, cb);
-      if (N < 0) {
-        goto bail;
-      }
-      if (N == 0) {
-        // Insufficient data in cb->buf[] to fill one row
-        cb->status = saved_status; // rollback the status
-                                   // Break out of inner loop. Continue outer
-                                   // loop to fill buffer and retry.
-        break;
-      }
+  int64_t lineno = 0, rowno = 0;
+  split_chunks(cb, chunk, n, ptr, len, true, &lineno, &rowno);
+
+  int ret = 0;
+  for (int i = 0; i < n; i++) {
+    chunk[i].csv = csv_open(&cb->conf);
+    if (!chunk[i].csv.ok) {
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", chunk[i].csv.errmsg);
+      ret = -1;
+    }
+  }
+  if (ret == 0) {
+    ret = parse_chunks(csv, chunk, n, context, perrow);
+  }
 
-      // Got a value! Advance the buffer.
-      assert(N == 1);
-      cb->buf.bot += scan_row.p - saved_p;
+  for (int i = 0; i < n; i++) {
+    csv_close(&chunk[i].csv);
+  }
+  xfree(al, chunk, n * sizeof(*chunk));
+  return ret;
+}
 
-      if (skip_header) {
-        skip_header = false;
-        continue;
-      }
+/*
+ *  A blocked compressed file (see decode_frames()) is decoded a batch
+ *  of frames at a time, with the frames of a batch shared out among
+ *  nthread threads. Each thread takes the next frame until none is
+ *  left, and decodes it into its place in the batch.
+ *
+ *  While a batch is split and parsed as above, the next one is decoded
+ *  into a second buffer, so that no more than two batches are held. The
+ *  row left over at the end of a batch is copied to the front of the
+ *  next one, and the line and row counts carry over with it.
+ */
 
-      // Unquote the values.
-      if (cb->conf.unquote_values) {
-        for (int i = 0; i < cb->value.top; i++) {
-          unquote(&scan_unquote, &cb->value.ptr[i], &cb->conf);
-        }
-      }
+// The least #bytes a batch decodes to, per thread. A variable, so that
+// the tests can make the batches small.
+static int64_t unframe_batch = 4 << 20;
+
+typedef struct unframe_t unframe_t;
+struct unframe_t {
+  int kind; // DECODE_xxx
+  const char *in;
+  const decode_frame_t *frame;
+  int64_t nframe;
+
+  // The batch: frame[lo..hi) is decoded into out[], at its offset from
+  // frame[lo].
+  int64_t lo, hi;
+  char *out;
+  int64_t next; // the next frame to decode
+  bool failed;  // set by the first thread that fails, or to stop
+  char errmsg[200];
+
+  pthread_t *tid; // tid[0..nstarted) are running
+  int nthread;
+  int nstarted;
+};
 
-      // Invoke the callback to process the current row
-      if (perrow(context, cb->value.top, cb->value.ptr, cb->status.lineno,
-                 cb->status.rowno - (cb->conf.skip_header ? 1 : 0),
-                 cb->ebuf.ptr, cb->ebuf.len)) {
-        // Make up an error message if user did not supply one
-        if (!cb->ebuf.ptr[0]) {
-          RETERROR(cb, "%s", "perrow callback failed");
-        }
-        goto bail;
+static void *unframe_main(void *arg) {
+  unframe_t *u = (unframe_t *)arg;
+  char errmsg[sizeof(u->errmsg)];
+  const int64_t base = u->frame[u->lo].outoff;
+  for (;;) {
+    int64_t i = __atomic_fetch_add(&u->next, 1, __ATOMIC_RELAXED);
+    if (i >= u->hi || __atomic_load_n(&u->failed, __ATOMIC_RELAXED)) {
+      break;
+    }
+    const decode_frame_t *f = &u->frame[i];
+    if (decode_frame(u->kind, u->in + f->inoff, f->inlen,
+                     u->out + (f->outoff - base), f->outlen, errmsg,
+                     sizeof(errmsg))) {
+      if (!__atomic_exchange_n(&u->failed, true, __ATOMIC_ACQ_REL)) {
+        memcpy(u->errmsg, errmsg, sizeof(errmsg));
       }
+      break;
     }
   }
-
-  csv->ok = true;
   return 0;
+}
 
-bail:
-  assert(csv->errmsg[0]);
-  csv->ok = false;
-  return -1;
+// The end of the batch of frames that starts at frame[lo]: at least
+// nthread frames, and unframe_batch bytes for each thread.
+static int64_t unframe_end(const unframe_t *u, int64_t lo) {
+  int64_t hi = lo;
+  int64_t len = 0;
+  while (hi < u->nframe &&
+         (hi - lo < u->nthread || len < u->nthread * unframe_batch)) {
+    len += u->frame[hi++].outlen;
+  }
+  return hi;
 }
 
-csv_t csv_open(const csv_config_t *conf) {
-  csv_t ret;
-  memset(&ret, 0, sizeof(ret));
-  csvx_t *cb = (csvx_t *)calloc(1, sizeof(*cb));
-  if (!cb) {
-    snprintf(ret.errmsg, sizeof(ret.errmsg), "%s", "out of memory");
-    return ret;
+// #bytes that frame[lo..hi) decode to.
+static int64_t unframe_len(const unframe_t *u, int64_t lo, int64_t hi) {
+  const decode_frame_t *last = &u->frame[hi - 1];
+  return last->outoff + last->outlen - u->frame[lo].outoff;
+}
+
+// Start decoding frame[lo..hi) into out[] on threads of their own.
+static void unframe_start(unframe_t *u, int64_t lo, int64_t hi, char *out) {
+  assert(u->nstarted == 0);
+  u->lo = lo;
+  u->hi = hi;
+  u->out = out;
+  u->next = lo;
+  for (int i = 0; i < u->nthread; i++) {
+    if (pthread_create(&u->tid[u->nstarted], 0, unframe_main, u)) {
+      break;
+    }
+    u->nstarted++;
   }
-  ret.__internal = cb;
+}
 
-  cb->conf = conf ? *conf : csv_default_config();
-  ret.ok = true;
-  return ret;
+// Help decode the rest of the batch, and wait for it. Return 0 on
+// success, -1 otherwise.
+static int unframe_wait(unframe_t *u) {
+  unframe_main(u);
+  for (int i = 0; i < u->nstarted; i++) {
+    pthread_join(u->tid[i], 0);
+  }
+  u->nstarted = 0;
+  return u->failed ? -1 : 0;
 }
 
-void csv_close(csv_t *csv) {
-  if (csv && csv->__internal) {
-    csvx_t *cb = (csvx_t *)csv->__internal;
-    free(cb->buf.ptr);
-    free(cb->value.ptr);
-    if (cb->fp) {
-      fclose(cb->fp);
+// A buffer of max bytes for a batch.
+typedef struct unframe_buf_t unframe_buf_t;
+struct unframe_buf_t {
+  char *ptr;
+  int64_t max;
+};
+
+// Make buf hold at least len bytes. Its content is not kept. Return 0
+// on success, -1 otherwise.
+static int unframe_grow(const csv_allocator_t *al, unframe_buf_t *buf,
+                        int64_t len) {
+  if (len > buf->max) {
+    xfree(al, buf->ptr, buf->max);
+    buf->max = 0;
+    buf->ptr = (char *)xalloc(al, len);
+    if (!buf->ptr) {
+      return -1;
     }
-    free(csv->__internal);
-    csv->__internal = NULL;
+    buf->max = len;
   }
+  return 0;
 }
 
-int csv_parse_file(csv_t *csv, FILE *fp, void *context, csv_perrow_t *perrow) {
-  /* Note: we own fp now. Make sure it is closed here or
-   * in csv_close(). */
+// Decode the blocked compressed file mapped at map.ptr[0..len) on
+// nthread threads a batch at a time, and parse each batch in parallel
+// as the next one decodes. Return 1 if done, 0 if the file is not
+// blocked, or -1 on error.
+static int parse_frames(csv_t *csv, int nthread, void *context[],
+                        csv_perrow_t *perrow) {
+  csvx_t *cb = (csvx_t *)csv->__internal;
+  const csv_allocator_t *al = &cb->conf.allocator;
+  unframe_t u;
+  memset(&u, 0, sizeof(u));
+  u.nframe = decode_frames(cb->map.ptr, cb->map.len, &u.kind, 0);
+  if (u.nframe == 0) {
+    return 0;
+  }
+  decode_frame_t *frame =
+      (decode_frame_t *)xalloc(al, u.nframe * sizeof(*frame));
+  if (!frame) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+    return -1;
+  }
+  decode_frames(cb->map.ptr, cb->map.len, &u.kind, frame);
+  u.in = cb->map.ptr;
+  u.frame = frame;
+  u.nthread = nthread;
+
+  int ret = -1;
+  unframe_buf_t buf[2];
+  memset(buf, 0, sizeof(buf));
+  int cur = 0; // buf[cur] holds the batch being parsed
+  int64_t lo = 0, hi = unframe_end(&u, 0);
+  int64_t len = unframe_len(&u, lo, hi);
+  int64_t lineno = 0, rowno = 0;
+  u.tid = (pthread_t *)xalloc(al, nthread * sizeof(*u.tid));
+  chunk_t *chunk = (chunk_t *)xalloc(al, nthread * sizeof(*chunk));
+  if (!u.tid || !chunk) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+    goto bail;
+  }
+  memset(chunk, 0, nthread * sizeof(*chunk));
+  for (int i = 0; i < nthread; i++) {
+    chunk[i].csv = csv_open(&cb->conf);
+    if (!chunk[i].csv.ok) {
+      snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", chunk[i].csv.errmsg);
+      goto bail;
+    }
+  }
+
+  if (unframe_grow(al, &buf[cur], len)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+    goto bail;
+  }
+  unframe_start(&u, lo, hi, buf[cur].ptr);
+  if (unframe_wait(&u)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", u.errmsg);
+    goto bail;
+  }
+
+  for (;;) {
+    const bool last = (hi == u.nframe);
+    char *ptr = buf[cur].ptr;
+    int n = nthread;
+    if (n > len / MIN_CHUNK) {
+      n = len / MIN_CHUNK;
+    }
+    if (n < 1) {
+      n = 1;
+    }
+    const int64_t end =
+        split_chunks(cb, chunk, n, ptr, len, last, &lineno, &rowno);
+
+    // Decode the next batch after the row left over, while this one is
+    // parsed.
+    int64_t nextlo = hi, nexthi = hi, nextlen = 0;
+    if (!last) {
+      nexthi = unframe_end(&u, nextlo);
+      nextlen = len - end + unframe_len(&u, nextlo, nexthi);
+      if (unframe_grow(al, &buf[!cur], nextlen)) {
+        snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", "out of memory");
+        goto bail;
+      }
+      memcpy(buf[!cur].ptr, ptr + end, len - end);
+      unframe_start(&u, nextlo, nexthi, buf[!cur].ptr + (len - end));
+    }
+
+    int rc = parse_chunks(csv, chunk, n, context, perrow);
+    if (!last) {
+      if (rc) {
+        // stop the decode early
+        __atomic_store_n(&u.failed, true, __ATOMIC_RELAXED);
+      }
+      if (unframe_wait(&u) && !rc) {
+        snprintf(csv->errmsg, sizeof(csv->errmsg), "%s", u.errmsg);
+        rc = -1;
+      }
+    }
+    if (rc) {
+      goto bail;
+    }
+    if (last) {
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      csv_reset(&chunk[i].csv);
+    }
+    cur = !cur;
+    lo = nextlo;
+    hi = nexthi;
+    len = nextlen;
+  }
+  ret = 1;
+
+bail:
+  assert(u.nstarted == 0);
+  if (chunk) {
+    for (int i = 0; i < nthread; i++) {
+      csv_close(&chunk[i].csv);
+    }
+  }
+  xfree(al, chunk, nthread * sizeof(*chunk));
+  xfree(al, u.tid, nthread * sizeof(*u.tid));
+  xfree(al, buf[0].ptr, buf[0].max);
+  xfree(al, buf[1].ptr, buf[1].max);
+  xfree(al, frame, u.nframe * sizeof(*frame));
+  return ret;
+}
+
+int csv_parse_parallel(csv_t *csv, const char *path, int nthread,
+                       void *context[], csv_perrow_t *perrow) {
   if (!csv->ok) {
     assert(csv->errmsg[0]);
-    fclose(fp);
     return -1;
   }
+  if (!is_new(csv)) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s",
+             "csv_parse_parallel() requires a new handle");
+    csv->ok = false;
+    return -1;
+  }
+  if (nthread <= 0) {
+    snprintf(csv->errmsg, sizeof(csv->errmsg), "%s",
+             "nthread must be positive");
+    csv->ok = false;
+    return -1;
+  }
+
+  // The mapping is owned by csv, and released by csv_close().
   csvx_t *cb = (csvx_t *)csv->__internal;
-  cb->ebuf.ptr = csv->errmsg;
-  cb->ebuf.len = sizeof(csv->errmsg);
+  char *ptr;
+  int64_t len;
+  if (map_file(csv, path, &ptr, &len)) {
+    csv->ok = false;
+    return -1;
+  }
+  if (ptr) {
+    cb->map.ptr = ptr;
+    cb->map.len = len;
+    cb->map.owned = true;
+
+    // A compressed file is decoded and parsed in parallel if it is
+    // blocked and can be split into rows, and parsed serially as by
+    // csv_parse_file_ex() otherwise.
+    if (cb->indexed) {
+      int rc = parse_frames(csv, nthread, context, perrow);
+      if (rc) {
+        csv->ok = (rc > 0);
+        return rc > 0 ? 0 : -1;
+      }
+    }
+    if (decode_kind((unsigned char *)ptr, len < 4 ? len : 4)) {
+      munmap(cb->map.ptr, cb->map.len);
+      memset(&cb->map, 0, sizeof(cb->map));
+      return csv_parse_file_ex(csv, path, context[0], perrow);
+    }
+  }
+  int ret = parse_parallel(csv, ptr, len, nthread, context, perrow);
+  csv->ok = (ret == 0);
+  return ret;
+}
 
-  if (cb->fp) {
-    fclose(cb->fp);
-    cb->fp = 0;
+/*
+ *  csv_parse_segments() scans each segment in place, with buf[] as a
+ *  window on it, as csv_parse_mmap() does. A row that straddles two
+ *  segments is finished in the heap: the end of the first segment is
+ *  copied into the heap buf[], and the next segment is pushed into it
+ *  a line at a time, as by csv_push(), until no row is in progress.
+ *  The rest of the next segment is then scanned in place.
+ */
+
+// The most #bytes of a segment scanned in place at a time, as buf[]
+// offsets are ints. A variable, so that the tests can make it small.
+static int64_t seg_window = 1 << 30;
+
+//////////////////
+// Make room for n more bytes in the heap buf[] at top.
+static int reserve_buf(csvx_t *cb, int64_t n) {
+  DO(ensure_buf(cb));
+  if (buf_room(cb) > n) {
+    return 0;
+  }
+  // Note: 1 byte is reserved for a \n.
+  int64_t need = cb->buf.top - cb->buf.bot + n + 1;
+  if (need > cb->conf.maxbufsz) {
+    return RETERROR(cb, "max row size is larger than maxbufsz of %d bytes",
+                    cb->conf.maxbufsz);
+  }
+  int64_t max = cb->buf.max * 1.5;
+  if (max < need) {
+    max = need;
+  }
+  // whole pages, so that buf[] can be a ring
+  const int64_t page = sysconf(_SC_PAGESIZE);
+  max = (max + page - 1) / page * page;
+  if (max > cb->conf.maxbufsz) {
+    max = cb->conf.maxbufsz;
+  }
+  return grow_buf(cb, max);
+}
+
+//////////////////
+// Scan seg[0..len) in place. The heap buf[] must be empty. The row in
+// progress at the end, if any, is moved to the heap buf[].
+static int parse_inplace(csvx_t *cb, const char *seg, int len,
+                         scan_t *scan_row, scan_t *scan_unquote,
+                         void *context, csv_perrow_t *perrow) {
+  assert(cb->buf.bot == cb->buf.top && cb->row.state == ROW_START);
+  char *const heap = cb->buf.ptr;
+  const int max = cb->buf.max;
+  const bool ring = cb->buf.ring;
+  cb->buf.ptr = (char *)seg;
+  cb->buf.bot = 0;
+  cb->buf.top = cb->buf.max = len;
+  cb->buf.mapped = true;
+  cb->buf.ring = false;
+  cb->sidx.scanned = cb->sidx.next = cb->sidx.top = 0;
+  cb->sidx.inquote = 0;
+
+  int ret = parse_rows(cb, scan_row, scan_unquote, context, perrow);
+
+  const int bot = cb->buf.bot;
+  const int N = cb->buf.top - bot;
+  cb->buf.ptr = heap;
+  cb->buf.bot = cb->buf.top = 0;
+  cb->buf.max = max;
+  cb->buf.mapped = false;
+  cb->buf.ring = ring;
+  DO(ret);
+  if (N == 0) {
+    return 0;
   }
 
-  cb->fp = fp;
-  return csv_parse(csv, context, read_file, perrow);
+  // Move the row in progress to the heap. It still points into seg[],
+  // so keep reserve_buf() from rebasing it.
+  const int state = cb->row.state;
+  cb->row.state = ROW_START;
+  ret = reserve_buf(cb, N);
+  cb->row.state = state;
+  DO(ret);
+  memcpy(cb->buf.ptr, seg + bot, N);
+  move_row(cb, (intptr_t)cb->buf.ptr - (intptr_t)(seg + bot), bot);
+  cb->buf.top = N;
+  return 0;
 }
 
-int csv_parse_file_ex(csv_t *csv, const char *path, void *context,
-                      csv_perrow_t *perrow) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) {
-    snprintf(csv->errmsg, sizeof(csv->errmsg), "fopen failed - %s",
-             strerror(errno));
-    csv->ok = false;
-    return -1;
+int csv_parse_segments(csv_t *csv, void *context, csv_segfeed_t *feed,
+                       csv_release_t *release, csv_perrow_t *perrow) {
+  const char *seg = 0; // the segment held, if any
+  int64_t seglen = 0;
+  scan_t scan_row, scan_unquote;
+  if (begin_parse(csv, &scan_row, &scan_unquote)) {
+    goto bail;
   }
 
-  return csv_parse_file(csv, fp, context, perrow);
+  {
+    csvx_t *cb = (csvx_t *)csv->__internal;
+    if (!is_new(csv)) {
+      RETERROR(cb, "%s", "csv_parse_segments() requires a new handle");
+      goto bail;
+    }
+    // the segments are read-only; values are unquoted into tmp[]
+    cb->readonly = true;
+
+    for (;;) {
+      int ret = feed(context, &seg, &seglen, cb->ebuf.ptr, cb->ebuf.len);
+      if (ret <= 0) {
+        seg = 0;
+        if (ret < 0) {
+          goto bail;
+        }
+        break;
+      }
+
+      for (int64_t pos = 0; pos < seglen;) {
+        int64_t n = seglen - pos;
+        if (cb->buf.bot == cb->buf.top) {
+          // Scan a window of the segment in place.
+          if (n > seg_window) {
+            n = seg_window;
+          }
+          if (parse_inplace(cb, seg + pos, n, &scan_row, &scan_unquote,
+                            context, perrow)) {
+            goto bail;
+          }
+          pos += n;
+          continue;
+        }
+
+        // A row is in progress in the heap buf[]. Push the segment to it
+        // up to the next \n, which likely ends the row, so that the
+        // rest of the segment can be scanned in place again.
+        if (n > seg_window) {
+          n = seg_window;
+        }
+        const char *nl = (const char *)memchr(seg + pos, '\n', n);
+        if (nl) {
+          n = nl + 1 - (seg + pos);
+        }
+        if (reserve_buf(cb, n)) {
+          goto bail;
+        }
+        memcpy(cb->buf.ptr + cb->buf.top, seg + pos, n);
+        cb->buf.top += n;
+        pos += n;
+        if (parse_rows(cb, &scan_row, &scan_unquote, context, perrow)) {
+          goto bail;
+        }
+      }
+
+      // Nothing points into seg[] now.
+      if (release) {
+        release(context, seg, seglen);
+      }
+      seg = 0;
+    }
+
+    // EOF: finish the last row.
+    cb->eof = true;
+    if (cb->buf.ptr) {
+      end_buf(cb);
+      if (parse_rows(cb, &scan_row, &scan_unquote, context, perrow)) {
+        goto bail;
+      }
+    }
+  }
+
+  csv->ok = true;
+  return 0;
+
+bail:
+  if (seg && release) {
+    release(context, seg, seglen);
+  }
+  assert(csv->errmsg[0]);
+  csv->ok = false;
+  return -1;
 }
 
 /*
@@ -505,6 +2787,14 @@ int csv_parse_file_ex(csv_t *csv, const char *path, void *context,
                                            |              |
                                            +-- eq or ee --+
 */
+// True if p[0..q) is "xxxx", where x != esc, so that unquoting it
+// only drops the outer quotes.
+static inline bool plain_quoted(const char *p, const char *q,
+                                const csv_config_t *conf) {
+  return q - p >= 2 && p[0] == conf->qte && q[-1] == conf->qte &&
+         !memchr(p + 1, conf->esc, q - p - 2);
+}
+
 /**
  *  Unquote a value and return a NUL-terminated string.
  *  This will modify memory area value.ptr[0 .. len+1].
@@ -531,74 +2821,87 @@ static void unquote(scan_t *scan, csv_value_t *value,
   }
 
   // fast path for "xxxx", where x != esc
-  if (p[0] == qte && q[-1] == qte) {
-    if (!memchr(p + 1, esc, q - p - 2)) {
-      p++;
-      *--q = 0;
-      value->ptr = p;
-      value->len = q - p;
-      value->quoted = false;
-      return;
-    }
+  if (plain_quoted(p, q, conf)) {
+    p++;
+    *--q = 0;
+    value->ptr = p;
+    value->len = q - p;
+    value->quoted = false;
+    return;
+  }
+
+  if (qte == esc) {
+    // a "" is the only escape; the kernel does it in bulk.
+    value->len = scan->kernel->unquote(p, q - p, qte);
+    value->ptr[value->len] = 0;
+    value->quoted = false;
+    return;
   }
 
-  char *begin = p;
-  char *pp;
+  // Single pass: the bytes between the chars dropped are moved down to
+  // the write cursor w in one memmove per span.
+  char *w = p;       // write cursor
+  const char *r = p; // r[0..] is yet to be moved to w
+  bool inquote = false;
+  const char *pp;
   scan_reset(scan, p, q - p);
-UNQUOTED:
-  if (p == q) {
-    goto DONE;
-  }
-  pp = (char *)scan_next(scan);
-  if (!pp) {
-    p = q;
-    goto DONE;
-  }
-  // q
-  if (*pp == qte) {
-    // shift down, and go into QUOTED mode
-    memmove(pp, pp + 1, q - pp);
-    q--;
-    assert(*q == 0);
-    p = pp;
-    scan_reset(scan, p, q - p);
-    goto QUOTED;
+  while ((pp = scan_next(scan))) {
+    if (*pp == qte) {
+      // q: drop it, and toggle QUOTED mode
+      inquote = !inquote;
+    } else if (inquote && pp + 1 < q && (pp[1] == esc || pp[1] == qte)) {
+      // eq or ee: drop the esc, and keep the next char
+      (void)scan_next(scan);
+    } else {
+      // ignore this char
+      continue;
+    }
+    memmove(w, r, pp - r);
+    w += pp - r;
+    r = pp + 1;
   }
-  // ignore this char
-  p = pp + 1;
-  goto UNQUOTED;
+  memmove(w, r, q - r);
+  w += q - r;
+  *w = 0;
+  value->len = w - p;
+  value->quoted = false;
+}
 
-QUOTED:
-  assert(p < q);
-  pp = (char *)scan_next(scan);
-  assert(pp);
-  // eq or ee
-  if (pp[0] == esc && (pp[1] == esc || pp[1] == qte)) {
-    // shift down
-    memmove(pp, pp + 1, q - pp);
-    q--;
-    p = pp + 1;
-    scan_reset(scan, p, q - p);
-    goto QUOTED;
+/**
+ *  Unquote a value without modifying it, for when buf[] is
+ *  read-only. Values that need unescaping are copied into cb->tmp[]
+ *  and unquoted there. The result is not NUL-terminated.
+ */
+static void unquote_readonly(csvx_t *cb, scan_t *scan, csv_value_t *value) {
+  const csv_config_t *conf = &cb->conf;
+  const char *p = value->ptr;
+  const char *q = p + value->len;
+
+  // if value is not quoted, just return it.
+  if (!value->quoted) {
+    // check for NULL
+    int nullsz = strlen(conf->nullstr);
+    if (value->len == nullsz && 0 == memcmp(p, conf->nullstr, nullsz)) {
+      value->ptr = 0;
+      value->len = 0;
+    }
+    return;
   }
-  // q
-  if (*pp == qte) {
-    memmove(pp, pp + 1, q - pp);
-    q--;
-    p = pp;
-    scan_reset(scan, p, q - p);
-    goto UNQUOTED;
+
+  // fast path for "xxxx", where x != esc
+  if (plain_quoted(p, q, conf)) {
+    value->ptr++;
+    value->len -= 2;
+    value->quoted = false;
+    return;
   }
-  // ignore this char
-  p = pp + 1;
-  goto QUOTED;
 
-DONE:
-  *p = 0;
-  value->ptr = begin;
-  value->len = p - begin;
-  value->quoted = false;
-  return;
+  char *copy = cb->tmp.ptr + cb->tmp.top;
+  cb->tmp.top += value->len + 1;
+  assert(cb->tmp.top <= cb->tmp.max);
+  memcpy(copy, p, value->len);
+  value->ptr = copy;
+  unquote(scan, value, conf);
 }
 
 csv_config_t csv_default_config(void) {
@@ -611,6 +2914,8 @@ csv_config_t csv_default_config(void) {
   conf.delim = ',';
   conf.initbufsz = 1024 * 4;          // 4KB
   conf.maxbufsz = 1024 * 1024 * 1024; // 1GB
+  conf.kernel = CSV_KERNEL_AUTO;
+  conf.batchsz = 1024;
   return conf;
 }
 
@@ -777,3 +3082,141 @@ int csv_parse_timestamptz(const char *s, int *year, int *month, int *day,
   }
   return 0;
 }
+
+/*
+ *  Typed values. Each decoder reads p[0..len), which is not
+ *  NUL-terminated, and returns 0 on success, -1 otherwise.
+ */
+
+static int decode_bool(const char *p, int len, bool *ret) {
+  static const struct {
+    const char *s;
+    bool b;
+  } tab[] = {{"true", true}, {"false", false}, {"yes", true}, {"no", false},
+             {"on", true},   {"off", false},   {"t", true},   {"f", false},
+             {"y", true},    {"n", false},     {"1", true},   {"0", false}};
+  for (size_t i = 0; i < sizeof(tab) / sizeof(tab[0]); i++) {
+    if ((int)strlen(tab[i].s) == len && 0 == strncasecmp(p, tab[i].s, len)) {
+      *ret = tab[i].b;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Days since 1970-01-01 of a valid date in the proleptic Gregorian
+// calendar, or -1 if not valid. See
+// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+static int days_from_civil(int y, int m, int d, int64_t *ret) {
+  static const int mdays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  const bool leap = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+  if (m < 1 || m > 12 || d < 1 || d > mdays[m - 1] + (m == 2 && leap)) {
+    return -1;
+  }
+  y -= (m <= 2);
+  const int era = (y >= 0 ? y : y - 399) / 400;
+  const int yoe = y - era * 400;
+  const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  *ret = (int64_t)era * 146097 + doe - 719468;
+  return 0;
+}
+
+// YYYY-MM-DD
+static int decode_date(const char *p, int len, int32_t *ret) {
+  char s[16];
+  int year, month, day;
+  int64_t days;
+  if (len != 10) {
+    return -1;
+  }
+  memcpy(s, p, len);
+  s[len] = 0;
+  DO(csv_parse_ymd(s, &year, &month, &day));
+  DO(days_from_civil(year, month, day, &days));
+  *ret = (int32_t)days;
+  return 0;
+}
+
+// YYYY-MM-DD HH:MM:SS{.subsec}
+static int decode_timestamp(const char *p, int len, int64_t *ret) {
+  char s[32];
+  int year, month, day, hour, minute, second, usec;
+  int64_t days;
+  if (len >= (int)sizeof(s)) {
+    return -1;
+  }
+  memcpy(s, p, len);
+  s[len] = 0;
+  DO(csv_parse_timestamp(s, &year, &month, &day, &hour, &minute, &second,
+                         &usec));
+  DO(days_from_civil(year, month, day, &days));
+  if (hour > 23 || minute > 59 || second > 59) {
+    return -1;
+  }
+  *ret = ((days * 24 + hour) * 60 + minute) * 60 + second;
+  *ret = *ret * 1000000 + usec;
+  return 0;
+}
+
+static void decode_value(const scan_kernel_t *kernel, const csv_config_t *conf,
+                         csv_type_t type, int scale, const csv_value_t *value,
+                         csv_column_t *col, int r) {
+  const char *p = value->ptr;
+  const int len = value->len;
+  if (!p) {
+    col->flag[r] = CSV_FLAG_NULL;
+    col->i64[r] = 0;
+    return;
+  }
+  int ret = -1;
+  col->i64[r] = 0;
+  switch (type) {
+  case CSV_TYPE_INT64:
+    ret = kernel->int64(p, len, &col->i64[r]);
+    break;
+  case CSV_TYPE_DOUBLE:
+    ret = number_double(p, len, &col->f64[r]);
+    break;
+  case CSV_TYPE_BOOL:
+    ret = decode_bool(p, len, &col->b[r]);
+    break;
+  case CSV_TYPE_DATE:
+    ret = decode_date(p, len, &col->date[r]);
+    break;
+  case CSV_TYPE_TIMESTAMP:
+    ret = decode_timestamp(p, len, &col->i64[r]);
+    break;
+  case CSV_TYPE_DECIMAL:
+    ret = number_decimal64(p, len, scale, conf->decimal_mode, &col->i64[r]);
+    break;
+  default:
+    break;
+  }
+  col->flag[r] = ret ? CSV_FLAG_ERROR : 0;
+}
+
+int csv_parse_int64(const char *ptr, int len, int64_t *ret) {
+  // the best kernel for the cpu, picked on the first call
+  static const scan_kernel_t *kernel;
+  const scan_kernel_t *k = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+  if (!k) {
+    k = scan_kernel(CSV_KERNEL_AUTO);
+    __atomic_store_n(&kernel, k, __ATOMIC_RELAXED);
+  }
+  return k->int64(ptr, len, ret);
+}
+
+int csv_parse_double(const char *ptr, int len, double *ret) {
+  return number_double(ptr, len, ret);
+}
+
+int csv_parse_decimal(const char *ptr, int len, int scale, int mode,
+                      int64_t *ret) {
+  return number_decimal64(ptr, len, scale, mode, ret);
+}
+
+int csv_parse_decimal128(const char *ptr, int len, int scale, int mode,
+                         __int128 *ret) {
+  return number_decimal128(ptr, len, scale, mode, ret);
+}
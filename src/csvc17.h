@@ -10,7 +10,8 @@
  *  1. Call csv_open() to obtain a handle.
  *  2. Call csv_parse() and supply a feed function and a per-row
  *     function, or call csv_parse_file().
- *  3. Call csv_close() to free up resources.
+ *  3. Call csv_close() to free up resources, or csv_reset() to parse
+ *     again with the same handle.
  *
  *  The feed function will be invoked automatically when the parser
  *  needs more data.
@@ -35,6 +36,81 @@
 #define CSV_EXTERN extern
 #endif
 
+/**
+ *  SIMD kernels used to scan the input. By default, csv_open() picks
+ *  the best kernel supported by the cpu.
+ */
+typedef enum csv_kernel_t {
+  CSV_KERNEL_AUTO = 0, // best kernel for the cpu
+  CSV_KERNEL_SSE2,     // x86_64
+  CSV_KERNEL_AVX2,     // x86_64
+  CSV_KERNEL_AVX512BW, // x86_64
+  CSV_KERNEL_NEON,     // aarch64
+} csv_kernel_t;
+
+/**
+ *  Memory hooks for the buffers and arrays of a csv handle, e.g., to
+ *  serve them from an arena. alloc() returns size bytes aligned to
+ *  align, or NULL if out of memory. free() gets the size and align
+ *  that ptr was allocated with. realloc() is only called with a
+ *  non-NULL ptr, and may be NULL; alloc(), a copy and free() are used
+ *  instead. csv_parse_parallel() calls the hooks from several threads
+ *  at once.
+ *
+ *  With the hooks set, buf[] is never a ring. Page mappings do not go
+ *  through them: the file of csv_parse_mmap(), and the submission and
+ *  completion rings and the read buffers of io_uring. Nor does the
+ *  state that zlib and libzstd allocate for a compressed file.
+ */
+typedef struct csv_allocator_t csv_allocator_t;
+struct csv_allocator_t {
+  void *(*alloc)(void *context, size_t size, size_t align);
+  void *(*realloc)(void *context, void *ptr, size_t oldsize, size_t size,
+                   size_t align);
+  void (*free)(void *context, void *ptr, size_t size, size_t align);
+  void *context;
+};
+
+/**
+ *  Types of the values in conf.schema. A value of a type other than
+ *  CSV_TYPE_TEXT is decoded by csv_parse_batch(), into the typed
+ *  arrays of its csv_column_t.
+ */
+typedef enum csv_type_t {
+  CSV_TYPE_TEXT = 0,  // not decoded
+  CSV_TYPE_INT64,     // [+-]digits, into i64
+  CSV_TYPE_DOUBLE,    // as csv_parse_double(), into f64
+  CSV_TYPE_BOOL,      // true/false, yes/no, on/off, t/f, y/n or 1/0 in
+                      // any case, into b
+  CSV_TYPE_DATE,      // YYYY-MM-DD, into date as days since 1970-01-01
+  CSV_TYPE_TIMESTAMP, // YYYY-MM-DD HH:MM:SS{.subsec}, into i64 as
+                      // microseconds since 1970-01-01 00:00:00
+  CSV_TYPE_DECIMAL,   // as csv_parse_decimal() with the scale in
+                      // conf.scale and the mode conf.decimal_mode, into
+                      // i64
+} csv_type_t;
+
+/**
+ *  Flags of a decoded value.
+ */
+enum {
+  CSV_FLAG_NULL = 1,  // the value is NULL
+  CSV_FLAG_ERROR = 2, // the value is not of its type in conf.schema
+};
+
+/**
+ *  Modes of csv_parse_decimal(): one of the first four, on how to round
+ *  the digits past the scale, or-ed with CSV_DECIMAL_SATURATE or not.
+ */
+enum {
+  CSV_DECIMAL_HALF_UP = 0,   // to the nearest, ties away from zero
+  CSV_DECIMAL_HALF_EVEN = 1, // to the nearest, ties to even
+  CSV_DECIMAL_TRUNCATE = 2,  // toward zero
+  CSV_DECIMAL_EXACT = 3,     // fail unless the digits are all 0
+  CSV_DECIMAL_SATURATE = 4,  // clamp a value out of range to the min or
+                             // max of the type, instead of failing
+};
+
 typedef struct csv_config_t csv_config_t;
 struct csv_config_t {
   bool unquote_values; // unquote and unescape the values for perrow callback;
@@ -47,6 +123,31 @@ struct csv_config_t {
   int initbufsz;       // default 4KB
   int maxbufsz;        // this should be many times bigger than the longest row;
                        // default 1GB
+  csv_kernel_t kernel; // SIMD kernel; default CSV_KERNEL_AUTO. csv_open()
+                       // fails if the cpu does not support the kernel.
+  int batchsz;         // max #rows per batch for csv_parse_batch();
+                       // default 1024
+  const int *select;   // if set, pass only the fields select[0..nselect)
+  int nselect;         // (0-based) to the callbacks, in this order. Fields
+                       // not selected are not stored or unquoted. Fields
+                       // missing from a row are NULL. Default NULL.
+  int readahead;       // if > 0, csv_parse() calls feed() on a thread of
+                       // its own, which reads up to this many buffers
+                       // ahead of the parse. Default 0.
+  csv_allocator_t allocator; // if alloc and free are set, memory of the
+                             // handle comes from them, but for what
+                             // csv_allocator_t leaves out. Default NULLs,
+                             // for the C library.
+  const csv_type_t *schema;  // if set, column i of csv_parse_batch() is
+  int nschema;               // decoded as schema[i] for i < nschema, after
+                             // the projection by select. perrow() gets
+                             // the text only. Requires unquote_values.
+                             // Default NULL.
+  const int *scale;          // if set, scale[i] is the scale, 0..18, of
+  int nscale;                // a CSV_TYPE_DECIMAL value i. nscale must
+                             // equal nschema. Default NULL, for 0.
+  int decimal_mode;          // CSV_DECIMAL_xxx of CSV_TYPE_DECIMAL;
+                             // default CSV_DECIMAL_HALF_UP
 };
 
 typedef struct csv_t csv_t;
@@ -70,6 +171,9 @@ struct csv_value_t {
  *  This callback is invoked when the parser needs data.
  *  Return #bytes copied into buf on success, 0 on EOF, -1 on error. If
  *  you return -1, be sure to write an error message into errbuf[].
+ *
+ *  Note: with conf.readahead, feed() runs on another thread, at the
+ *  same time as perrow().
  */
 typedef int csv_feed_t(void *context, char *buf, int bufsz, char *errbuf,
                        int errsz);
@@ -83,6 +187,64 @@ typedef int csv_perrow_t(void *context, int n, csv_value_t value[],
                          int64_t lineno, int64_t rowno, char *errbuf,
                          int errsz);
 
+/**
+ *  This callback hands the next segment of the input to
+ *  csv_parse_segments(). Set *ptr and *len to memory owned by the
+ *  caller, and return 1. Return 0 on EOF, or -1 on error with a message
+ *  in errbuf[].
+ */
+typedef int csv_segfeed_t(void *context, const char **ptr, int64_t *len,
+                          char *errbuf, int errsz);
+
+/**
+ *  This callback is invoked once for every segment when the parser no
+ *  longer refers to it. The caller may then free or reuse it.
+ */
+typedef void csv_release_t(void *context, const char *ptr, int64_t len);
+
+/**
+ *  A column of a batch of rows. The value of row i in the column is
+ *  ptr[i][0..len[i]). For NULL, ptr[i] will be a nullptr.
+ */
+typedef struct csv_column_t csv_column_t;
+struct csv_column_t {
+  char **ptr;
+  int *len;
+  bool *quoted;
+
+  // The decoded values, if the column has a type in conf.schema; see
+  // csv_type_t. flag[i] is CSV_FLAG_xxx, or 0 if value i is decoded
+  // into i64[i] etc. NULL otherwise.
+  uint8_t *flag;
+  union {
+    int64_t *i64;
+    double *f64;
+    bool *b;
+    int32_t *date;
+  };
+};
+
+/**
+ *  A batch of consecutive rows that have the same number of values,
+ *  stored by columns.
+ */
+typedef struct csv_batch_t csv_batch_t;
+struct csv_batch_t {
+  int nrow;             // #rows
+  int ncol;             // #values in each row
+  csv_column_t *column; // column[0..ncol)
+  int64_t *lineno;      // lineno[0..nrow)
+  int64_t rowno;        // rowno of the first row; row i is (rowno + i)
+};
+
+/**
+ *  This callback is invoked per batch of rows by csv_parse_batch().
+ *  Return 0 on success, -1 otherwise. If you return -1, be sure to
+ *  write an error message into errbuf[].
+ */
+typedef int csv_perbatch_t(void *context, const csv_batch_t *batch,
+                           char *errbuf, int errsz);
+
 /**
  *  Open a scan. The csv_t handle returned must be freed using
  *  csv_close() after use. The param 'conf' may be NULL to use the
@@ -101,6 +263,31 @@ CSV_EXTERN csv_t csv_open(const csv_config_t *conf);
 CSV_EXTERN int csv_parse(csv_t *csv, void *context, csv_feed_t *feed,
                          csv_perrow_t *perrrow);
 
+/**
+ *  Push-style parsing, for data that arrives in pieces, e.g., from a
+ * non-blocking socket. Each call to csv_push() appends buf[0..len) to
+ * the input, and passes the rows it completes to perrow(). A partial
+ * row at the end is kept by csv until the next call. Call csv_finish()
+ * at the end of the input to deliver the last row. Return 0 on
+ * success, -1 otherwise. On failure, check for error message in
+ * csv->errmsg.
+ *
+ *  Note: the handle must not be used with csv_parse() or the other
+ * parse functions without a csv_reset() in between.
+ */
+CSV_EXTERN int csv_push(csv_t *csv, const char *buf, int len, void *context,
+                        csv_perrow_t *perrow);
+CSV_EXTERN int csv_finish(csv_t *csv, void *context, csv_perrow_t *perrow);
+
+/**
+ *  Same as csv_parse(), but deliver the rows in batches of up to
+ * conf.batchsz rows. A batch ends early when the number of values
+ * changes, or when the parser needs more data. The values are valid
+ * until perbatch() returns.
+ */
+CSV_EXTERN int csv_parse_batch(csv_t *csv, void *context, csv_feed_t *feed,
+                               csv_perbatch_t *perbatch);
+
 /**
  *  Parse a file. This function will call csv_parse(). Return 0 on success, -1
  * otherwise. On failure, check for error message in csv->errmsg.
@@ -114,15 +301,111 @@ CSV_EXTERN int csv_parse_file(csv_t *csv, FILE *fp, void *context,
 /**
  *  Parse a file. This function will call csv_parse(). Return 0 on success, -1
  * otherwise. On failure, check for error message in csv->errmsg.
+ *
+ *  On Linux, a regular file is read ahead through io_uring, so that
+ * the reads overlap with the parse. Otherwise, it is read with stdio.
+ *
+ *  A gzip or zstd file, as told by its magic number, is decoded on a
+ * thread of its own while the parse runs, if the library was built
+ * with zlib or libzstd. conf.readahead sets the number of buffers
+ * decoded ahead.
  */
 CSV_EXTERN int csv_parse_file_ex(csv_t *csv, const char *path, void *context,
                                  csv_perrow_t *perrow);
 
+/**
+ *  Parse a file by mapping it into memory. The values point directly
+ *  into the read-only mapping, so nothing is copied, and the size of
+ *  the file is not limited by maxbufsz. Return 0 on success, -1
+ * otherwise. On failure, check for error message in csv->errmsg.
+ *
+ *  Note: in this mode, the values passed to perrow() are NOT
+ * NUL-terminated, and must not be modified. Use value.len. The csv
+ * handle must not have been used by another parse.
+ */
+CSV_EXTERN int csv_parse_mmap(csv_t *csv, const char *path, void *context,
+                              csv_perrow_t *perrow);
+
+/**
+ *  Parse ptr[0..len) in place, as csv_parse_mmap() does with a file.
+ *  Meant for many small documents: the scratch space of the parse is
+ *  on the stack, so a document with rows of up to 64 values is parsed
+ *  without any allocation beyond csv_open(). Return 0 on success, -1
+ *  otherwise. On failure, check for error message in csv->errmsg.
+ *
+ *  Note: the values passed to perrow() are NOT NUL-terminated. See
+ * csv_parse_mmap(). The csv handle must not have been used by another
+ * parse.
+ */
+CSV_EXTERN int csv_parse_mem(csv_t *csv, const char *ptr, size_t len,
+                             void *context, csv_perrow_t *perrow);
+
+/**
+ *  Parse the input handed over by feed() one segment at a time. The
+ *  segments are scanned in place, so nothing is copied except the
+ *  rows that straddle two segments. A segment may be larger than 2GB;
+ *  it is scanned in windows, and only a row must fit in
+ *  conf.maxbufsz. release() may be NULL. Return 0 on success, -1
+ *  otherwise. On failure, check for error message in csv->errmsg.
+ *
+ *  Note: the values passed to perrow() are NOT NUL-terminated. See
+ * csv_parse_mmap(). The csv handle must not have been used by another
+ * parse.
+ */
+CSV_EXTERN int csv_parse_segments(csv_t *csv, void *context,
+                                  csv_segfeed_t *feed, csv_release_t *release,
+                                  csv_perrow_t *perrow);
+
+/**
+ *  Parse a file on nthread threads. The file is mapped into memory as
+ *  in csv_parse_mmap(), and split into nthread chunks of whole
+ *  rows. The rows of chunk i are passed to perrow() with context[i],
+ *  in order, on a thread of its own; all rows of chunk i precede the
+ *  rows of chunk i+1 in the file. lineno and rowno are counted from
+ *  the start of the file. Return 0 on success, -1 otherwise. On
+ *  failure, check for error message in csv->errmsg. Once a chunk
+ *  fails, the other threads stop before their next row; only a row
+ *  already passed to perrow() may finish after the failure.
+ *
+ *  Small files use fewer threads. Files with esc != qte are parsed by
+ *  the calling thread using context[0], because they cannot be split
+ *  into rows without a serial scan.
+ *
+ *  A BGZF or zstd seekable file is decoded on nthread threads a batch
+ *  of frames at a time, and each batch parsed as above while the next
+ *  one decodes. context[i] then gets chunk i of every batch, and the
+ *  batches are parsed in order. Other gzip or zstd files, and those
+ *  with esc != qte, are parsed by csv_parse_file_ex() using
+ *  context[0].
+ *
+ *  Note: the values passed to perrow() are NOT NUL-terminated. See
+ * csv_parse_mmap(). The csv handle must not have been used by another
+ * parse.
+ */
+CSV_EXTERN int csv_parse_parallel(csv_t *csv, const char *path, int nthread,
+                                  void *context[], csv_perrow_t *perrow);
+
+/**
+ *  Rewind the handle for another parse, as if it were just opened with
+ *  the same configuration, and close the input of the last parse. The
+ *  buffers and arrays grown by earlier parses are kept, so repeated
+ *  parses on a long-lived handle stop allocating once warmed up. This
+ *  also clears an error of the last parse. Return 0 on success, -1 if
+ *  csv_open() failed on the handle.
+ */
+CSV_EXTERN int csv_reset(csv_t *csv);
+
 /**
  *  Close the scan and release resources.
  */
 CSV_EXTERN void csv_close(csv_t *csv);
 
+/**
+ *  Return the name of the SIMD kernel picked by csv_open(), e.g.,
+ *  "avx2".
+ */
+CSV_EXTERN const char *csv_kernel_name(const csv_t *csv);
+
 /**
  *  Parse a YYYY-MM-DD. Return 0 on success, -1 otherwise.
  *
@@ -174,6 +457,40 @@ CSV_EXTERN int csv_parse_timestamptz(const char *s, int *year, int *month,
                                      int *second, int *usec, char *tzsign,
                                      int *tzhour, int *tzminute);
 
+/**
+ *  Parse the decimal integer [+-]digits in ptr[0..len) into *ret. The
+ *  string need not be NUL-terminated. Return 0 on success, or -1 if it
+ *  is not an integer or is out of the range of int64_t.
+ */
+CSV_EXTERN int csv_parse_int64(const char *ptr, int len, int64_t *ret);
+
+/**
+ *  Parse the floating point number in ptr[0..len) into *ret, rounded
+ *  to the nearest double. The string need not be NUL-terminated. The
+ *  forms accepted are [+-]digits[.digits][(e|E)[+-]digits], with a
+ *  digit on at least one side of the '.', and [+-]nan, inf or infinity
+ *  in any case; the decimal point is always '.', whatever the
+ *  locale. Values out of range become inf or 0. Return 0 on success,
+ *  -1 otherwise.
+ */
+CSV_EXTERN int csv_parse_double(const char *ptr, int len, double *ret);
+
+/**
+ *  Parse the decimal [+-]digits[.digits][(e|E)[+-]digits] in
+ *  ptr[0..len) into *ret as a whole number of 10^-scale, e.g., 12.345
+ *  with scale 2 is 1235. The string need not be NUL-terminated. Digits
+ *  past the scale are rounded as mode says; see CSV_DECIMAL_xxx. Return
+ *  0 on success, or -1 if it is not a decimal, if a digit is lost under
+ *  CSV_DECIMAL_EXACT, or if the value is out of range and mode does not
+ *  have CSV_DECIMAL_SATURATE.
+ */
+CSV_EXTERN int csv_parse_decimal(const char *ptr, int len, int scale,
+                                 int mode, int64_t *ret);
+#ifdef __SIZEOF_INT128__
+CSV_EXTERN int csv_parse_decimal128(const char *ptr, int len, int scale,
+                                    int mode, __int128 *ret);
+#endif
+
 /**
  *  Get the default config. Set values if default is not correct, and
  *  pass to csv_open().
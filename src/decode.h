@@ -0,0 +1,425 @@
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef CSV_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CSV_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ *  Decoder of compressed files for csv_parse_file_ex(). The format is
+ *  told by the magic number at the start of the file, not by its name:
+ *  gzip is decoded by zlib, and zstd by libzstd, if the library was
+ *  built with them (CSV_HAVE_ZLIB, CSV_HAVE_ZSTD). Concatenated gzip
+ *  members and zstd frames are decoded one after another.
+ *
+ *  decode_read() is a csv_feed_t. csv_parse() runs it on its read-ahead
+ *  thread, so the decode of the next buffers overlaps the scan.
+ */
+#define DECODE_INSZ (256 * 1024) // compressed bytes read at a time
+#define DECODE_AHEAD 4           // default #buffers decoded ahead
+
+enum {
+  DECODE_NONE = 0,
+  DECODE_GZIP,
+  DECODE_ZSTD,
+};
+
+typedef struct decode_t decode_t;
+struct decode_t {
+  int fd;
+  int kind; // DECODE_xxx
+  const char *name;
+
+  // The compressed input. in[pos..len) is yet to be decoded. in[] has
+  // DECODE_INSZ bytes; the caller sets it after decode_open() and frees
+  // it, so that it comes from the caller's allocator.
+  char *in;
+  int pos, len;
+  bool ineof; // no more input from fd
+
+  // True in the middle of a gzip member or zstd frame. The input is
+  // truncated if it ends here.
+  bool midframe;
+
+#ifdef CSV_HAVE_ZLIB
+  z_stream zs;
+  bool zsinit;
+#endif
+#ifdef CSV_HAVE_ZSTD
+  ZSTD_DCtx *zd;
+#endif
+};
+
+// Return the DECODE_xxx format of a file that starts with p[0..n).
+static int decode_kind(const unsigned char *p, int n) {
+  if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+    return DECODE_GZIP;
+  }
+  if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f &&
+      p[3] == 0xfd) {
+    return DECODE_ZSTD;
+  }
+  return DECODE_NONE;
+}
+
+static void decode_close(decode_t *d) {
+#ifdef CSV_HAVE_ZLIB
+  if (d->zsinit) {
+    inflateEnd(&d->zs);
+  }
+#endif
+#ifdef CSV_HAVE_ZSTD
+  ZSTD_freeDCtx(d->zd);
+#endif
+  if (d->fd >= 0) {
+    close(d->fd);
+  }
+  memset(d, 0, sizeof(*d));
+  d->fd = -1;
+}
+
+// Open the file at path for decoding. Return 1 if it is compressed and
+// ready to be read once in[] is set, 0 if it is not compressed (or
+// cannot be opened; the caller reports that), and -1 with a message in
+// errbuf[] if it cannot be decoded.
+static int decode_open(decode_t *d, const char *path, char *errbuf,
+                       int errsz) {
+  memset(d, 0, sizeof(*d));
+  d->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (d->fd < 0) {
+    return 0;
+  }
+  unsigned char magic[4];
+  int n = pread(d->fd, magic, sizeof(magic), 0);
+  d->kind = decode_kind(magic, n < 0 ? 0 : n);
+
+  switch (d->kind) {
+  case DECODE_NONE:
+    decode_close(d);
+    return 0;
+
+  case DECODE_GZIP:
+    d->name = "gzip";
+#ifdef CSV_HAVE_ZLIB
+    // 15 + 32: the largest window, with a gzip or zlib header
+    if (inflateInit2(&d->zs, 15 + 32) != Z_OK) {
+      snprintf(errbuf, errsz, "%s", "inflateInit2 failed");
+      goto bail;
+    }
+    d->zsinit = true;
+    break;
+#else
+    snprintf(errbuf, errsz, "%s", "gzip input requires zlib");
+    goto bail;
+#endif
+
+  case DECODE_ZSTD:
+    d->name = "zstd";
+#ifdef CSV_HAVE_ZSTD
+    d->zd = ZSTD_createDCtx();
+    if (!d->zd) {
+      snprintf(errbuf, errsz, "%s", "ZSTD_createDCtx failed");
+      goto bail;
+    }
+    break;
+#else
+    snprintf(errbuf, errsz, "%s", "zstd input requires libzstd");
+    goto bail;
+#endif
+  }
+  return 1;
+
+bail:
+  decode_close(d);
+  return -1;
+}
+
+// Make sure that in[pos..len) is not empty, unless at EOF. Return 0 on
+// success, -1 otherwise.
+static int __decode_fill(decode_t *d, char *errbuf, int errsz) {
+  if (d->pos < d->len || d->ineof) {
+    return 0;
+  }
+  int n;
+  do {
+    n = read(d->fd, d->in, DECODE_INSZ);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    snprintf(errbuf, errsz, "read failed - %s", strerror(errno));
+    return -1;
+  }
+  d->pos = 0;
+  d->len = n;
+  d->ineof = (n == 0);
+  return 0;
+}
+
+// Decode some input into out[0..outsz). Return #bytes decoded, or -1
+// on error.
+static int __decode_step(decode_t *d, char *out, int outsz, char *errbuf,
+                         int errsz) {
+  char *in = d->in + d->pos;
+  int inlen = d->len - d->pos;
+  switch (d->kind) {
+#ifdef CSV_HAVE_ZLIB
+  case DECODE_GZIP: {
+    if (!d->midframe && inlen > 0) {
+      // start of the next member
+      inflateReset(&d->zs);
+    }
+    d->zs.next_in = (Bytef *)in;
+    d->zs.avail_in = inlen;
+    d->zs.next_out = (Bytef *)out;
+    d->zs.avail_out = outsz;
+    int rc = inflate(&d->zs, Z_NO_FLUSH);
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+      snprintf(errbuf, errsz, "corrupt gzip input - %s",
+               d->zs.msg ? d->zs.msg : "inflate failed");
+      return -1;
+    }
+    d->midframe = (rc != Z_STREAM_END);
+    d->pos += inlen - d->zs.avail_in;
+    return outsz - d->zs.avail_out;
+  }
+#endif
+#ifdef CSV_HAVE_ZSTD
+  case DECODE_ZSTD: {
+    ZSTD_inBuffer zin = {in, (size_t)inlen, 0};
+    ZSTD_outBuffer zout = {out, (size_t)outsz, 0};
+    size_t rc = ZSTD_decompressStream(d->zd, &zout, &zin);
+    if (ZSTD_isError(rc)) {
+      snprintf(errbuf, errsz, "corrupt zstd input - %s",
+               ZSTD_getErrorName(rc));
+      return -1;
+    }
+    // rc is 0 at the end of a frame
+    d->midframe = (rc != 0);
+    d->pos += zin.pos;
+    return zout.pos;
+  }
+#endif
+  }
+  (void)in;
+  (void)inlen;
+  (void)out;
+  (void)outsz;
+  snprintf(errbuf, errsz, "%s", "unknown compression");
+  return -1;
+}
+
+// A csv_feed_t on the decode_t in context.
+static int decode_read(void *context, char *buf, int bufsz, char *errbuf,
+                       int errsz) {
+  decode_t *d = (decode_t *)context;
+  int nread = 0;
+  while (nread < bufsz) {
+    if (__decode_fill(d, errbuf, errsz)) {
+      return -1;
+    }
+    if (d->ineof && !d->midframe) {
+      break;
+    }
+    int n = __decode_step(d, buf + nread, bufsz - nread, errbuf, errsz);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0 && d->ineof) {
+      // no more input, and no progress
+      snprintf(errbuf, errsz, "truncated %s input", d->name);
+      return -1;
+    }
+    nread += n;
+  }
+  return nread;
+}
+
+/*
+ *  Blocked formats, whose frames can be decoded independently of each
+ *  other, so that csv_parse_parallel() decodes them on all of its
+ *  threads:
+ *
+ *  - BGZF: a series of gzip members of up to 64KB each. The 'BC'
+ *    subfield of the extra field of each member holds its size.
+ *  - zstd seekable: a series of zstd frames, followed by a skippable
+ *    frame that holds the compressed and decompressed size of each.
+ *
+ *  In both, the decompressed size of every frame is known up front, so
+ *  each frame is decoded straight into its place in the output.
+ */
+typedef struct decode_frame_t decode_frame_t;
+struct decode_frame_t {
+  int64_t inoff, inlen;   // the frame is in[inoff..inoff+inlen)
+  int64_t outoff, outlen; // it decodes to out[outoff..outoff+outlen)
+};
+
+#define DECODE_ZSTD_SKIPPABLE 0x184D2A5E
+#define DECODE_ZSTD_SEEKABLE 0x8F92EAB1
+
+static inline uint32_t __decode_le16(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return u[0] | (u[1] << 8);
+}
+
+static inline uint32_t __decode_le32(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+// Return the size of the BGZF member at p[0..len), or 0 if it is not one.
+static int64_t __decode_bgzf_size(const char *p, int64_t len) {
+  // ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2), with FLG.FEXTRA set
+  if (len < 18 || decode_kind((const unsigned char *)p, 2) != DECODE_GZIP ||
+      p[2] != 8 || !(p[3] & 4)) {
+    return 0;
+  }
+  int64_t xlen = __decode_le16(p + 10);
+  const char *x = p + 12;
+  const char *xend = x + xlen;
+  if (12 + xlen > len) {
+    return 0;
+  }
+  // find the 'BC' subfield: SI1 SI2 SLEN(2) BSIZE(2)
+  while (x + 4 <= xend) {
+    int64_t slen = __decode_le16(x + 2);
+    if (x[0] == 'B' && x[1] == 'C' && slen == 2 && x + 6 <= xend) {
+      int64_t size = __decode_le16(x + 4) + 1;
+      return size <= len ? size : 0;
+    }
+    x += 4 + slen;
+  }
+  return 0;
+}
+
+// Index the BGZF members of p[0..len). Return #members, or 0 if this is
+// not BGZF all the way.
+static int64_t __decode_bgzf_frames(const char *p, int64_t len,
+                                    decode_frame_t *frame) {
+  int64_t n = 0, outoff = 0;
+  for (int64_t off = 0; off < len; n++) {
+    int64_t size = __decode_bgzf_size(p + off, len - off);
+    if (size < 26) {
+      return 0;
+    }
+    if (frame) {
+      frame[n].inoff = off;
+      frame[n].inlen = size;
+      frame[n].outoff = outoff;
+      frame[n].outlen = __decode_le32(p + off + size - 4); // ISIZE
+      outoff += frame[n].outlen;
+    }
+    off += size;
+  }
+  return n;
+}
+
+// Index the frames of the zstd seekable file p[0..len). Return #frames,
+// or 0 if there is no valid seek table.
+static int64_t __decode_zstd_frames(const char *p, int64_t len,
+                                    decode_frame_t *frame) {
+  // footer: Number_Of_Frames(4) Descriptor(1) Seekable_Magic(4)
+  if (len < 17 || __decode_le32(p + len - 4) != DECODE_ZSTD_SEEKABLE) {
+    return 0;
+  }
+  const int64_t n = __decode_le32(p + len - 9);
+  const int esz = (p[len - 5] & 0x80) ? 12 : 8; // with checksums?
+  const int64_t tabsz = 8 + n * esz + 9;
+  const int64_t tab = len - tabsz;
+  if (n == 0 || tab < 0 ||
+      __decode_le32(p + tab) != DECODE_ZSTD_SKIPPABLE ||
+      __decode_le32(p + tab + 4) != tabsz - 8) {
+    return 0;
+  }
+  int64_t inoff = 0, outoff = 0;
+  for (int64_t i = 0; i < n; i++) {
+    const char *e = p + tab + 8 + i * esz;
+    int64_t inlen = __decode_le32(e);
+    int64_t outlen = __decode_le32(e + 4);
+    if (frame) {
+      frame[i].inoff = inoff;
+      frame[i].inlen = inlen;
+      frame[i].outoff = outoff;
+      frame[i].outlen = outlen;
+    }
+    inoff += inlen;
+    outoff += outlen;
+  }
+  // the frames must cover everything up to the seek table
+  return inoff == tab ? n : 0;
+}
+
+// Index the frames of p[0..len) if it is in a blocked format. Return
+// #frames, or 0 if not blocked. frame[] is filled in if not NULL; call
+// with NULL first for the size of it.
+static int64_t decode_frames(const char *p, int64_t len, int *kind,
+                             decode_frame_t *frame) {
+  *kind = decode_kind((const unsigned char *)p, len < 4 ? len : 4);
+  int64_t (*index)(const char *, int64_t, decode_frame_t *) =
+      (*kind == DECODE_GZIP   ? __decode_bgzf_frames
+       : *kind == DECODE_ZSTD ? __decode_zstd_frames
+                              : 0);
+  int64_t n = index ? index(p, len, frame) : 0;
+  return n < 0 ? 0 : n;
+}
+
+// Decode one frame of a blocked format, in[0..inlen), into
+// out[0..outlen). Return 0 on success, -1 otherwise.
+static int decode_frame(int kind, const char *in, int64_t inlen, char *out,
+                        int64_t outlen, char *errbuf, int errsz) {
+  (void)in;
+  (void)inlen;
+  (void)out;
+  (void)outlen;
+  switch (kind) {
+  case DECODE_GZIP: {
+#ifdef CSV_HAVE_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+      snprintf(errbuf, errsz, "%s", "inflateInit2 failed");
+      return -1;
+    }
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = inlen;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = outlen;
+    int rc = inflate(&zs, Z_FINISH);
+    bool ok = (rc == Z_STREAM_END && zs.avail_out == 0);
+    inflateEnd(&zs);
+    if (!ok) {
+      snprintf(errbuf, errsz, "%s", "corrupt gzip input");
+      return -1;
+    }
+    return 0;
+#else
+    snprintf(errbuf, errsz, "%s", "gzip input requires zlib");
+    return -1;
+#endif
+  }
+
+  case DECODE_ZSTD: {
+#ifdef CSV_HAVE_ZSTD
+    size_t rc = ZSTD_decompress(out, outlen, in, inlen);
+    if (ZSTD_isError(rc) || (int64_t)rc != outlen) {
+      snprintf(errbuf, errsz, "corrupt zstd input - %s",
+               ZSTD_isError(rc) ? ZSTD_getErrorName(rc) : "bad size");
+      return -1;
+    }
+    return 0;
+#else
+    snprintf(errbuf, errsz, "%s", "zstd input requires libzstd");
+    return -1;
+#endif
+  }
+  }
+  snprintf(errbuf, errsz, "%s", "unknown compression");
+  return -1;
+}
@@ -0,0 +1,17 @@
+# Optional dependencies, included by the Makefiles that build or link
+# the library. zlib and libzstd are used if their headers are found.
+# CSV_LIBS lists the libraries to link with libcsvc17.a.
+
+CSV_LIBS = -lpthread
+
+HAVE_ZLIB := $(shell $(CC) -E -x c -include zlib.h /dev/null >/dev/null 2>&1 && echo 1)
+ifeq ($(HAVE_ZLIB),1)
+    CFLAGS += -DCSV_HAVE_ZLIB
+    CSV_LIBS += -lz
+endif
+
+HAVE_ZSTD := $(shell $(CC) -E -x c -include zstd.h /dev/null >/dev/null 2>&1 && echo 1)
+ifeq ($(HAVE_ZSTD),1)
+    CFLAGS += -DCSV_HAVE_ZSTD
+    CSV_LIBS += -lzstd
+endif
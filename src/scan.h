@@ -0,0 +1,549 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *  The SIMD code for each instruction set is packaged as a scan
+ *  kernel in scan_x86.h or scan_arm.h. A kernel is picked at runtime
+ *  by scan_kernel(), so a single build runs on every cpu of the
+ *  architecture and still uses the widest vectors available.
+ *
+ *  The rest of this file is shared by all kernels.
+ */
+// Counts over a range of bytes. See __scan_count().
+typedef struct scan_count_t scan_count_t;
+struct scan_count_t {
+  int64_t nqte; // #qte
+  int64_t nnl;  // #newlines
+  int64_t nrow; // #newlines outside of quotes
+};
+
+typedef struct scan_kernel_t scan_kernel_t;
+struct scan_kernel_t {
+  int id;           // CSV_KERNEL_xxx
+  const char *name; // name of the kernel, e.g. "avx2"
+
+  // Return a bitmap marking the bytes in p[0..len) that match any of
+  // accept[0..n). Requires 0 < len <= 64.
+  uint64_t (*match)(const char *p, int64_t len, const char *accept, int n);
+
+  // Stage 1 of the row parser. See __scan_index().
+  int (*index)(const char *buf, int *off, int end, char qte, char delim,
+               uint64_t *inquote, uint32_t *out, int max);
+
+  // Count qte and newlines in p[0..len). See __scan_count().
+  void (*count)(const char *p, int64_t len, char qte, scan_count_t *ret);
+
+  // Unquote p[0..len) in place. See __scan_unquote().
+  int (*unquote)(char *p, int len, char qte);
+
+  // Decode [+-]digits in p[0..len) into *ret. See __scan_int64().
+  int (*int64)(const char *p, int len, int64_t *ret);
+};
+
+// Classify the 64-byte block p[] into bitmaps of qte, delim and newline.
+typedef void scan_block64_t(const char *p, char qte, char delim,
+                            uint64_t *mqte, uint64_t *mdelim, uint64_t *mnl);
+
+// Bit i of the result is the XOR of bits 0..i of x.
+typedef uint64_t scan_prefix_xor_t(uint64_t x);
+
+// Pages are at least this large on every supported cpu.
+#define SCAN_PAGESZ 4096
+
+// True if the n bytes at p lie within one page. A short tail at p can
+// then be loaded as a whole n-byte vector without faulting, and the
+// bytes past the end masked off, instead of copying the tail into a
+// tmpbuf[] first. Small documents are mostly tail. Not under ASan or
+// TSan, which rightly flag the bytes past the end.
+static inline bool __scan_inpage(const void *p, int n) {
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+  (void)p;
+  (void)n;
+  return false;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+  (void)p;
+  (void)n;
+  return false;
+#endif
+#endif
+  return ((uintptr_t)p & (SCAN_PAGESZ - 1)) <= (uintptr_t)(SCAN_PAGESZ - n);
+}
+
+static inline bool __scan_inpage64(const void *p) {
+  return __scan_inpage(p, 64);
+}
+
+// Portable prefix xor for kernels without a carry-less multiply.
+static inline uint64_t __scan_prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/*
+ *  Stage 1: index buf[*off..end) 64 bytes at a time. Quoted regions
+ *  are resolved in bulk: with esc == qte, an escaped quote is simply a
+ *  pair of quotes, so a prefix-xor over the quote bitmap marks every
+ *  byte inside quotes. Delims inside quotes are dropped, and the
+ *  offsets of the remaining special chars are appended to out[].
+ *
+ *  Stops when the data runs out or out[] has less than 64 free
+ *  slots. Returns #offsets appended, and advances *off. *inquote is
+ *  all 1s if buf[*off - 1] is inside quotes.
+ *
+ *  This is a template: each kernel instantiates it with its own
+ *  block64 and prefix_xor so that they are inlined.
+ */
+static inline __attribute__((always_inline)) int
+__scan_index(const char *buf, int *poff, int end, char qte, char delim,
+             uint64_t *pinquote, uint32_t *out, int max,
+             scan_block64_t *block64, scan_prefix_xor_t *prefix_xor) {
+  uint64_t inquote = *pinquote;
+  int off = *poff;
+  int top = 0;
+  char tmpbuf[64];
+
+  while (off < end && top + 64 <= max) {
+    const char *p = buf + off;
+    int len = end - off;
+    if (len >= 64) {
+      len = 64;
+    } else if (!__scan_inpage64(p)) {
+      memset(tmpbuf, 0, sizeof(tmpbuf));
+      memcpy(tmpbuf, p, len);
+      p = tmpbuf;
+    }
+
+    uint64_t mqte, mdelim, mnl;
+    block64(p, qte, delim, &mqte, &mdelim, &mnl);
+    if (len < 64) {
+      uint64_t mask = (1ULL << len) - 1;
+      mqte &= mask;
+      mdelim &= mask;
+      mnl &= mask;
+    }
+
+    // inquote marks the bytes inside quotes, carried over from the
+    // previous block.
+    inquote ^= prefix_xor(mqte);
+    uint64_t bits = mqte | mnl | (mdelim & ~inquote);
+    inquote = (uint64_t)((int64_t)inquote >> 63);
+
+    // flatten the bitmap into offsets
+    while (bits) {
+      out[top++] = off + __builtin_ctzll(bits);
+      bits &= bits - 1;
+    }
+    off += len;
+  }
+
+  *poff = off;
+  *pinquote = inquote;
+  return top;
+}
+
+/*
+ *  Count the quotes, the newlines, and the newlines outside of quotes
+ *  in p[0..len), assuming that p[0] is outside of quotes. Used to
+ *  split a file into chunks of rows: if p[0] turns out to be inside
+ *  quotes, the newlines outside of quotes are (nnl - nrow) instead.
+ *
+ *  Only valid when esc == qte. This is a template like __scan_index().
+ */
+static inline __attribute__((always_inline)) void
+__scan_count(const char *p, int64_t len, char qte, scan_count_t *ret,
+             scan_block64_t *block64, scan_prefix_xor_t *prefix_xor) {
+  uint64_t inquote = 0;
+  int64_t nqte = 0, nnl = 0, nrow = 0;
+  char tmpbuf[64];
+
+  for (int64_t off = 0; off < len; off += 64) {
+    const char *b = p + off;
+    uint64_t mask = ~0ULL;
+    if (len - off < 64) {
+      memset(tmpbuf, 0, sizeof(tmpbuf));
+      memcpy(tmpbuf, b, len - off);
+      b = tmpbuf;
+      mask = (1ULL << (len - off)) - 1;
+    }
+
+    // qte is passed as delim; mdelim is not used.
+    uint64_t mqte, mdelim, mnl;
+    block64(b, qte, qte, &mqte, &mdelim, &mnl);
+    mqte &= mask;
+    mnl &= mask;
+
+    inquote ^= prefix_xor(mqte);
+    nqte += __builtin_popcountll(mqte);
+    nnl += __builtin_popcountll(mnl);
+    nrow += __builtin_popcountll(mnl & ~inquote);
+    inquote = (uint64_t)((int64_t)inquote >> 63);
+  }
+
+  ret->nqte = nqte;
+  ret->nnl = nnl;
+  ret->nrow = nrow;
+}
+
+// Copy the bytes r[i] where bit i of m is set to w[0..], and return
+// #bytes copied. Requires w <= r. May write up to 8 bytes at w.
+typedef int scan_compress8_t(char *w, const char *r, unsigned m);
+
+// Portable compress8 for kernels without a byte shuffle.
+static inline int __scan_compress8(char *w, const char *r, unsigned m) {
+  int n = 0;
+  for (int i = 0; i < 8; i++) {
+    w[n] = r[i];
+    n += (m >> i) & 1;
+  }
+  return n;
+}
+
+// SCAN_COMPRESS8[m] packs the indices of the set bits of m, one per
+// byte, for use as a byte shuffle by compress8.
+static const uint64_t SCAN_COMPRESS8[256] = {
+    0x0000000000000000, 0x0000000000000000, 0x0000000000000001,
+    0x0000000000000100, 0x0000000000000002, 0x0000000000000200,
+    0x0000000000000201, 0x0000000000020100, 0x0000000000000003,
+    0x0000000000000300, 0x0000000000000301, 0x0000000000030100,
+    0x0000000000000302, 0x0000000000030200, 0x0000000000030201,
+    0x0000000003020100, 0x0000000000000004, 0x0000000000000400,
+    0x0000000000000401, 0x0000000000040100, 0x0000000000000402,
+    0x0000000000040200, 0x0000000000040201, 0x0000000004020100,
+    0x0000000000000403, 0x0000000000040300, 0x0000000000040301,
+    0x0000000004030100, 0x0000000000040302, 0x0000000004030200,
+    0x0000000004030201, 0x0000000403020100, 0x0000000000000005,
+    0x0000000000000500, 0x0000000000000501, 0x0000000000050100,
+    0x0000000000000502, 0x0000000000050200, 0x0000000000050201,
+    0x0000000005020100, 0x0000000000000503, 0x0000000000050300,
+    0x0000000000050301, 0x0000000005030100, 0x0000000000050302,
+    0x0000000005030200, 0x0000000005030201, 0x0000000503020100,
+    0x0000000000000504, 0x0000000000050400, 0x0000000000050401,
+    0x0000000005040100, 0x0000000000050402, 0x0000000005040200,
+    0x0000000005040201, 0x0000000504020100, 0x0000000000050403,
+    0x0000000005040300, 0x0000000005040301, 0x0000000504030100,
+    0x0000000005040302, 0x0000000504030200, 0x0000000504030201,
+    0x0000050403020100, 0x0000000000000006, 0x0000000000000600,
+    0x0000000000000601, 0x0000000000060100, 0x0000000000000602,
+    0x0000000000060200, 0x0000000000060201, 0x0000000006020100,
+    0x0000000000000603, 0x0000000000060300, 0x0000000000060301,
+    0x0000000006030100, 0x0000000000060302, 0x0000000006030200,
+    0x0000000006030201, 0x0000000603020100, 0x0000000000000604,
+    0x0000000000060400, 0x0000000000060401, 0x0000000006040100,
+    0x0000000000060402, 0x0000000006040200, 0x0000000006040201,
+    0x0000000604020100, 0x0000000000060403, 0x0000000006040300,
+    0x0000000006040301, 0x0000000604030100, 0x0000000006040302,
+    0x0000000604030200, 0x0000000604030201, 0x0000060403020100,
+    0x0000000000000605, 0x0000000000060500, 0x0000000000060501,
+    0x0000000006050100, 0x0000000000060502, 0x0000000006050200,
+    0x0000000006050201, 0x0000000605020100, 0x0000000000060503,
+    0x0000000006050300, 0x0000000006050301, 0x0000000605030100,
+    0x0000000006050302, 0x0000000605030200, 0x0000000605030201,
+    0x0000060503020100, 0x0000000000060504, 0x0000000006050400,
+    0x0000000006050401, 0x0000000605040100, 0x0000000006050402,
+    0x0000000605040200, 0x0000000605040201, 0x0000060504020100,
+    0x0000000006050403, 0x0000000605040300, 0x0000000605040301,
+    0x0000060504030100, 0x0000000605040302, 0x0000060504030200,
+    0x0000060504030201, 0x0006050403020100, 0x0000000000000007,
+    0x0000000000000700, 0x0000000000000701, 0x0000000000070100,
+    0x0000000000000702, 0x0000000000070200, 0x0000000000070201,
+    0x0000000007020100, 0x0000000000000703, 0x0000000000070300,
+    0x0000000000070301, 0x0000000007030100, 0x0000000000070302,
+    0x0000000007030200, 0x0000000007030201, 0x0000000703020100,
+    0x0000000000000704, 0x0000000000070400, 0x0000000000070401,
+    0x0000000007040100, 0x0000000000070402, 0x0000000007040200,
+    0x0000000007040201, 0x0000000704020100, 0x0000000000070403,
+    0x0000000007040300, 0x0000000007040301, 0x0000000704030100,
+    0x0000000007040302, 0x0000000704030200, 0x0000000704030201,
+    0x0000070403020100, 0x0000000000000705, 0x0000000000070500,
+    0x0000000000070501, 0x0000000007050100, 0x0000000000070502,
+    0x0000000007050200, 0x0000000007050201, 0x0000000705020100,
+    0x0000000000070503, 0x0000000007050300, 0x0000000007050301,
+    0x0000000705030100, 0x0000000007050302, 0x0000000705030200,
+    0x0000000705030201, 0x0000070503020100, 0x0000000000070504,
+    0x0000000007050400, 0x0000000007050401, 0x0000000705040100,
+    0x0000000007050402, 0x0000000705040200, 0x0000000705040201,
+    0x0000070504020100, 0x0000000007050403, 0x0000000705040300,
+    0x0000000705040301, 0x0000070504030100, 0x0000000705040302,
+    0x0000070504030200, 0x0000070504030201, 0x0007050403020100,
+    0x0000000000000706, 0x0000000000070600, 0x0000000000070601,
+    0x0000000007060100, 0x0000000000070602, 0x0000000007060200,
+    0x0000000007060201, 0x0000000706020100, 0x0000000000070603,
+    0x0000000007060300, 0x0000000007060301, 0x0000000706030100,
+    0x0000000007060302, 0x0000000706030200, 0x0000000706030201,
+    0x0000070603020100, 0x0000000000070604, 0x0000000007060400,
+    0x0000000007060401, 0x0000000706040100, 0x0000000007060402,
+    0x0000000706040200, 0x0000000706040201, 0x0000070604020100,
+    0x0000000007060403, 0x0000000706040300, 0x0000000706040301,
+    0x0000070604030100, 0x0000000706040302, 0x0000070604030200,
+    0x0000070604030201, 0x0007060403020100, 0x0000000000070605,
+    0x0000000007060500, 0x0000000007060501, 0x0000000706050100,
+    0x0000000007060502, 0x0000000706050200, 0x0000000706050201,
+    0x0000070605020100, 0x0000000007060503, 0x0000000706050300,
+    0x0000000706050301, 0x0000070605030100, 0x0000000706050302,
+    0x0000070605030200, 0x0000070605030201, 0x0007060503020100,
+    0x0000000007060504, 0x0000000706050400, 0x0000000706050401,
+    0x0000070605040100, 0x0000000706050402, 0x0000070605040200,
+    0x0000070605040201, 0x0007060504020100, 0x0000000706050403,
+    0x0000070605040300, 0x0000070605040301, 0x0007060504030100,
+    0x0000070605040302, 0x0007060504030200, 0x0007060504030201,
+    0x0706050403020100,
+};
+
+/*
+ *  Unquote p[0..len) in place, 64 bytes at a time, and return the new
+ *  length. Only valid when esc == qte.
+ *
+ *  With esc == qte, every qte is dropped except the second one of a
+ *  pair inside quotes: that is a qte right after another qte, where
+ *  the prefix-xor says that it is inside quotes again. The bytes kept
+ *  are compacted 8 at a time by compress8, so the cost does not
+ *  depend on the number of escapes.
+ *
+ *  This is a template like __scan_index().
+ */
+static inline __attribute__((always_inline)) int
+__scan_unquote(char *p, int len, char qte, scan_block64_t *block64,
+               scan_prefix_xor_t *prefix_xor, scan_compress8_t *compress8) {
+  uint64_t inquote = 0; // all 1s if the previous byte is inside quotes
+  uint64_t prevqte = 0; // 1 if the previous byte is qte
+  char *w = p;          // write cursor
+  char tmpbuf[64];
+
+  for (int off = 0; off < len; off += 64) {
+    char *b = p + off;
+    int n = len - off;
+    if (n < 64) {
+      memset(tmpbuf, 0, sizeof(tmpbuf));
+      memcpy(tmpbuf, b, n);
+      b = tmpbuf;
+    } else {
+      n = 64;
+    }
+
+    // qte is passed as delim; mdelim and mnl are not used.
+    uint64_t mqte, mdelim, mnl;
+    block64(b, qte, qte, &mqte, &mdelim, &mnl);
+    uint64_t valid = (n < 64 ? (1ULL << n) - 1 : ~0ULL);
+    mqte &= valid;
+
+    uint64_t px = prefix_xor(mqte) ^ inquote;
+    uint64_t keep = (~mqte | (mqte & ((mqte << 1) | prevqte) & px)) & valid;
+    inquote = (uint64_t)((int64_t)px >> 63);
+    prevqte = mqte >> 63;
+
+    if (keep == ~0ULL) {
+      // nothing to drop
+      if (w != b) {
+        memmove(w, b, 64);
+      }
+      w += 64;
+      continue;
+    }
+
+    // compress8 may write 8 bytes; the tail is compacted within
+    // tmpbuf[] so that nothing past p[len] is touched.
+    char *dst = (b == tmpbuf ? tmpbuf : w);
+    char *d = dst;
+    for (int i = 0; i < n; i += 8) {
+      d += compress8(d, b + i, (keep >> i) & 0xff);
+    }
+    if (dst == tmpbuf) {
+      memcpy(w, tmpbuf, d - tmpbuf);
+    }
+    w += d - dst;
+  }
+  return w - p;
+}
+
+/*
+ *  Decode [+-]digits in p[0..len) into *ret, and return 0, or -1 if
+ *  p[] is not an int64. Leading zeros are allowed.
+ *
+ *  The last 16 digits at most are converted at once by digits16; the
+ *  up to 3 digits before them, digit by digit. 19 digits cannot
+ *  overflow a uint64_t, so the range check is a single compare at the
+ *  end.
+ *
+ *  This is a template like __scan_index().
+ */
+
+// Convert the n digits in p[0..n) to *val, and return true, or false
+// if they are not all digits. Requires 0 < n <= 16. May read up to 16
+// bytes at p.
+typedef bool scan_digits16_t(const char *p, int n, uint64_t *val);
+
+// Byte i of SCAN_ALIGN16 + n is the index to move byte i - (16 - n) of
+// a vector to byte i, or -1 to zero byte i. This right-aligns the n
+// digits at the front of a vector.
+static const int8_t SCAN_ALIGN16[32] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15};
+
+// Convert 8 digits, the first in the low byte of x, to a number. See
+// http://0x80.pl/articles/swar-digits-validate.html and
+// https://kholdstare.github.io/technical/2020/05/26/faster-integer-parsing.html
+static inline bool __scan_swar8(uint64_t x, uint64_t *val) {
+  // every byte is in '0'..'9'
+  if (((x + 0x4646464646464646) | (x - 0x3030303030303030)) &
+      0x8080808080808080) {
+    return false;
+  }
+  x = (x & 0x0f0f0f0f0f0f0f0f) * 2561 >> 8;
+  x = (x & 0x00ff00ff00ff00ff) * 6553601 >> 16;
+  *val = (uint32_t)((x & 0x0000ffff0000ffff) * 42949672960001 >> 32);
+  return true;
+}
+
+// Portable digits16 for kernels without a byte shuffle: 8 digits at a
+// time in a uint64_t. Assumes a little-endian cpu.
+static inline bool __scan_digits16(const char *p, int n, uint64_t *val) {
+  uint64_t hi = 0, lo;
+  if (n > 8) {
+    uint64_t x = 0x3030303030303030; // '0' pads the front
+    memcpy((char *)&x + 16 - n, p, n - 8);
+    if (!__scan_swar8(x, &hi)) {
+      return false;
+    }
+    p += n - 8;
+    n = 8;
+  }
+  uint64_t x = 0x3030303030303030;
+  memcpy((char *)&x + 8 - n, p, n);
+  if (!__scan_swar8(x, &lo)) {
+    return false;
+  }
+  *val = hi * 100000000 + lo;
+  return true;
+}
+
+static inline __attribute__((always_inline)) int
+__scan_int64(const char *p, int len, int64_t *ret,
+             scan_digits16_t *digits16) {
+  const char *q = p + len;
+  bool neg = false;
+  if (p < q && (*p == '+' || *p == '-')) {
+    neg = (*p++ == '-');
+  }
+  while (q - p > 19 && *p == '0') {
+    p++;
+  }
+  int n = q - p;
+  if (n <= 0 || n > 19) {
+    return -1;
+  }
+  uint64_t hi = 0, lo;
+  for (; n > 16; n--, p++) {
+    unsigned d = (unsigned char)*p - '0';
+    if (d > 9) {
+      return -1;
+    }
+    hi = hi * 10 + d;
+  }
+  if (!digits16(p, n, &lo)) {
+    return -1;
+  }
+  // at most 999 * 10^16 + 10^16 - 1, which fits
+  uint64_t val = hi * 10000000000000000 + lo;
+  if (val > (uint64_t)INT64_MAX + neg) {
+    return -1;
+  }
+  *ret = (neg && val) ? -(int64_t)(val - 1) - 1 : (int64_t)val;
+  return 0;
+}
+
+/**
+ *  This is a scanner that uses SIMD to locate the next interesting
+ *  char in an array of bytes. Supports up to 4 interesting chars.
+ */
+typedef struct scan_t scan_t;
+struct scan_t {
+  const scan_kernel_t *kernel;
+  char accept[4]; // up to 4 interesting chars
+  int naccept;    // #chars in accept[]
+
+  // orig <= base <= p <= q.
+  const char *orig; // scan started here
+  const char *base; // the current 64 bytes in orig[]
+  const char *p;    // ptr to current token
+  const char *q;    // scan ends here
+
+  uint64_t flag; // bmap marks interesting bits offset from base
+};
+
+// Set the flag field, which is bitmap that indicate which char
+// indexed from base is interesting.
+static inline int __scan_calcflag(scan_t *scan) {
+  int64_t len = scan->q - scan->base;
+  if (len <= 0) {
+    return -1;
+  }
+  if (len > 64) {
+    len = 64;
+  }
+  scan->flag =
+      scan->kernel->match(scan->base, len, scan->accept, scan->naccept);
+  return 0;
+}
+
+// Initialize a scan using kernel. The interesting chars are provided
+// in the string 'accept', which must not be longer than 4 chars. This
+// is similar to strpbrk().
+static scan_t scan_init(const char *accept, const scan_kernel_t *kernel) {
+  scan_t scan;
+  memset(&scan, 0, sizeof(scan));
+  scan.kernel = kernel;
+  for (int i = 0; i < 4; i++) {
+    if (!accept[i])
+      break;
+    scan.accept[scan.naccept++] = accept[i];
+  }
+  return scan;
+}
+
+// Get ready to scan buf[].
+static inline void scan_reset(scan_t *scan, const char *buf, int64_t buflen) {
+  scan->orig = buf;
+  scan->base = buf;
+  scan->p = buf;
+  scan->q = buf + buflen;
+  scan->flag = 0;
+  __scan_calcflag(scan);
+}
+
+// Move to the next SIMD pipeline
+static void __scan_forward(scan_t *scan) {
+  while (!scan->flag) {
+    scan->base += 64; // 64 at a time
+    // use new base to find the new scan->flag
+    if (__scan_calcflag(scan))
+      break;
+  }
+}
+
+// Return a pointer to the next interesting char, or NULL if not found.
+static inline const char *scan_next(scan_t *scan) {
+  if (!scan->flag) {
+    __scan_forward(scan);
+  }
+  // __builtin_ffsll: returns one plus the index of the least significant
+  // 1-bit of x, or if x is zero, returns zero.
+  int off = __builtin_ffsll(scan->flag) - 1;
+  if (off >= 0) {
+    scan->flag &= scan->flag - 1; // clear the bit at off
+    scan->p = scan->base + off;
+  } else {
+    scan->p = scan->q;
+  }
+  return (scan->p < scan->q) ? scan->p++ : 0;
+}
+
+// Return TRUE if the current char matches ch.
+static inline int scan_match(scan_t *scan, int ch) { return ch == *scan->p; }
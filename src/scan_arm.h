@@ -1,112 +1,148 @@
 #pragma once
+#include "csvc17.h"
+#include "scan.h"
 #include <arm_neon.h>
-#include <stdint.h>
-#include <string.h>
 
-typedef struct scan_t scan_t;
-struct scan_t {
-  char inuse[4];
-  uint8x16_t ch[4];
-  char tmpbuf[16]; // copy when (q-base) < 16 bytes
+/*
+ *  aarch64 scan kernel. NEON is part of the armv8-a baseline, so
+ *  there is only one kernel.
+ */
 
-  // orig <= base <= p <= q.
-  const char *orig; // scan started here
-  const char *base; // the current 32-byte in orig[]
-  const char *p;    // ptr to current token
-  const char *q;    // scan ends here
-
-  uint32_t flag; // bmap marks interesting bits offset from base
-};
+// Bit i of the result is the XOR of bits 0..i of x.
+static inline uint64_t __scan_prefix_xor_neon(uint64_t x) {
+#ifdef __ARM_FEATURE_AES
+  // carry-less multiply by all ones
+  return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64(x, ~0ULL)), 0);
+#else
+  return __scan_prefix_xor(x);
+#endif
+}
 
-static int __scan_calcflag(scan_t *scan) {
-  const char *base = scan->base;
-  int64_t len = scan->q - base;
-  if (len < 16) {
-    if (len <= 0) {
-      return -1;
-    }
-    memcpy(scan->tmpbuf, base, len);
-    base = scan->tmpbuf;
-  } else if (((intptr_t)base) & 0xf) {
-    memcpy(scan->tmpbuf, base, 16);
-    base = scan->tmpbuf;
-  }
+// Convert four 16-byte compare results (0x00 or 0xFF per byte) into
+// a 64-bit bitmap.
+static inline uint64_t __movemask_neon(uint8x16_t c0, uint8x16_t c1,
+                                       uint8x16_t c2, uint8x16_t c3) {
+  const uint8x16_t bitmask = {1, 2, 4, 8, 16, 32, 64, 128,
+                              1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t t0 = vandq_u8(c0, bitmask);
+  uint8x16_t t1 = vandq_u8(c1, bitmask);
+  uint8x16_t t2 = vandq_u8(c2, bitmask);
+  uint8x16_t t3 = vandq_u8(c3, bitmask);
+  uint8x16_t sum0 = vpaddq_u8(t0, t1);
+  uint8x16_t sum1 = vpaddq_u8(t2, t3);
+  sum0 = vpaddq_u8(sum0, sum1);
+  sum0 = vpaddq_u8(sum0, sum0);
+  return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
+}
 
-  // Load 16 bytes from base
-  uint8x16_t src = vld1q_u8((const uint8_t *)base);
+static inline uint64_t __eq64_neon(const uint8x16_t s[4], char ch) {
+  uint8x16_t c = vdupq_n_u8(ch);
+  return __movemask_neon(vceqq_u8(s[0], c), vceqq_u8(s[1], c),
+                         vceqq_u8(s[2], c), vceqq_u8(s[3], c));
+}
 
-  // Compare each byte with ch[i] (0xFF if equal, 0x00 otherwise)
-  uint8x16_t cmp = vceqq_u8(src, scan->ch[0]);
-  for (int i = 1; i < 4; i++) {
-    if (scan->inuse[i]) {
-      cmp = vorrq_u8(cmp, vceqq_u8(src, scan->ch[i]));
-    }
+static inline void __load64_neon(const char *p, uint8x16_t s[4]) {
+  const uint8_t *u = (const uint8_t *)p;
+  for (int i = 0; i < 4; i++) {
+    s[i] = vld1q_u8(u + 16 * i);
   }
+}
 
-  // convert cmp to bitmap. cmp contains 0x00 or 0xFF.
-  // Extract high and low halves
-  const uint8x8_t lo = vget_low_u8(cmp);
-  const uint8x8_t hi = vget_high_u8(cmp);
+static uint64_t match_neon(const char *p, int64_t len, const char *accept,
+                           int n) {
+  char tmpbuf[64];
+  if (len < 64 && !__scan_inpage64(p)) {
+    memset(tmpbuf, 0, sizeof(tmpbuf));
+    memcpy(tmpbuf, p, len);
+    p = tmpbuf;
+  }
+  uint8x16_t s[4];
+  __load64_neon(p, s);
+  uint64_t flag = 0;
+  for (int i = 0; i < n; i++) {
+    flag |= __eq64_neon(s, accept[i]);
+  }
+  // the bytes past len, if loaded, are not data
+  return len < 64 ? flag & ((1ULL << len) - 1) : flag;
+}
 
-  // Multiply by bit pattern and horizontal add
-  const uint8x8_t bitmask = {1, 2, 4, 8, 16, 32, 64, 128};
-  const uint16_t mask_lo = vaddlv_u8(vand_u8(lo, bitmask));
-  const uint16_t mask_hi = vaddlv_u8(vand_u8(hi, bitmask));
+static inline void block64_neon(const char *p, char qte, char delim,
+                                uint64_t *mqte, uint64_t *mdelim,
+                                uint64_t *mnl) {
+  uint8x16_t s[4];
+  __load64_neon(p, s);
+  *mqte = __eq64_neon(s, qte);
+  *mdelim = __eq64_neon(s, delim);
+  *mnl = __eq64_neon(s, '\n');
+}
 
-  scan->flag = mask_lo | (mask_hi << 8);
-  return 0;
+static int index_neon(const char *buf, int *off, int end, char qte,
+                      char delim, uint64_t *inquote, uint32_t *out, int max) {
+  return __scan_index(buf, off, end, qte, delim, inquote, out, max,
+                      block64_neon, __scan_prefix_xor_neon);
 }
 
-// Initialize a scan. The interesting chars are provided in the string
-// 'accept', which must not be longer than 4 chars. This is similar to
-// strpbrk().
-static scan_t scan_init(const char *accept) {
-  scan_t scan;
-  memset(&scan, 0, sizeof(scan));
-  for (int i = 0; i < 4; i++) {
-    if (!accept[i])
-      break;
-    scan.ch[i] = vdupq_n_u8(accept[i]);
-    scan.inuse[i] = 1;
-  }
-  return scan;
+// Compress8 using a table lookup. See __scan_compress8().
+static inline int __scan_compress8_neon(char *w, const char *r, unsigned m) {
+  uint8x8_t v = vld1_u8((const uint8_t *)r);
+  uint8x8_t idx = vcreate_u8(SCAN_COMPRESS8[m]);
+  vst1_u8((uint8_t *)w, vtbl1_u8(v, idx));
+  return __builtin_popcount(m);
 }
 
-// Get ready to scan buf[].
-static inline void scan_reset(scan_t *scan, const char *buf, int64_t buflen) {
-  scan->orig = buf;
-  scan->base = buf;
-  scan->p = buf;
-  scan->q = buf + buflen;
-  __scan_calcflag(scan);
+static int unquote_neon(char *p, int len, char qte) {
+  return __scan_unquote(p, len, qte, block64_neon, __scan_prefix_xor_neon,
+                        __scan_compress8_neon);
 }
 
-// Move to the next SIMD pipeline
-static void __scan_forward(scan_t *scan) {
-  while (!scan->flag) {
-    scan->base += 16; // 16 at a time
-    // use new base to find the new scan->flag
-    if (__scan_calcflag(scan))
-      break;
-  }
+static void count_neon(const char *p, int64_t len, char qte,
+                       scan_count_t *ret) {
+  __scan_count(p, len, qte, ret, block64_neon, __scan_prefix_xor_neon);
 }
 
-// Return a pointer to the next interesting char, or NULL if not found.
-static inline const char *scan_next(scan_t *scan) {
-  if (!scan->flag) {
-    __scan_forward(scan);
+// Digits16 using a table lookup and multiply-adds of adjacent lanes.
+// See __scan_int64().
+static inline bool __scan_digits16_neon(const char *p, int n,
+                                        uint64_t *val) {
+  char tmpbuf[16] = {0};
+  if (!__scan_inpage(p, 16)) {
+    memcpy(tmpbuf, p, n);
+    p = tmpbuf;
   }
-  // __builtin_ffs: returns one plus the index of the least significant 1-bit of
-  // x, or if x is zero, returns zero.
-  int off = __builtin_ffs(scan->flag) - 1;
-  if (off >= 0) {
-    scan->flag &= ~(1 << off); // clear the bit at off
-    scan->p = scan->base + off;
-  } else {
-    scan->p = scan->q;
+  uint8x16_t v = vsubq_u8(vld1q_u8((const uint8_t *)p), vdupq_n_u8('0'));
+  // right-align the digits, with zeros in front
+  v = vqtbl1q_u8(v, vreinterpretq_u8_s8(vld1q_s8(SCAN_ALIGN16 + n)));
+  // every byte is 0..9
+  if (vmaxvq_u8(v) > 9) {
+    return false;
   }
-  return (scan->p < scan->q) ? scan->p++ : 0;
+  // 16 x 1 digit -> 8 x 2 digits -> 4 x 4 digits
+  uint16x8_t w = vreinterpretq_u16_u8(v);
+  w = vmlaq_n_u16(vshrq_n_u16(w, 8), vandq_u16(w, vdupq_n_u16(0xff)), 10);
+  uint32x4_t d = vreinterpretq_u32_u16(w);
+  d = vmlaq_n_u32(vshrq_n_u32(d, 16), vandq_u32(d, vdupq_n_u32(0xffff)),
+                  100);
+  uint64_t hi = vgetq_lane_u32(d, 0) * 10000ULL + vgetq_lane_u32(d, 1);
+  uint64_t lo = vgetq_lane_u32(d, 2) * 10000ULL + vgetq_lane_u32(d, 3);
+  *val = hi * 100000000 + lo;
+  return true;
+}
+
+static int int64_neon(const char *p, int len, int64_t *ret) {
+  return __scan_int64(p, len, ret, __scan_digits16_neon);
 }
 
-// Return TRUE if the current char matches ch.
-static inline int scan_match(scan_t *scan, int ch) { return ch == *scan->p; }
+static const scan_kernel_t SCAN_NEON = {
+    CSV_KERNEL_NEON, "neon",       match_neon, index_neon,
+    count_neon,      unquote_neon, int64_neon};
+
+// Return the kernel for id, or NULL if the cpu does not support
+// it. CSV_KERNEL_AUTO returns the best kernel for the cpu.
+static const scan_kernel_t *scan_kernel(int id) {
+  switch (id) {
+  case CSV_KERNEL_AUTO:
+  case CSV_KERNEL_NEON:
+    return &SCAN_NEON;
+  }
+  return 0;
+}
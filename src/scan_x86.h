@@ -1,109 +1,271 @@
 #pragma once
-#include <stdint.h>
-#include <string.h>
+#include "csvc17.h"
+#include "scan.h"
 #include <x86intrin.h>
 
-/**
- *  This is a scanner that uses SIMD to locate the next interesting
- *  char in an array of bytes. Supports up to 4 interesting chars.
+/*
+ *  x86_64 scan kernels. Each kernel is compiled for its own
+ *  instruction set using the target attribute, so the library itself
+ *  only requires the x86_64 baseline (SSE2). scan_kernel() checks the
+ *  cpu before handing out a kernel.
  */
-typedef struct scan_t scan_t;
-struct scan_t {
-  // for alignment
-  char inuse[4];   // flag which of ch[x] are in use
-  __m256i ch[4];   // up to 4 interesting char or 0
-  char tmpbuf[32]; // copy when (q-base) < 32 bytes
-
-  // orig <= base <= p <= q.
-  const char *orig; // scan started here
-  const char *base; // the current 32-byte in orig[]
-  const char *p;    // ptr to current token
-  const char *q;    // scan ends here
-
-  uint32_t flag; // bmap marks interesting bits offset from base
-};
-
-// Set the flag field, which is bitmap that indicate which char
-// indexed from base is interesting.
-static int __scan_calcflag(scan_t *scan) {
-  const char *base = scan->base;
-  int64_t len = scan->q - base;
-  if (len < 32) {
-    if (len <= 0) {
-      return -1;
-    }
-    // memset(scan->tmpbuf, 0, sizeof(scan->tmpbuf));
-    memcpy(scan->tmpbuf, base, len);
-    base = scan->tmpbuf;
-  }
-#ifdef ALIGNED_LOAD
-  // don't need this on x86
-  else if (((intptr_t)base) & 0x1f) {
-    memcpy(scan->tmpbuf, base, 32);
-    base = scan->tmpbuf;
+#define TARGET_AVX2 __attribute__((target("avx2,pclmul")))
+#define TARGET_AVX512BW __attribute__((target("avx512bw,pclmul")))
+
+// Bit i of the result is the XOR of bits 0..i of x.
+static inline __attribute__((target("pclmul"))) uint64_t
+__scan_prefix_xor_clmul(uint64_t x) {
+  // carry-less multiply by all ones
+  __m128i r =
+      _mm_clmulepi64_si128(_mm_set_epi64x(0, x), _mm_set1_epi8(-1), 0);
+  return _mm_cvtsi128_si64(r);
+}
+
+// Compress8 using a byte shuffle. See __scan_compress8().
+static inline __attribute__((target("ssse3"))) int
+__scan_compress8_ssse3(char *w, const char *r, unsigned m) {
+  __m128i v = _mm_loadl_epi64((const __m128i *)r);
+  __m128i idx = _mm_cvtsi64_si128(SCAN_COMPRESS8[m]);
+  _mm_storel_epi64((__m128i *)w, _mm_shuffle_epi8(v, idx));
+  return __builtin_popcount(m);
+}
+
+// Digits16 using a byte shuffle and multiply-adds of adjacent lanes.
+// See __scan_int64().
+static inline __attribute__((target("ssse3"))) bool
+__scan_digits16_ssse3(const char *p, int n, uint64_t *val) {
+  char tmpbuf[16] = {0};
+  if (!__scan_inpage(p, 16)) {
+    memcpy(tmpbuf, p, n);
+    p = tmpbuf;
   }
-#endif
-
-  __m256i src = _mm256_loadu_si256((__m256i *)base);
-  scan->flag = _mm256_movemask_epi8(_mm256_cmpeq_epi8(src, scan->ch[0]));
-  for (int i = 1; i < 4; i++) {
-    if (scan->inuse[i]) {
-      scan->flag |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(src, scan->ch[i]));
-    }
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  v = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+  // right-align the digits, with zeros in front
+  __m128i align = _mm_loadu_si128((const __m128i *)(SCAN_ALIGN16 + n));
+  v = _mm_shuffle_epi8(v, align);
+  // every byte is 0..9
+  __m128i ok = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(9)), v);
+  if (_mm_movemask_epi8(ok) != 0xffff) {
+    return false;
   }
-  return 0;
+  // 16 x 1 digit -> 8 x 2 digits -> 4 x 4 digits -> 2 x 8 digits
+  v = _mm_maddubs_epi16(v, _mm_set_epi8(1, 10, 1, 10, 1, 10, 1, 10, 1, 10,
+                                        1, 10, 1, 10, 1, 10));
+  v = _mm_madd_epi16(v, _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100));
+  v = _mm_packs_epi32(v, v);
+  v = _mm_madd_epi16(v,
+                     _mm_set_epi16(1, 10000, 1, 10000, 1, 10000, 1, 10000));
+  uint64_t hi = (uint32_t)_mm_cvtsi128_si32(v);
+  uint64_t lo = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+  *val = hi * 100000000 + lo;
+  return true;
 }
 
-// Initialize a scan. The interesting chars are provided in the string
-// 'accept', which must not be longer than 4 chars. This is similar to
-// strpbrk().
-static scan_t scan_init(const char *accept) {
-  scan_t scan;
-  memset(&scan, 0, sizeof(scan));
+/////////////////////////////////////////////
+// SSE2: 16 bytes at a time.
+//
+static inline uint64_t __movemask_sse2(__m128i c0, __m128i c1, __m128i c2,
+                                       __m128i c3) {
+  return (uint64_t)(uint16_t)_mm_movemask_epi8(c0) |
+         ((uint64_t)(uint16_t)_mm_movemask_epi8(c1) << 16) |
+         ((uint64_t)(uint16_t)_mm_movemask_epi8(c2) << 32) |
+         ((uint64_t)(uint16_t)_mm_movemask_epi8(c3) << 48);
+}
+
+static inline uint64_t __eq64_sse2(const __m128i s[4], char ch) {
+  __m128i c = _mm_set1_epi8(ch);
+  return __movemask_sse2(_mm_cmpeq_epi8(s[0], c), _mm_cmpeq_epi8(s[1], c),
+                         _mm_cmpeq_epi8(s[2], c), _mm_cmpeq_epi8(s[3], c));
+}
+
+static inline void __load64_sse2(const char *p, __m128i s[4]) {
   for (int i = 0; i < 4; i++) {
-    if (!accept[i])
-      break;
-    scan.ch[i] = _mm256_set1_epi8(accept[i]);
-    scan.inuse[i] = 1;
+    s[i] = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+  }
+}
+
+static uint64_t match_sse2(const char *p, int64_t len, const char *accept,
+                           int n) {
+  char tmpbuf[64];
+  if (len < 64 && !__scan_inpage64(p)) {
+    memset(tmpbuf, 0, sizeof(tmpbuf));
+    memcpy(tmpbuf, p, len);
+    p = tmpbuf;
+  }
+  __m128i s[4];
+  __load64_sse2(p, s);
+  uint64_t flag = 0;
+  for (int i = 0; i < n; i++) {
+    flag |= __eq64_sse2(s, accept[i]);
   }
-  return scan;
+  // the bytes past len, if loaded, are not data
+  return len < 64 ? flag & ((1ULL << len) - 1) : flag;
 }
 
-// Get ready to scan buf[].
-static inline void scan_reset(scan_t *scan, const char *buf, int64_t buflen) {
-  scan->orig = buf;
-  scan->base = buf;
-  scan->p = buf;
-  scan->q = buf + buflen;
-  __scan_calcflag(scan);
+static inline void block64_sse2(const char *p, char qte, char delim,
+                                uint64_t *mqte, uint64_t *mdelim,
+                                uint64_t *mnl) {
+  __m128i s[4];
+  __load64_sse2(p, s);
+  *mqte = __eq64_sse2(s, qte);
+  *mdelim = __eq64_sse2(s, delim);
+  *mnl = __eq64_sse2(s, '\n');
 }
 
-// Move to the next SIMD pipeline
-static void __scan_forward(scan_t *scan) {
-  while (!scan->flag) {
-    scan->base += 32; // 32 at a time
-    // use new base to find the new scan->flag
-    if (__scan_calcflag(scan))
-      break;
-  }
+static int index_sse2(const char *buf, int *off, int end, char qte,
+                      char delim, uint64_t *inquote, uint32_t *out, int max) {
+  return __scan_index(buf, off, end, qte, delim, inquote, out, max,
+                      block64_sse2, __scan_prefix_xor);
+}
+
+static void count_sse2(const char *p, int64_t len, char qte,
+                       scan_count_t *ret) {
+  __scan_count(p, len, qte, ret, block64_sse2, __scan_prefix_xor);
+}
+
+static int unquote_sse2(char *p, int len, char qte) {
+  return __scan_unquote(p, len, qte, block64_sse2, __scan_prefix_xor,
+                        __scan_compress8);
 }
 
-// Return a pointer to the next interesting char, or NULL if not found.
-static inline const char *scan_next(scan_t *scan) {
-  if (!scan->flag) {
-    __scan_forward(scan);
+static int int64_sse2(const char *p, int len, int64_t *ret) {
+  return __scan_int64(p, len, ret, __scan_digits16);
+}
+
+/////////////////////////////////////////////
+// AVX2: 32 bytes at a time.
+//
+static inline TARGET_AVX2 uint64_t __eq64_avx2(__m256i lo, __m256i hi,
+                                               char ch) {
+  __m256i c = _mm256_set1_epi8(ch);
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c)) |
+         ((uint64_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c)) << 32);
+}
+
+static TARGET_AVX2 uint64_t match_avx2(const char *p, int64_t len,
+                                       const char *accept, int n) {
+  char tmpbuf[64];
+  if (len < 64 && !__scan_inpage64(p)) {
+    memset(tmpbuf, 0, sizeof(tmpbuf));
+    memcpy(tmpbuf, p, len);
+    p = tmpbuf;
   }
-  // __builtin_ffs: returns one plus the index of the least significant 1-bit of
-  // x, or if x is zero, returns zero.
-  int off = __builtin_ffs(scan->flag) - 1;
-  if (off >= 0) {
-    scan->flag &= ~(1 << off); // clear the bit at off
-    scan->p = scan->base + off;
-  } else {
-    scan->p = scan->q;
+  __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+  uint64_t flag = 0;
+  for (int i = 0; i < n; i++) {
+    flag |= __eq64_avx2(lo, hi, accept[i]);
   }
-  return (scan->p < scan->q) ? scan->p++ : 0;
+  // the bytes past len, if loaded, are not data
+  return len < 64 ? flag & ((1ULL << len) - 1) : flag;
+}
+
+static inline TARGET_AVX2 void block64_avx2(const char *p, char qte,
+                                            char delim, uint64_t *mqte,
+                                            uint64_t *mdelim, uint64_t *mnl) {
+  __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+  *mqte = __eq64_avx2(lo, hi, qte);
+  *mdelim = __eq64_avx2(lo, hi, delim);
+  *mnl = __eq64_avx2(lo, hi, '\n');
 }
 
-// Return TRUE if the current char matches ch.
-static inline int scan_match(scan_t *scan, int ch) { return ch == *scan->p; }
+static TARGET_AVX2 int index_avx2(const char *buf, int *off, int end,
+                                  char qte, char delim, uint64_t *inquote,
+                                  uint32_t *out, int max) {
+  return __scan_index(buf, off, end, qte, delim, inquote, out, max,
+                      block64_avx2, __scan_prefix_xor_clmul);
+}
+
+static TARGET_AVX2 void count_avx2(const char *p, int64_t len, char qte,
+                                   scan_count_t *ret) {
+  __scan_count(p, len, qte, ret, block64_avx2, __scan_prefix_xor_clmul);
+}
+
+static TARGET_AVX2 int unquote_avx2(char *p, int len, char qte) {
+  return __scan_unquote(p, len, qte, block64_avx2, __scan_prefix_xor_clmul,
+                        __scan_compress8_ssse3);
+}
+
+static TARGET_AVX2 int int64_avx2(const char *p, int len, int64_t *ret) {
+  return __scan_int64(p, len, ret, __scan_digits16_ssse3);
+}
+
+/////////////////////////////////////////////
+// AVX-512BW: 64 bytes at a time.
+//
+static TARGET_AVX512BW uint64_t match_avx512bw(const char *p, int64_t len,
+                                               const char *accept, int n) {
+  // a masked load does not touch the bytes past len, so there is no
+  // need to copy the tail into a tmpbuf[].
+  __mmask64 mask = (len < 64 ? (1ULL << len) - 1 : ~0ULL);
+  __m512i src = _mm512_maskz_loadu_epi8(mask, p);
+  uint64_t flag = 0;
+  for (int i = 0; i < n; i++) {
+    flag |= _mm512_cmpeq_epi8_mask(src, _mm512_set1_epi8(accept[i]));
+  }
+  return flag & mask;
+}
+
+static inline TARGET_AVX512BW void
+block64_avx512bw(const char *p, char qte, char delim, uint64_t *mqte,
+                 uint64_t *mdelim, uint64_t *mnl) {
+  __m512i src = _mm512_loadu_si512((const void *)p);
+  *mqte = _mm512_cmpeq_epi8_mask(src, _mm512_set1_epi8(qte));
+  *mdelim = _mm512_cmpeq_epi8_mask(src, _mm512_set1_epi8(delim));
+  *mnl = _mm512_cmpeq_epi8_mask(src, _mm512_set1_epi8('\n'));
+}
+
+static TARGET_AVX512BW int index_avx512bw(const char *buf, int *off, int end,
+                                          char qte, char delim,
+                                          uint64_t *inquote, uint32_t *out,
+                                          int max) {
+  return __scan_index(buf, off, end, qte, delim, inquote, out, max,
+                      block64_avx512bw, __scan_prefix_xor_clmul);
+}
+
+static TARGET_AVX512BW void count_avx512bw(const char *p, int64_t len,
+                                           char qte, scan_count_t *ret) {
+  __scan_count(p, len, qte, ret, block64_avx512bw, __scan_prefix_xor_clmul);
+}
+
+static TARGET_AVX512BW int unquote_avx512bw(char *p, int len, char qte) {
+  return __scan_unquote(p, len, qte, block64_avx512bw,
+                        __scan_prefix_xor_clmul, __scan_compress8_ssse3);
+}
+
+static TARGET_AVX512BW int int64_avx512bw(const char *p, int len,
+                                          int64_t *ret) {
+  return __scan_int64(p, len, ret, __scan_digits16_ssse3);
+}
+
+/////////////////////////////////////////////
+static const scan_kernel_t SCAN_SSE2 = {
+    CSV_KERNEL_SSE2, "sse2",       match_sse2, index_sse2,
+    count_sse2,      unquote_sse2, int64_sse2};
+static const scan_kernel_t SCAN_AVX2 = {
+    CSV_KERNEL_AVX2, "avx2",       match_avx2, index_avx2,
+    count_avx2,      unquote_avx2, int64_avx2};
+static const scan_kernel_t SCAN_AVX512BW = {
+    CSV_KERNEL_AVX512BW, "avx512bw",       match_avx512bw, index_avx512bw,
+    count_avx512bw,      unquote_avx512bw, int64_avx512bw};
+
+// Return the kernel for id, or NULL if the cpu does not support
+// it. CSV_KERNEL_AUTO returns the best kernel for the cpu.
+static const scan_kernel_t *scan_kernel(int id) {
+  bool pclmul = __builtin_cpu_supports("pclmul");
+  bool avx2 = pclmul && __builtin_cpu_supports("avx2");
+  bool avx512bw = pclmul && __builtin_cpu_supports("avx512bw");
+  switch (id) {
+  case CSV_KERNEL_AUTO:
+    return avx512bw ? &SCAN_AVX512BW : avx2 ? &SCAN_AVX2 : &SCAN_SSE2;
+  case CSV_KERNEL_SSE2:
+    return &SCAN_SSE2;
+  case CSV_KERNEL_AVX2:
+    return avx2 ? &SCAN_AVX2 : 0;
+  case CSV_KERNEL_AVX512BW:
+    return avx512bw ? &SCAN_AVX512BW : 0;
+  }
+  return 0;
+}
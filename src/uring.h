@@ -0,0 +1,308 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  A sequential file reader on io_uring, used by csv_parse_file_ex().
+ *
+ *  The file is read into a ring of URING_NBUF buffers of URING_BUFSZ
+ *  bytes each. Every buffer has a read in flight at the next file
+ *  offset, so the disk works ahead while the parser scans. uring_read()
+ *  copies out of the buffer at the head of the ring, and resubmits the
+ *  buffer for a new read once it has been consumed.
+ *
+ *  The raw syscalls are used, so there is no dependency on liburing.
+ *  uring_open() fails on kernels without io_uring, in sandboxes that
+ *  block it, and on anything but a regular file; the caller then falls
+ *  back to stdio. It also declines a file smaller than one buffer, for
+ *  which setting up the ring costs more than stdio does to read it.
+ */
+#define URING_NBUF 4
+#define URING_BUFSZ (1024 * 1024)
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct uring_t uring_t;
+struct uring_t {
+  int fd;     // the file
+  int ringfd; // the io_uring instance
+
+  // Submission queue. Entry i is always used by slot i.
+  struct {
+    unsigned *head, *tail, *mask, *array;
+    struct io_uring_sqe *sqe;
+  } sq;
+
+  // Completion queue
+  struct {
+    unsigned *head, *tail, *mask;
+    struct io_uring_cqe *cqe;
+  } cq;
+
+  void *ring; // SQ and CQ rings, mapped together
+  size_t ringsz;
+  size_t sqesz;
+  char *mem; // the buffers of all slots
+
+  struct {
+    char *ptr;   // buffer of URING_BUFSZ bytes
+    int64_t off; // file offset of ptr[0]
+    int len;     // #bytes requested
+    int res;     // result of the read, if done
+    int pos;     // ptr[pos..res) is yet to be consumed
+    bool done;   // true if the read completed
+  } slot[URING_NBUF];
+  int next;       // slot to consume next
+  int inflight;   // #reads submitted and not completed
+  int64_t offset; // file offset of the next new read
+  bool eof;
+};
+
+static inline int __uring_enter(int ringfd, unsigned nsubmit,
+                                unsigned nwait) {
+  unsigned flags = nwait ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, ringfd, nsubmit, nwait, flags, 0, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+// Submit a read of slot i at file offset off.
+static int __uring_submit(uring_t *ur, int i, int64_t off, int len) {
+  ur->slot[i].off = off;
+  ur->slot[i].len = len;
+  ur->slot[i].pos = 0;
+  ur->slot[i].done = false;
+
+  struct io_uring_sqe *sqe = &ur->sq.sqe[i];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = ur->fd;
+  sqe->off = off;
+  sqe->addr = (uint64_t)(uintptr_t)ur->slot[i].ptr;
+  sqe->len = len;
+  sqe->user_data = i;
+
+  unsigned tail = *ur->sq.tail;
+  ur->sq.array[tail & *ur->sq.mask] = i;
+  __atomic_store_n(ur->sq.tail, tail + 1, __ATOMIC_RELEASE);
+  if (__uring_enter(ur->ringfd, 1, 0) != 1) {
+    return -1;
+  }
+  ur->inflight++;
+  return 0;
+}
+
+// Wait for at least one read to complete, and reap all completions.
+static int __uring_wait(uring_t *ur) {
+  if (__uring_enter(ur->ringfd, 0, 1) < 0) {
+    return -1;
+  }
+  unsigned head = *ur->cq.head;
+  unsigned tail = __atomic_load_n(ur->cq.tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *cqe = &ur->cq.cqe[head & *ur->cq.mask];
+    int i = cqe->user_data;
+    ur->slot[i].res = cqe->res;
+    ur->slot[i].done = true;
+    ur->inflight--;
+  }
+  __atomic_store_n(ur->cq.head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static void uring_close(uring_t *ur) {
+  // the kernel may still write into the buffers
+  while (ur->inflight > 0 && 0 == __uring_wait(ur)) {
+  }
+  if (ur->mem) {
+    munmap(ur->mem, (size_t)URING_NBUF * URING_BUFSZ);
+  }
+  if (ur->sq.sqe) {
+    munmap(ur->sq.sqe, ur->sqesz);
+  }
+  if (ur->ring) {
+    munmap(ur->ring, ur->ringsz);
+  }
+  if (ur->ringfd >= 0) {
+    close(ur->ringfd);
+  }
+  if (ur->fd >= 0) {
+    close(ur->fd);
+  }
+  memset(ur, 0, sizeof(*ur));
+  ur->fd = ur->ringfd = -1;
+}
+
+// Open the file at path and start reading it. Return 0 on success, -1
+// otherwise.
+static int uring_open(uring_t *ur, const char *path) {
+  memset(ur, 0, sizeof(*ur));
+  ur->ringfd = -1;
+  ur->fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (ur->fd < 0 || fstat(ur->fd, &st) || !S_ISREG(st.st_mode) ||
+      st.st_size < URING_BUFSZ) {
+    goto bail;
+  }
+
+  {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ur->ringfd = syscall(__NR_io_uring_setup, URING_NBUF, &p);
+    if (ur->ringfd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+      goto bail;
+    }
+
+    // One mapping for both rings.
+    size_t sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ur->ringsz = (sqsz > cqsz ? sqsz : cqsz);
+    void *ring =
+        mmap(0, ur->ringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ur->ringfd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+      goto bail;
+    }
+    ur->ring = ring;
+    char *base = (char *)ring;
+    ur->sq.head = (unsigned *)(base + p.sq_off.head);
+    ur->sq.tail = (unsigned *)(base + p.sq_off.tail);
+    ur->sq.mask = (unsigned *)(base + p.sq_off.ring_mask);
+    ur->sq.array = (unsigned *)(base + p.sq_off.array);
+    ur->cq.head = (unsigned *)(base + p.cq_off.head);
+    ur->cq.tail = (unsigned *)(base + p.cq_off.tail);
+    ur->cq.mask = (unsigned *)(base + p.cq_off.ring_mask);
+    ur->cq.cqe = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+
+    ur->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqe =
+        mmap(0, ur->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ur->ringfd, IORING_OFF_SQES);
+    if (sqe == MAP_FAILED) {
+      goto bail;
+    }
+    ur->sq.sqe = (struct io_uring_sqe *)sqe;
+  }
+
+  {
+    // page-aligned buffers
+    void *mem = mmap(0, (size_t)URING_NBUF * URING_BUFSZ,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                     0);
+    if (mem == MAP_FAILED) {
+      goto bail;
+    }
+    ur->mem = (char *)mem;
+  }
+
+  for (int i = 0; i < URING_NBUF; i++) {
+    ur->slot[i].ptr = ur->mem + (size_t)i * URING_BUFSZ;
+    if (__uring_submit(ur, i, ur->offset, URING_BUFSZ)) {
+      goto bail;
+    }
+    ur->offset += URING_BUFSZ;
+  }
+  return 0;
+
+bail:
+  uring_close(ur);
+  return -1;
+}
+
+// A csv_feed_t on the uring_t in context.
+static int uring_read(void *context, char *buf, int bufsz, char *errbuf,
+                      int errsz) {
+  uring_t *ur = (uring_t *)context;
+  int nread = 0;
+  while (nread < bufsz && !ur->eof) {
+    const int i = ur->next;
+    while (!ur->slot[i].done) {
+      if (__uring_wait(ur)) {
+        snprintf(errbuf, errsz, "io_uring_enter failed - %s",
+                 strerror(errno));
+        return -1;
+      }
+    }
+
+    int res = ur->slot[i].res;
+    if (res < 0) {
+      snprintf(errbuf, errsz, "read failed - %s", strerror(-res));
+      return -1;
+    }
+    if (res == 0) {
+      ur->eof = true;
+      break;
+    }
+
+    int pos = ur->slot[i].pos;
+    int n = res - pos;
+    if (n > bufsz - nread) {
+      n = bufsz - nread;
+    }
+    memcpy(buf + nread, ur->slot[i].ptr + pos, n);
+    nread += n;
+    ur->slot[i].pos += n;
+    if (ur->slot[i].pos < res) {
+      break; // buf[] is full
+    }
+
+    // Slot i is consumed. On a short read, read the rest of it into
+    // the same slot, so that the slots stay in file order. Otherwise,
+    // recycle it for the next new read, and move on.
+    int rc;
+    if (res < ur->slot[i].len) {
+      rc = __uring_submit(ur, i, ur->slot[i].off + res, ur->slot[i].len - res);
+    } else {
+      rc = __uring_submit(ur, i, ur->offset, URING_BUFSZ);
+      ur->offset += URING_BUFSZ;
+      ur->next = (i + 1) % URING_NBUF;
+    }
+    if (rc) {
+      snprintf(errbuf, errsz, "io_uring_enter failed - %s", strerror(errno));
+      return -1;
+    }
+    if (!ur->slot[ur->next].done) {
+      break; // let the parser work while the read is in flight
+    }
+  }
+  return nread;
+}
+
+#else
+#include <stdio.h>
+
+// io_uring is not available; the caller always falls back to stdio.
+typedef struct uring_t uring_t;
+struct uring_t {
+  int unused;
+};
+
+static inline int uring_open(uring_t *ur, const char *path) {
+  (void)ur;
+  (void)path;
+  return -1;
+}
+
+static inline void uring_close(uring_t *ur) { (void)ur; }
+
+static int uring_read(void *context, char *buf, int bufsz, char *errbuf,
+                      int errsz) {
+  (void)context;
+  (void)buf;
+  (void)bufsz;
+  snprintf(errbuf, errsz, "%s", "io_uring is not available");
+  return -1;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+namespace ahead1 {
+
+const char *PATH = "/tmp/csv_ahead_test.csv";
+
+struct context_t {
+  csv_t csv;
+  std::vector<std::vector<std::string>> result;
+  std::string doc; // for feed()
+  size_t off = 0;
+  int chunk = 1 << 30; // max bytes per feed()
+  size_t failat = SIZE_MAX; // feed() fails past this offset
+  context_t(int readahead) {
+    auto conf = csv_default_config();
+    conf.readahead = readahead;
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+// Note: runs on the read-ahead thread.
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  context_t *ctx = (context_t *)ctx_;
+  if (ctx->off >= ctx->failat) {
+    snprintf(errbuf, errsz, "%s", "feed failed");
+    return -1;
+  }
+  int len = std::min(ctx->doc.size() - ctx->off, (size_t)ctx->chunk);
+  len = std::min(len, bufsz);
+  memcpy(buf, ctx->doc.data() + ctx->off, len);
+  ctx->off += len;
+  return len;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? value[i].ptr : "(null)");
+  }
+  row.push_back(std::to_string(lineno) + ":" + std::to_string(rowno));
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+// A document of nrow rows, some with quoted newlines.
+static string random_doc(std::mt19937 &rng, int nrow) {
+  string s;
+  for (int i = 0; i < nrow; i++) {
+    s += to_string(rng() % 1000) + ",";
+    if (rng() % 4 == 0) {
+      s += "\"a,\"\"b\"\"\nc\",";
+    }
+    s += string(rng() % 50, 'x') + "\n";
+  }
+  return s;
+}
+
+} // namespace ahead1
+
+TEST_CASE("ahead1") {
+
+  using namespace ahead1;
+
+  std::mt19937 rng(13);
+  const string doc = random_doc(rng, 20000);
+
+  SUBCASE("same as without") {
+    context_t expected(0);
+    expected.doc = doc;
+    CHECK(0 == csv_parse(&expected.csv, &expected, feed, perrow));
+    for (int readahead : {1, 2, 8}) {
+      for (int chunk : {1000, 1 << 30}) {
+        context_t ctx(readahead);
+        ctx.doc = doc;
+        ctx.chunk = chunk;
+        CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+        CHECK(ctx.result == expected.result);
+      }
+    }
+  }
+
+  SUBCASE("file") {
+    {
+      std::ofstream out(PATH, std::ios::binary);
+      out << doc;
+    }
+    context_t expected(0), ctx(4);
+    CHECK(0 == csv_parse_file_ex(&expected.csv, PATH, &expected, perrow));
+    CHECK(0 == csv_parse_file(&ctx.csv, fopen(PATH, "r"), &ctx, perrow));
+    CHECK(ctx.result.size() == 20000);
+    CHECK(ctx.result == expected.result);
+  }
+
+  SUBCASE("feed error") {
+    // the rows before the error are delivered
+    context_t ctx(2);
+    ctx.doc = doc;
+    ctx.chunk = 1000;
+    ctx.failat = doc.size() / 2;
+    CHECK(-1 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+    CHECK(string(ctx.csv.errmsg) == "feed failed");
+    CHECK(ctx.result.size() > 1000);
+  }
+
+  SUBCASE("perrow error") {
+    // csv_parse() stops the thread, which may be waiting for room,
+    // before it returns.
+    context_t ctx(1);
+    ctx.doc = doc;
+    ctx.chunk = 100;
+    auto fail = [](void *ctx_, int, csv_value_t[], int64_t, int64_t,
+                   char *errbuf, int errsz) {
+      context_t *ctx = (context_t *)ctx_;
+      if (ctx->result.size() < 1000) {
+        ctx->result.push_back({});
+        return 0;
+      }
+      snprintf(errbuf, errsz, "%s", "stop");
+      return -1;
+    };
+    CHECK(-1 == csv_parse(&ctx.csv, &ctx, feed, fail));
+    CHECK(string(ctx.csv.errmsg) == "stop");
+    CHECK(((csvx_t *)ctx.csv.__internal)->ahead == 0);
+    // feed() is no longer called
+    const size_t off = ctx.off;
+    CHECK(off < doc.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(ctx.off == off);
+  }
+}
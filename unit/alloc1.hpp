@@ -0,0 +1,349 @@
+#pragma once
+
+#include "../src/csv.hpp"
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace std;
+
+namespace alloc1 {
+
+// An allocator that checks every free() against its alloc().
+struct arena_t {
+  std::mutex mutex;
+  map<void *, pair<size_t, size_t>> live; // ptr -> (size, align)
+  int64_t nalloc = 0;
+  int64_t nrealloc = 0;
+  int64_t nbad = 0;        // free() with a size or align not allocated
+  set<size_t> sizes;       // of every alloc()
+  int64_t fail_at = -1;    // alloc() #fail_at returns NULL
+  bool use_realloc = true; // set the realloc hook
+
+  static void *alloc(void *ctx, size_t size, size_t align) {
+    arena_t *a = (arena_t *)ctx;
+    std::lock_guard<std::mutex> lock(a->mutex);
+    if (a->nalloc++ == a->fail_at) {
+      return 0;
+    }
+    a->sizes.insert(size);
+    void *p = aligned_alloc(align, (size + align - 1) / align * align);
+    if (p) {
+      a->live[p] = {size, align};
+    }
+    return p;
+  }
+
+  static void *realloc(void *ctx, void *ptr, size_t oldsize, size_t size,
+                       size_t align) {
+    arena_t *a = (arena_t *)ctx;
+    void *p = alloc(ctx, size, align);
+    if (p) {
+      memcpy(p, ptr, std::min(oldsize, size));
+      free(ctx, ptr, oldsize, align);
+      std::lock_guard<std::mutex> lock(a->mutex);
+      a->nrealloc++;
+    }
+    return p;
+  }
+
+  static void free(void *ctx, void *ptr, size_t size, size_t align) {
+    arena_t *a = (arena_t *)ctx;
+    std::lock_guard<std::mutex> lock(a->mutex);
+    auto it = a->live.find(ptr);
+    if (it == a->live.end() || it->second != make_pair(size, align)) {
+      a->nbad++;
+      return;
+    }
+    a->live.erase(it);
+    ::free(ptr);
+  }
+
+  csv_config_t config() {
+    csv_config_t conf = csv_default_config();
+    conf.initbufsz = 64;
+    conf.allocator.alloc = alloc;
+    conf.allocator.realloc = use_realloc ? realloc : nullptr;
+    conf.allocator.free = free;
+    conf.allocator.context = this;
+    return conf;
+  }
+};
+
+using result_t = vector<vector<string>>;
+
+static int perrow(void *ctx, int n, csv_value_t value[], int64_t, int64_t,
+                  char *, int) {
+  vector<string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? string(value[i].ptr, value[i].len)
+                               : "(null)");
+  }
+  ((result_t *)ctx)->push_back(std::move(row));
+  return 0;
+}
+
+static int perbatch(void *ctx, const csv_batch_t *batch, char *, int) {
+  for (int r = 0; r < batch->nrow; r++) {
+    vector<string> row;
+    for (int c = 0; c < batch->ncol; c++) {
+      const csv_column_t &col = batch->column[c];
+      row.push_back(col.ptr[r] ? string(col.ptr[r], col.len[r])
+                               : "(null)");
+    }
+    ((result_t *)ctx)->push_back(std::move(row));
+  }
+  return 0;
+}
+
+// Feed a document 7 bytes at a time.
+struct feeder_t {
+  result_t result;
+  string doc;
+  size_t off = 0;
+  static int feed(void *ctx, char *buf, int bufsz, char *, int) {
+    feeder_t *f = (feeder_t *)ctx;
+    int len = std::min<size_t>({(size_t)bufsz, 7, f->doc.size() - f->off});
+    memcpy(buf, f->doc.data() + f->off, len);
+    f->off += len;
+    return len;
+  }
+};
+
+enum mode_t { PARSE, BATCH, MEM, MMAP };
+
+// Parse doc with conf, and return the rows and the return code in *rc.
+static result_t parse(mode_t mode, const string &doc,
+                      const csv_config_t &conf, int *rc) {
+  csv_t csv = csv_open(&conf);
+  REQUIRE(csv.ok);
+  feeder_t f;
+  f.doc = doc;
+  switch (mode) {
+  case PARSE:
+    *rc = csv_parse(&csv, &f, feeder_t::feed, perrow);
+    break;
+  case BATCH:
+    *rc = csv_parse_batch(&csv, &f.result, feeder_t::feed, perbatch);
+    break;
+  case MEM:
+    *rc = csv_parse_mem(&csv, doc.data(), doc.size(), &f.result, perrow);
+    break;
+  case MMAP: {
+    char path[] = "/tmp/alloc1_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE((ssize_t)doc.size() == write(fd, doc.data(), doc.size()));
+    close(fd);
+    *rc = csv_parse_mmap(&csv, path, &f.result, perrow);
+    unlink(path);
+    break;
+  }
+  }
+  csv_close(&csv);
+  return std::move(f.result);
+}
+
+// Check that doc parses the same with and without the arena, and that
+// all of the memory from the arena went back to it.
+static void check(const string &doc, csv_config_t conf, bool realloc) {
+  conf.initbufsz = 64;
+  for (mode_t mode : {PARSE, BATCH, MEM, MMAP}) {
+    int want, got;
+    result_t expected = parse(mode, doc, conf, &want);
+    arena_t arena;
+    arena.use_realloc = realloc;
+    csv_config_t aconf = conf;
+    aconf.allocator = arena.config().allocator;
+    CHECK(parse(mode, doc, aconf, &got) == expected);
+    CHECK(got == want);
+    CHECK(arena.nalloc > 0);
+    CHECK(arena.nbad == 0);
+    CHECK(arena.live.empty());
+  }
+}
+
+static string make_doc(int nrow) {
+  string doc;
+  for (int i = 0; i < nrow; i++) {
+    doc += to_string(i) + ",\"a\"\"b\",\"x\ny\"," + string(i % 50, 'z') +
+           "\n";
+  }
+  doc += "last,row"; // not terminated, for the tail copy in mmap
+  return doc;
+}
+
+} // namespace alloc1
+
+TEST_CASE("alloc1") {
+  using namespace alloc1;
+  const csv_config_t dflt = csv_default_config();
+
+  SUBCASE("basic") {
+    for (bool realloc : {true, false}) {
+      check("", dflt, realloc);
+      check("a,b\n1,2\n", dflt, realloc);
+      check(make_doc(500), dflt, realloc);
+      csv_config_t bslash = dflt;
+      bslash.esc = '\\';
+      check(make_doc(500), bslash, realloc);
+    }
+  }
+
+  SUBCASE("wide row") {
+    string wide;
+    for (int i = 0; i < 2000; i++) {
+      wide += '"';
+      wide += to_string(i) + "\"\"\",";
+    }
+    wide += "x\n";
+    check(wide + wide, dflt, true);
+    check(wide + wide, dflt, false);
+  }
+
+  SUBCASE("select") {
+    const int sel[] = {3, 0, 9};
+    csv_config_t conf = dflt;
+    conf.select = sel;
+    conf.nselect = 3;
+    conf.batchsz = 16;
+    check(make_doc(300), conf, true);
+  }
+
+  SUBCASE("out of memory") {
+    // Fail each allocation in turn. The parse fails or succeeds, but
+    // nothing leaks and nothing is freed twice.
+    const string doc = make_doc(200);
+    for (int64_t k = 0;; k++) {
+      arena_t arena;
+      arena.fail_at = k;
+      csv_config_t conf = arena.config();
+      csv_t csv = csv_open(&conf);
+      int rc = -1;
+      feeder_t f;
+      f.doc = doc;
+      if (csv.ok) {
+        rc = csv_parse(&csv, &f, feeder_t::feed, perrow);
+      }
+      if (rc) {
+        CHECK(string(csv.errmsg).find("out of memory") != string::npos);
+      }
+      csv_close(&csv);
+      CHECK(arena.nbad == 0);
+      CHECK(arena.live.empty());
+      if (rc == 0) {
+        CHECK(arena.nalloc <= k); // no allocation failed
+        break;
+      }
+    }
+  }
+
+  SUBCASE("threads") {
+    // The read-ahead slots, the file readers and the chunks of a
+    // parallel parse come from the arena too.
+    const string doc = make_doc(40000);
+    const char *path = "/tmp/alloc1_threads.csv";
+    FILE *fp = fopen(path, "w");
+    REQUIRE(fp);
+    REQUIRE(doc.size() == fwrite(doc.data(), 1, doc.size(), fp));
+    fclose(fp);
+    int rc;
+    const result_t expected = parse(MEM, doc, dflt, &rc);
+    REQUIRE(rc == 0);
+
+    for (int api = 0; api < 3; api++) {
+      CAPTURE(api);
+      arena_t arena;
+      csv_config_t conf = arena.config();
+      result_t part[3];
+      void *context[3] = {&part[0], &part[1], &part[2]};
+      csv_t csv = csv_open(&conf);
+      REQUIRE(csv.ok);
+      if (api == 0) {
+        csv_close(&csv);
+        conf.readahead = 2;
+        CHECK(parse(PARSE, doc, conf, &rc) == expected);
+      } else if (api == 1) {
+        rc = csv_parse_file_ex(&csv, path, &part[0], perrow);
+        CHECK(part[0] == expected);
+      } else {
+        rc = csv_parse_parallel(&csv, path, 3, context, perrow);
+        CHECK(part[0].size() + part[1].size() + part[2].size() ==
+              expected.size());
+      }
+      CHECK(rc == 0);
+      csv_close(&csv);
+      const size_t want[] = {AHEAD_BUFSZ, sizeof(decode_t),
+                             3 * sizeof(chunk_t)};
+      CHECK(arena.sizes.count(want[api]));
+      CHECK(arena.nbad == 0);
+      CHECK(arena.live.empty());
+    }
+
+#ifdef CSV_HAVE_ZLIB
+    {
+      // and so does the input buffer of the decoder
+      gzFile gz = gzopen(path, "wb");
+      REQUIRE(gz);
+      REQUIRE((int)doc.size() == gzwrite(gz, doc.data(), doc.size()));
+      gzclose(gz);
+      arena_t arena;
+      csv_config_t conf = arena.config();
+      result_t result;
+      csv_t csv = csv_open(&conf);
+      CHECK(0 == csv_parse_file_ex(&csv, path, &result, perrow));
+      CHECK(result == expected);
+      csv_close(&csv);
+      CHECK(arena.sizes.count(DECODE_INSZ));
+      CHECK(arena.nbad == 0);
+      CHECK(arena.live.empty());
+    }
+#endif
+    unlink(path);
+  }
+
+  SUBCASE("c++") {
+    // A memory_resource that counts the bytes outstanding.
+    struct counter_t : std::pmr::memory_resource {
+      int64_t outstanding = 0, ncall = 0;
+      void *do_allocate(size_t size, size_t align) override {
+        ncall++;
+        outstanding += size;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+      }
+      void do_deallocate(void *p, size_t size, size_t align) override {
+        outstanding -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, align);
+      }
+      bool do_is_equal(const memory_resource &o) const noexcept override {
+        return this == &o;
+      }
+    } counter;
+    struct parser_t : csv_parser_t {
+      using csv_parser_t::csv_parser_t;
+      result_t result;
+    };
+    {
+      parser_t p(&counter);
+      CHECK(p.parse_mem(make_doc(100), [](void *ctx, int n,
+                                          csv_value_t value[], int64_t,
+                                          int64_t, char *, int) {
+        return perrow(&((parser_t *)ctx)->result, n, value, 0, 0, 0, 0);
+      }));
+      CHECK(p.result.size() == 101);
+      CHECK(counter.ncall > 0);
+    }
+    CHECK(counter.outstanding == 0);
+
+    // a monotonic resource on the stack
+    char space[1 << 16];
+    std::pmr::monotonic_buffer_resource mono(space, sizeof(space));
+    parser_t p(&mono);
+    CHECK(p.parse_mem("a,b\n1,\"2\"\"\"\n", [](void *ctx, int n,
+                                                 csv_value_t value[], int64_t,
+                                                 int64_t, char *, int) {
+      return perrow(&((parser_t *)ctx)->result, n, value, 0, 0, 0, 0);
+    }));
+    CHECK(p.result == result_t{{"a", "b"}, {"1", "2\""}});
+  }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <random>
+
+using namespace std;
+
+namespace batch1 {
+
+// A row as seen by perrow() or perbatch().
+struct row_t {
+  vector<string> value;
+  int64_t lineno, rowno;
+  bool operator==(const row_t &) const = default;
+};
+
+struct context_t {
+  csv_t csv;
+  const char *doc;
+  int chunk; // max #bytes returned per feed() call
+  vector<row_t> result;
+  vector<int> batchsz; // #rows of each batch
+  int fail_at = -1;    // perbatch() fails on this batch
+  context_t(const char *doc_, int batchsz_, int chunk_ = 1 << 30,
+            bool skip_header = false)
+      : doc(doc_), chunk(chunk_) {
+    auto conf = csv_default_config();
+    conf.initbufsz = 64;
+    conf.batchsz = batchsz_;
+    conf.skip_header = skip_header;
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = strlen(ctx->doc);
+  len = std::min(len, std::min(bufsz, ctx->chunk));
+  memcpy(buf, ctx->doc, len);
+  ctx->doc += len;
+  return len;
+}
+
+static string str(const char *p, int len) {
+  return p ? string(p, len) : string("(null)");
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  row_t row{{}, lineno, rowno};
+  for (int i = 0; i < n; i++) {
+    row.value.push_back(str(value[i].ptr, value[i].len));
+  }
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+static int perbatch(void *ctx_, const csv_batch_t *batch, char *errbuf,
+                    int errsz) {
+  context_t *ctx = (context_t *)ctx_;
+  if ((int)ctx->batchsz.size() == ctx->fail_at) {
+    snprintf(errbuf, errsz, "batch %d failed", ctx->fail_at);
+    return -1;
+  }
+  ctx->batchsz.push_back(batch->nrow);
+  for (int r = 0; r < batch->nrow; r++) {
+    row_t row{{}, batch->lineno[r], batch->rowno + r};
+    for (int c = 0; c < batch->ncol; c++) {
+      const csv_column_t *col = &batch->column[c];
+      row.value.push_back(str(col->ptr[r], col->len[r]));
+    }
+    ctx->result.push_back(std::move(row));
+  }
+  return 0;
+}
+
+// Generate a random document with rows of 1 to 4 values.
+static string random_doc(std::mt19937 &rng, int nrow) {
+  const char *pieces[] = {"a", "bc", "\"x,y\"", "\"p\"\"q\"", "",
+                          "\"m\nn\"", "1234567890"};
+  string doc;
+  for (int i = 0; i < nrow; i++) {
+    int n = rng() % 4 + 1;
+    for (int j = 0; j < n; j++) {
+      doc += j ? "," : "";
+      doc += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    doc += (rng() % 2) ? "\r\n" : "\n";
+  }
+  return doc;
+}
+
+} // namespace batch1
+
+TEST_CASE("batch1") {
+
+  using namespace batch1;
+
+  SUBCASE("columns") {
+    const char *doc = "a,b,c\n"
+                      "d,\"e,f\",\n"
+                      "g,h\n";
+    context_t ctx(doc, 1024);
+    CHECK(0 == csv_parse_batch(&ctx.csv, &ctx, feed, perbatch));
+    // the 3rd row has a different #values
+    CHECK(ctx.batchsz == vector<int>{2, 1});
+    REQUIRE(ctx.result.size() == 3);
+    CHECK(ctx.result[0] == row_t{{"a", "b", "c"}, 1, 1});
+    CHECK(ctx.result[1] == row_t{{"d", "e,f", "(null)"}, 2, 2});
+    CHECK(ctx.result[2] == row_t{{"g", "h"}, 3, 3});
+  }
+
+  SUBCASE("batchsz") {
+    string doc;
+    for (int i = 0; i < 10; i++) {
+      doc += "x,y\n";
+    }
+    context_t ctx(doc.c_str(), 4);
+    CHECK(0 == csv_parse_batch(&ctx.csv, &ctx, feed, perbatch));
+    CHECK(ctx.batchsz == vector<int>{4, 4, 2});
+  }
+
+  SUBCASE("same as perrow") {
+    std::mt19937 rng(5);
+    for (int i = 0; i < 20; i++) {
+      string doc = random_doc(rng, 300);
+      for (int chunk : {1, 7, 1 << 30}) {
+        context_t expect(doc.c_str(), 1, chunk, i % 2);
+        CHECK(0 == csv_parse(&expect.csv, &expect, feed, perrow));
+        for (int batchsz : {1, 3, 1024}) {
+          context_t ctx(doc.c_str(), batchsz, chunk, i % 2);
+          CHECK(0 == csv_parse_batch(&ctx.csv, &ctx, feed, perbatch));
+          CHECK(ctx.result == expect.result);
+        }
+      }
+    }
+  }
+
+  SUBCASE("perbatch fails") {
+    context_t ctx("a\nb\nc\n", 1);
+    ctx.fail_at = 1;
+    CHECK(-1 == csv_parse_batch(&ctx.csv, &ctx, feed, perbatch));
+    CHECK(string(ctx.csv.errmsg) == "batch 1 failed");
+  }
+
+  SUBCASE("bad batchsz") {
+    context_t ctx("a\n", 0);
+    CHECK(-1 == csv_parse_batch(&ctx.csv, &ctx, feed, perbatch));
+    CHECK(string(ctx.csv.errmsg) == "batchsz must be positive");
+  }
+}
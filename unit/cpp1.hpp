@@ -81,4 +81,64 @@ TEST_CASE("cpp1") {
     p.parse(parser_t::feed, parser_t::perrow);
     CHECK(!p.ok());
   }
+
+  SUBCASE("select") {
+    parser_t p;
+    p.set_select({2, 0});
+    p.set_input("a,b,c,d");
+    p.parse(parser_t::feed, parser_t::perrow);
+    CHECK(p.ok());
+    CHECK(p.result.size() == 1);
+    CHECK(p.result[0] == vector<string>{"c", "a"});
+  }
+
+  SUBCASE("scale") {
+    parser_t p;
+    // the decimals of each row
+    auto perbatch = [](void *ctx, const csv_batch_t *batch, char *, int) {
+      parser_t *p = (parser_t *)ctx;
+      for (int r = 0; r < batch->nrow; r++) {
+        vector<string> row;
+        for (int c = 0; c < batch->ncol; c++) {
+          row.push_back(to_string(batch->column[c].i64[r]));
+        }
+        p->result.push_back(std::move(row));
+      }
+      return 0;
+    };
+    const csv_type_t dec = CSV_TYPE_DECIMAL;
+    // a short scale is padded with 0
+    p.set_schema({dec, dec, dec}).set_scale({2});
+    p.set_input("1.5,2.5,3.5\n");
+    CHECK(p.parse_batch(parser_t::feed, perbatch));
+    CHECK(p.result == vector<vector<string>>{{"150", "3", "4"}});
+    // the scale is kept as given when the schema shrinks
+    p.set_schema({dec});
+    p.set_input("1.5\n");
+    p.result.clear();
+    CHECK(p.parse_batch(parser_t::feed, perbatch));
+    CHECK(p.result == vector<vector<string>>{{"150"}});
+    // a long scale is cut short
+    p.set_scale({1, 2, 3, 4});
+    p.set_input("1.5\n");
+    p.result.clear();
+    CHECK(p.parse_batch(parser_t::feed, perbatch));
+    CHECK(p.result == vector<vector<string>>{{"15"}});
+  }
+
+  SUBCASE("push") {
+    parser_t p;
+    p.set_delim('|');
+    CHECK(p.push("a|b", parser_t::perrow));
+    CHECK(p.result.size() == 0);
+    CHECK(p.push("|c\nd|x", parser_t::perrow));
+    CHECK(p.result.size() == 1);
+    CHECK(p.result[0] == vector<string>{"a", "b", "c"});
+    CHECK(p.finish(parser_t::perrow));
+    CHECK(p.result[0] == vector<string>{"d", "x"});
+    // a push after finish() starts a new parse
+    CHECK(p.push("e\n", parser_t::perrow));
+    CHECK(p.result[0] == vector<string>{"e"});
+    CHECK(p.finish(parser_t::perrow));
+  }
 };
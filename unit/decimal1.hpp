@@ -0,0 +1,296 @@
+#pragma once
+
+#include "../src/csv.hpp"
+#include <random>
+
+using namespace std;
+
+namespace decimal1 {
+
+static int64_t dec(const char *s, int scale, int mode = 0) {
+  int64_t v = 0;
+  REQUIRE(0 == csv_parse_decimal(s, strlen(s), scale, mode, &v));
+  return v;
+}
+
+static bool bad(const char *s, int scale, int mode = 0) {
+  int64_t v = 7;
+  bool ret = (-1 == csv_parse_decimal(s, strlen(s), scale, mode, &v));
+  CHECK(v == 7); // untouched
+  return ret;
+}
+
+static __int128 dec128(const char *s, int scale, int mode = 0) {
+  __int128 v = 0;
+  REQUIRE(0 == csv_parse_decimal128(s, strlen(s), scale, mode, &v));
+  return v;
+}
+
+// |w| rounded up or not by the digits tail dropped after it.
+static uint64_t round(uint64_t w, const string &tail, int mode) {
+  if (tail.empty()) {
+    return w;
+  }
+  const bool sticky = tail.find_first_not_of('0', 1) != string::npos;
+  switch (mode & 3) {
+  case CSV_DECIMAL_HALF_UP:
+    return w + (tail[0] >= '5');
+  case CSV_DECIMAL_HALF_EVEN:
+    return w + (tail[0] > '5' || (tail[0] == '5' && (sticky || (w & 1))));
+  default:
+    return w;
+  }
+}
+
+// w followed by tail, written with the point and an exponent so that
+// its value is (w.tail) * 10^-scale.
+static string write(bool neg, uint64_t w, const string &tail, int scale,
+                    int exp) {
+  string d = to_string(w) + tail;
+  // #digits after the point in the mantissa
+  int nfrac = scale + tail.size() + exp;
+  if (nfrac < 0) {
+    d += string(-nfrac, '0');
+    nfrac = 0;
+  }
+  if (nfrac > (int)d.size()) {
+    d = string(nfrac - d.size(), '0') + d;
+  }
+  string s = d.substr(0, d.size() - nfrac);
+  if (nfrac > 0) {
+    s += "." + d.substr(d.size() - nfrac);
+  }
+  if (exp) {
+    s += "e" + to_string(exp);
+  }
+  return (neg ? "-" : "") + s;
+}
+
+} // namespace decimal1
+
+TEST_CASE("decimal1") {
+  using namespace decimal1;
+
+  SUBCASE("basic") {
+    CHECK(dec("12.345", 2) == 1235);
+    CHECK(dec("-12.345", 2) == -1235);
+    CHECK(dec("12.345", 2, CSV_DECIMAL_HALF_EVEN) == 1234);
+    CHECK(dec("12.3451", 2, CSV_DECIMAL_HALF_EVEN) == 1235);
+    CHECK(dec("12.355", 2, CSV_DECIMAL_HALF_EVEN) == 1236);
+    CHECK(dec("12.349", 2, CSV_DECIMAL_TRUNCATE) == 1234);
+    CHECK(dec("-12.349", 2, CSV_DECIMAL_TRUNCATE) == -1234);
+    CHECK(dec("12.340", 2, CSV_DECIMAL_EXACT) == 1234);
+    CHECK(bad("12.341", 2, CSV_DECIMAL_EXACT));
+    CHECK(dec("12", 4) == 120000);
+    CHECK(dec("+.5", 1) == 5);
+    CHECK(dec("5.", 1) == 50);
+    CHECK(dec("0", 4) == 0);
+    CHECK(dec("-0.00", 4) == 0);
+    CHECK(dec("000123.4500", 4) == 1234500);
+    CHECK(dec("1.5e3", 0) == 1500);
+    CHECK(dec("15E-2", 2) == 15);
+    CHECK(dec("0.004", 2) == 0);
+    CHECK(dec("0.005", 2) == 1);
+    CHECK(dec("-0.005", 2) == -1);
+    CHECK(dec("0.0049999", 2) == 0);
+    CHECK(dec("1e-30", 2) == 0);
+    CHECK(dec("0e400", 2) == 0);
+    CHECK(dec("12345", -2) == 123);
+    // not NUL-terminated
+    int64_t v = 0;
+    CHECK(0 == csv_parse_decimal("1.25,3", 4, 2, 0, &v));
+    CHECK(v == 125);
+
+    for (const char *s : {"", "-", ".", "-.", "e5", "1e", "1e+", "1.2.3",
+                          " 1", "1 ", "1,5", "nan", "inf", "0x10", "--1"}) {
+      CAPTURE(s);
+      CHECK(bad(s, 2));
+    }
+  }
+
+  SUBCASE("range") {
+    CHECK(dec("9223372036854775807", 0) == INT64_MAX);
+    CHECK(dec("-9223372036854775808", 0) == INT64_MIN);
+    CHECK(dec("922337203685477.5807", 4) == INT64_MAX);
+    CHECK(dec("-922337203685477.58089", 4, CSV_DECIMAL_TRUNCATE) ==
+          INT64_MIN);
+    CHECK(bad("9223372036854775808", 0));
+    CHECK(bad("922337203685477.58075", 4)); // rounds up past the max
+    CHECK(bad("1e19", 0));
+    CHECK(bad("1", 40));
+    CHECK(bad(("1" + string(100, '0')).c_str(), 0));
+    CHECK(dec("1e19", 0, CSV_DECIMAL_SATURATE) == INT64_MAX);
+    CHECK(dec("-1e19", 0, CSV_DECIMAL_SATURATE) == INT64_MIN);
+    CHECK(dec("-1e999999", 0, CSV_DECIMAL_SATURATE) == INT64_MIN);
+    CHECK(dec("1.239", 2, CSV_DECIMAL_TRUNCATE | CSV_DECIMAL_SATURATE) ==
+          123);
+    // still checked with saturate
+    CHECK(bad("1.239", 2, CSV_DECIMAL_EXACT | CSV_DECIMAL_SATURATE));
+    CHECK(bad("x", 2, CSV_DECIMAL_SATURATE));
+
+    const __int128 max = ~(unsigned __int128)0 >> 1;
+    const __int128 min = -max - 1;
+    CHECK(dec128("170141183460469231731687303715884105727", 0) == max);
+    CHECK(dec128("-170141183460469231731687303715884105728", 0) == min);
+    CHECK(dec128("17014118346046923173168730371588410.5727", 4) == max);
+    CHECK(dec128("1e38", 0) ==
+          (__int128)10000000000000000000ULL * 10000000000000000000ULL);
+    __int128 v;
+    CHECK(-1 == csv_parse_decimal128("170141183460469231731687303715884105728",
+                                     39, 0, 0, &v));
+    CHECK(-1 == csv_parse_decimal128("1e39", 4, 0, 0, &v));
+    CHECK(dec128("1e39", 0, CSV_DECIMAL_SATURATE) == max);
+    CHECK(dec128("-1e39", 0, CSV_DECIMAL_SATURATE) == min);
+    const __int128 big = (__int128)12345678901234567890ULL * 1000000000000;
+    CHECK(dec128("123456789012345678901234567890.125", 2) ==
+          big + 123456789013);
+    CHECK(dec128("123456789012345678901234567890.125", 2,
+                 CSV_DECIMAL_HALF_EVEN) == big + 123456789012);
+  }
+
+  SUBCASE("random") {
+    std::mt19937_64 rng(25);
+    for (int i = 0; i < 200000; i++) {
+      const bool neg = rng() % 2;
+      const uint64_t w = (rng() >> 1) >> (rng() % 63);
+      const int scale = rng() % 19;
+      string tail = to_string(rng()).substr(0, rng() % 6);
+      if (rng() % 4 == 0 && !tail.empty()) {
+        tail = "5" + string(tail.size() - 1, '0'); // a tie
+      }
+      const int exp = (rng() % 4 == 0) ? (int)(rng() % 9) - 4 : 0;
+      const string s = write(neg, w, tail, scale, exp);
+      CAPTURE(s);
+      CAPTURE(scale);
+      for (int mode : {CSV_DECIMAL_HALF_UP, CSV_DECIMAL_HALF_EVEN,
+                       CSV_DECIMAL_TRUNCATE, CSV_DECIMAL_EXACT}) {
+        CAPTURE(mode);
+        const uint64_t want = round(w, tail, mode);
+        const bool lost = tail.find_first_not_of('0') != string::npos;
+        int64_t v = 0;
+        int rc = csv_parse_decimal(s.data(), s.size(), scale, mode, &v);
+        if (mode == CSV_DECIMAL_EXACT && lost) {
+          CHECK(rc == -1);
+        } else if (want > (uint64_t)INT64_MAX) {
+          CHECK(rc == -1);
+        } else {
+          REQUIRE(rc == 0);
+          CHECK(v == (neg ? -(int64_t)want : (int64_t)want));
+          __int128 v128 = 0;
+          CHECK(0 == csv_parse_decimal128(s.data(), s.size(), scale, mode,
+                                          &v128));
+          CHECK(v128 == v);
+        }
+      }
+    }
+  }
+
+  SUBCASE("typed") {
+    const csv_type_t schema[] = {CSV_TYPE_DECIMAL, CSV_TYPE_DECIMAL,
+                                 CSV_TYPE_TEXT};
+    const int scale[] = {4, 2, 9};
+    csv_config_t conf = csv_default_config();
+    conf.schema = schema;
+    conf.nschema = 3;
+    conf.scale = scale;
+    conf.nscale = 3;
+    csv_t csv = csv_open(&conf);
+    REQUIRE(csv.ok);
+    const char doc[] = "1.5,\"-2.345\",x\n,12.3.4,y\n";
+    struct feed_t {
+      const char *p;
+      vector<pair<uint8_t, int64_t>> got;
+      static int feed(void *ctx, char *buf, int bufsz, char *, int) {
+        feed_t *f = (feed_t *)ctx;
+        int len = std::min<int>(strlen(f->p), bufsz);
+        memcpy(buf, f->p, len);
+        f->p += len;
+        return len;
+      }
+      static int perbatch(void *ctx, const csv_batch_t *batch, char *, int) {
+        for (int r = 0; r < batch->nrow; r++) {
+          for (int c = 0; c < 2; c++) {
+            const csv_column_t &col = batch->column[c];
+            ((feed_t *)ctx)->got.push_back({col.flag[r], col.i64[r]});
+          }
+          CHECK(!batch->column[2].flag);
+        }
+        return 0;
+      }
+    } f = {doc, {}};
+    CHECK(0 == csv_parse_batch(&csv, &f, feed_t::feed, feed_t::perbatch));
+    csv_close(&csv);
+    const vector<pair<uint8_t, int64_t>> want = {
+        {0, 15000}, {0, -235}, {CSV_FLAG_NULL, 0}, {CSV_FLAG_ERROR, 0}};
+    CHECK(f.got == want);
+
+    // truncated
+    f = {doc, {}};
+    conf.decimal_mode = CSV_DECIMAL_TRUNCATE;
+    csv = csv_open(&conf);
+    REQUIRE(csv.ok);
+    CHECK(0 == csv_parse_batch(&csv, &f, feed_t::feed, feed_t::perbatch));
+    csv_close(&csv);
+    const vector<pair<uint8_t, int64_t>> want2 = {
+        {0, 15000}, {0, -234}, {CSV_FLAG_NULL, 0}, {CSV_FLAG_ERROR, 0}};
+    CHECK(f.got == want2);
+  }
+
+  SUBCASE("invalid scale") {
+    const csv_type_t schema[] = {CSV_TYPE_DECIMAL};
+    for (int s : {-1, 19}) {
+      csv_config_t conf = csv_default_config();
+      conf.schema = schema;
+      conf.nschema = 1;
+      conf.scale = &s;
+      conf.nscale = 1;
+      csv_t csv = csv_open(&conf);
+      CHECK(!csv.ok);
+      CHECK(string(csv.errmsg).find("invalid scale") != string::npos);
+      csv_close(&csv);
+    }
+  }
+
+  SUBCASE("scale size") {
+    const csv_type_t schema[] = {CSV_TYPE_TEXT, CSV_TYPE_DECIMAL};
+    const int scale[] = {0, 2};
+    for (int n : {0, 1, 3}) {
+      csv_config_t conf = csv_default_config();
+      conf.schema = schema;
+      conf.nschema = 2;
+      conf.scale = scale;
+      conf.nscale = n;
+      csv_t csv = csv_open(&conf);
+      CAPTURE(n);
+      CHECK(!csv.ok);
+      CHECK(string(csv.errmsg).find("does not match nschema") !=
+            string::npos);
+      csv_close(&csv);
+    }
+  }
+
+  SUBCASE("c++") {
+    struct parser_t : csv_parser_t {
+      const char *p = "0.125\n0.135\n-7\n";
+      vector<int64_t> result;
+    } p;
+    p.set_schema({CSV_TYPE_DECIMAL})
+        .set_scale({2})
+        .set_decimal_mode(CSV_DECIMAL_HALF_EVEN);
+    CHECK(p.parse_batch(
+        [](void *ctx, char *buf, int bufsz, char *, int) {
+          parser_t *p = (parser_t *)ctx;
+          int len = std::min<int>(strlen(p->p), bufsz);
+          memcpy(buf, p->p, len);
+          p->p += len;
+          return len;
+        },
+        [](void *ctx, const csv_batch_t *batch, char *, int) {
+          for (int r = 0; r < batch->nrow; r++) {
+            ((parser_t *)ctx)->result.push_back(batch->column[0].i64[r]);
+          }
+          return 0;
+        }));
+    CHECK(p.result == vector<int64_t>{12, 14, -700});
+  }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+using namespace std;
+namespace decode1 {
+
+const char *PATH = "/tmp/csv_decode_test.csv.gz";
+
+struct context_t {
+  csv_t csv;
+  int64_t nrow = 0;
+  string rows; // the values of all rows, joined by '|'
+  context_t(int readahead = 0) {
+    auto conf = csv_default_config();
+    conf.readahead = readahead;
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  ctx->nrow++;
+  for (int i = 0; i < n; i++) {
+    ctx->rows += value[i].ptr ? value[i].ptr : "(null)";
+    ctx->rows += '|';
+  }
+  ctx->rows += '\n';
+  return 0;
+}
+
+// A document larger than a few read-ahead slots.
+static string make_doc() {
+  string s;
+  for (int i = 0; s.size() < 4 * AHEAD_BUFSZ + 12345; i++) {
+    s += to_string(i) + ",\"quoted, " + to_string(i * 7) + "\",xyz\n";
+  }
+  return s;
+}
+
+static void write_file(const string &s) {
+  std::ofstream out(PATH, std::ios::binary);
+  out << s;
+}
+
+// Parse the file at PATH. Return the rows, or "ERROR: errmsg".
+static string parse(int readahead = 0) {
+  context_t ctx(readahead);
+  if (csv_parse_file_ex(&ctx.csv, PATH, &ctx, perrow)) {
+    return string("ERROR: ") + ctx.csv.errmsg;
+  }
+  return ctx.rows;
+}
+
+#ifdef CSV_HAVE_ZLIB
+static string gzip(const string &s) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // 15 + 16: the largest window, with a gzip header
+  REQUIRE(Z_OK == deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8,
+                               Z_DEFAULT_STRATEGY));
+  string out(deflateBound(&zs, s.size()), '\0');
+  zs.next_in = (Bytef *)s.data();
+  zs.avail_in = s.size();
+  zs.next_out = (Bytef *)out.data();
+  zs.avail_out = out.size();
+  REQUIRE(Z_STREAM_END == deflate(&zs, Z_FINISH));
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+#endif
+
+#ifdef CSV_HAVE_ZSTD
+static string zstd(const string &s) {
+  string out(ZSTD_compressBound(s.size()), '\0');
+  size_t n = ZSTD_compress(out.data(), out.size(), s.data(), s.size(), 3);
+  REQUIRE(!ZSTD_isError(n));
+  out.resize(n);
+  return out;
+}
+#endif
+
+} // namespace decode1
+
+TEST_CASE("decode1") {
+
+  using namespace decode1;
+
+  const string doc = make_doc();
+  write_file(doc);
+  const string expected = parse();
+  REQUIRE(expected.find("ERROR") != 0);
+
+  SUBCASE("magic") {
+    const unsigned char gz[] = {0x1f, 0x8b, 0x08};
+    const unsigned char zst[] = {0x28, 0xb5, 0x2f, 0xfd};
+    CHECK(decode_kind(gz, 3) == DECODE_GZIP);
+    CHECK(decode_kind(gz, 1) == DECODE_NONE);
+    CHECK(decode_kind(zst, 4) == DECODE_ZSTD);
+    CHECK(decode_kind(zst, 3) == DECODE_NONE);
+    CHECK(decode_kind((const unsigned char *)"a,b\n", 4) == DECODE_NONE);
+  }
+
+#ifdef CSV_HAVE_ZLIB
+  SUBCASE("gzip") {
+    const string gz = gzip(doc);
+    write_file(gz);
+    CHECK(parse() == expected);
+    CHECK(parse(1) == expected);
+
+    // concatenated members
+    write_file(gzip(doc.substr(0, 1000)) + gzip(doc.substr(1000)));
+    CHECK(parse() == expected);
+
+    write_file(gzip(""));
+    CHECK(parse() == "");
+
+    write_file(gz.substr(0, gz.size() - 20));
+    CHECK(parse() == "ERROR: truncated gzip input");
+
+    string bad = gz;
+    for (size_t i = 100; i < 200; i++) {
+      bad[i] = 'x';
+    }
+    write_file(bad);
+    CHECK(parse().find("ERROR: corrupt gzip input") == 0);
+  }
+#else
+  SUBCASE("gzip") {
+    write_file(string("\x1f\x8b\x08\x00", 4));
+    CHECK(parse() == "ERROR: gzip input requires zlib");
+  }
+#endif
+
+#ifdef CSV_HAVE_ZSTD
+  SUBCASE("zstd") {
+    const string zst = zstd(doc);
+    write_file(zst);
+    CHECK(parse() == expected);
+    CHECK(parse(1) == expected);
+
+    // concatenated frames
+    write_file(zstd(doc.substr(0, 1000)) + zstd(doc.substr(1000)));
+    CHECK(parse() == expected);
+
+    write_file(zst.substr(0, zst.size() - 20));
+    CHECK(parse() == "ERROR: truncated zstd input");
+  }
+#else
+  SUBCASE("zstd") {
+    write_file(string("\x28\xb5\x2f\xfd\x00", 5));
+    CHECK(parse() == "ERROR: zstd input requires libzstd");
+  }
+#endif
+
+  remove(PATH);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+namespace double1 {
+
+static uint64_t bits(double d) {
+  uint64_t x;
+  memcpy(&x, &d, sizeof(x));
+  return x;
+}
+
+// Check that s decodes to the same double as strtod().
+static void check(const string &s) {
+  CAPTURE(s);
+  double want = strtod(s.c_str(), 0);
+  double got = 0;
+  REQUIRE(0 == csv_parse_double(s.data(), s.size(), &got));
+  REQUIRE(bits(got) == bits(want));
+}
+
+static string format(const char *fmt, ...) {
+  char buf[1200];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return buf;
+}
+
+} // namespace double1
+
+TEST_CASE("double1") {
+  using namespace double1;
+
+  SUBCASE("forms") {
+    const pair<const char *, double> good[] = {
+        {"0", 0},         {"1", 1},          {"-1", -1},
+        {"+1.5", 1.5},    {".5", 0.5},       {"5.", 5},
+        {"-.5", -0.5},    {"1e-5", 1e-5},    {"1E+5", 1e5},
+        {"2.5e3", 2500},  {"007.250", 7.25}, {"1e0400", INFINITY},
+        {"1e-400", 0},    {"-1e400", -INFINITY},
+    };
+    for (auto [s, want] : good) {
+      double d;
+      CAPTURE(s);
+      CHECK(0 == csv_parse_double(s, strlen(s), &d));
+      CHECK(d == want);
+    }
+    double d;
+    CHECK(0 == csv_parse_double("-0", 2, &d));
+    CHECK(d == 0);
+    CHECK(signbit(d));
+    CHECK(0 == csv_parse_double("-0.0e9", 6, &d));
+    CHECK(signbit(d));
+    for (const char *s : {"nan", "NaN", "-nan", "+NAN"}) {
+      d = 0;
+      CHECK(0 == csv_parse_double(s, strlen(s), &d));
+      CHECK(isnan(d));
+    }
+    for (const char *s : {"inf", "Inf", "+INF", "infinity", "Infinity"}) {
+      CHECK(0 == csv_parse_double(s, strlen(s), &d));
+      CHECK(d == INFINITY);
+    }
+    CHECK(0 == csv_parse_double("-inf", 4, &d));
+    CHECK(d == -INFINITY);
+
+    // not NUL-terminated
+    CHECK(0 == csv_parse_double("1.25,3", 4, &d));
+    CHECK(d == 1.25);
+    CHECK(0 == csv_parse_double("1e2e", 3, &d));
+    CHECK(d == 100);
+
+    d = 7;
+    for (const char *s :
+         {"", "-", "+", ".", "-.", "e5", ".e5", "1e", "1e+", "1e-", "1.5.",
+          " 1", "1 ", "1,5", "0x10", "1e5.0", "nanx", "in", "infinit",
+          "--1", "+-1", "1d5", "1f", "nan(1)"}) {
+      CAPTURE(s);
+      CHECK(-1 == csv_parse_double(s, strlen(s), &d));
+    }
+    CHECK(d == 7); // untouched
+  }
+
+  SUBCASE("random doubles") {
+    std::mt19937_64 rng(24);
+    for (int i = 0; i < 100000; i++) {
+      double x;
+      uint64_t u = rng();
+      memcpy(&x, &u, sizeof(x));
+      if (!isfinite(x)) {
+        continue;
+      }
+      int prec = 1 + rng() % 20;
+      check(format("%.*g", prec, x));
+      check(format("%.*e", prec, x));
+      // fixed notation for moderate exponents
+      int e = (u >> 52 & 0x7ff) - 1023;
+      if (-80 < e && e < 80) {
+        check(format("%.*f", prec, x));
+      }
+    }
+    for (int i = 0; i < 100000; i++) {
+      // short decimals, as in sensor data
+      int64_t v = rng() % 100000000;
+      int scale = rng() % 10;
+      check(format("%" PRId64 "e-%d", v, scale));
+      check(format("%.*f", scale, v / pow(10.0, scale)));
+    }
+  }
+
+  SUBCASE("halfway") {
+    // The exact midpoint between two doubles, and its neighbours with
+    // a digit changed far past the 19th. These need all the digits.
+    std::mt19937_64 rng(25);
+    for (int i = 0; i < 3000; i++) {
+      double a;
+      uint64_t u = rng() >> (rng() % 2 ? 1 : 12); // some subnormals
+      memcpy(&a, &u, sizeof(a));
+      double b = nextafter(a, INFINITY);
+      if (!isfinite(b)) {
+        continue;
+      }
+      long double mid = ((long double)a + b) / 2;
+      string s = format("%.800Le", mid);
+      // strip trailing zeros of the mantissa
+      size_t e = s.find('e');
+      size_t z = s.find_last_not_of('0', e - 1);
+      s = s.substr(0, z + 1) + s.substr(e);
+      check(s);
+      e = s.find('e');
+      string up = s.substr(0, e) + "0001" + s.substr(e);
+      check(up);
+      string down = s;
+      down[e - 1]--;
+      check(down);
+    }
+  }
+
+  SUBCASE("edges") {
+    for (double x : {DBL_MAX, DBL_MIN, DBL_TRUE_MIN, DBL_EPSILON, 1.0,
+                     9007199254740992.0, 9007199254740993.0}) {
+      check(format("%.17g", x));
+      check(format("%.40g", x));
+      check(format("%.17g", nextafter(x, 0)));
+    }
+    for (const char *s :
+         {"1.7976931348623158e308", "1.7976931348623159e308",
+          "2.4703282292062327e-324", "2.4703282292062328e-324",
+          "4.9406564584124654e-324", "2.2250738585072011e-308",
+          "2.2250738585072012e-308", "9007199254740993",
+          "9007199254740993.0000000000000000001",
+          "123456789012345678901234567890", "0.1", "0.3",
+          "1e22", "1e23", "1e-22", "1e-23", "4503599627370497.5",
+          "1e308", "1e309", "1e-342", "1e-343", "1e-324", "0e999999999"}) {
+      check(s);
+    }
+    // many digits, and many leading zeros
+    check(string(1000, '9'));
+    check("0." + string(320, '0') + "4940656458412465441765687928682213");
+    check(string(500, '0') + "1" + string(400, '0') + "." +
+          string(900, '7'));
+    check("1." + string(2000, '0') + "1e-1");
+  }
+
+  SUBCASE("typed") {
+    const csv_type_t schema[] = {CSV_TYPE_DOUBLE, CSV_TYPE_DOUBLE};
+    csv_config_t conf = csv_default_config();
+    conf.schema = schema;
+    conf.nschema = 2;
+    csv_t csv = csv_open(&conf);
+    REQUIRE(csv.ok);
+    struct feed_t {
+      const char *p;
+      vector<pair<uint8_t, double>> got;
+      static int feed(void *ctx, char *buf, int bufsz, char *, int) {
+        feed_t *f = (feed_t *)ctx;
+        int len = std::min<int>(strlen(f->p), bufsz);
+        memcpy(buf, f->p, len);
+        f->p += len;
+        return len;
+      }
+    } f = {"1e-5,.5\n-0,NaN\ninf,1\n", {}};
+    CHECK(0 == csv_parse_batch(&csv, &f, feed_t::feed,
+                               [](void *ctx, const csv_batch_t *batch,
+                                  char *, int) {
+                                 for (int r = 0; r < batch->nrow; r++) {
+                                   for (int c = 0; c < batch->ncol; c++) {
+                                     const csv_column_t &col =
+                                         batch->column[c];
+                                     ((feed_t *)ctx)
+                                         ->got.push_back(
+                                             {col.flag[r], col.f64[r]});
+                                   }
+                                 }
+                                 return 0;
+                               }));
+    csv_close(&csv);
+    const auto &got = f.got;
+    REQUIRE(got.size() == 6);
+    CHECK(got[0] == make_pair<uint8_t, double>(0, 1e-5));
+    CHECK(got[1] == make_pair<uint8_t, double>(0, 0.5));
+    CHECK(got[2].first == 0);
+    CHECK(signbit(got[2].second));
+    CHECK(got[3].first == 0);
+    CHECK(isnan(got[3].second));
+    CHECK(got[4] == make_pair<uint8_t, double>(0, INFINITY));
+    CHECK(got[5] == make_pair<uint8_t, double>(0, 1));
+  }
+}
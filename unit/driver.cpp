@@ -9,7 +9,27 @@
 #include "unquote1.hpp"
 #include "csv1.hpp"
 #include "scan1.hpp"
+#include "index1.hpp"
+#include "kernel1.hpp"
+#include "int64_1.hpp"
+#include "double1.hpp"
+#include "decimal1.hpp"
+#include "resume1.hpp"
+#include "push1.hpp"
+#include "batch1.hpp"
+#include "alloc1.hpp"
+#include "reset1.hpp"
+#include "schema1.hpp"
+#include "select1.hpp"
 #include "filescan1.hpp"
+#include "uring1.hpp"
+#include "ahead1.hpp"
+#include "decode1.hpp"
+#include "mmap1.hpp"
+#include "segment1.hpp"
+#include "mem1.hpp"
+#include "parallel1.hpp"
+#include "unframe1.hpp"
 #include "datetime1.hpp"
 #include "cpp1.hpp"
 // #include "unquote2.hpp"
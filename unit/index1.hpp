@@ -0,0 +1,113 @@
+#pragma once
+
+#include <random>
+
+using namespace std;
+
+namespace index1 {
+
+// Parse doc with either onerow() or onerow_indexed(), and record every
+// row along with its lineno and rowno.
+struct context_t {
+  csv_t csv;
+  const char *doc;
+  int chunk; // max #bytes returned per feed() call
+  std::vector<std::vector<std::string>> result;
+  std::vector<std::pair<int64_t, int64_t>> pos;
+  context_t(const char *doc_, bool indexed, int chunk_ = 1 << 30)
+      : doc(doc_), chunk(chunk_) {
+    auto conf = csv_default_config();
+    conf.delim = '|';
+    conf.nullstr[0] = 1; // nothing is NULL
+    conf.initbufsz = 64;
+    csv = csv_open(&conf);
+    ((csvx_t *)csv.__internal)->indexed = indexed;
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = strlen(ctx->doc);
+  len = std::min(len, std::min(bufsz, ctx->chunk));
+  memcpy(buf, ctx->doc, len);
+  ctx->doc += len;
+  return len;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr);
+  }
+  ctx->result.push_back(std::move(row));
+  ctx->pos.push_back({lineno, rowno});
+  return 0;
+}
+
+// Generate a random document full of quotes, delims and newlines.
+static std::string random_doc(std::mt19937 &rng, int nrow) {
+  const char *pieces[] = {"a", "bc", "|", "\"x|y\"", "\"p\"\"q\"", "\"\"",
+                          "\"m\nn\"", "\"\"\"\"", "1234567890"};
+  std::string doc;
+  for (int i = 0; i < nrow; i++) {
+    int n = rng() % 20;
+    for (int j = 0; j < n; j++) {
+      doc += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    doc += (rng() % 2) ? "\r\n" : "\n";
+  }
+  return doc;
+}
+
+} // namespace index1
+
+TEST_CASE("index1") {
+
+  using namespace index1;
+
+  SUBCASE("quotes and newlines") {
+    const char *doc = "a|\"b|c\"|d\n"
+                      "\"e\"\"f\"|\"g\nh\"|i\r\n"
+                      "j|\"\"|\"\"\"\"\n";
+    context_t ctx{doc, true};
+    CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+    CHECK(ctx.result.size() == 3);
+    CHECK(ctx.result[0] == vector<string>{"a", "b|c", "d"});
+    CHECK(ctx.result[1] == vector<string>{"e\"f", "g\nh", "i"});
+    CHECK(ctx.result[2] == vector<string>{"j", "", "\""});
+    CHECK(ctx.pos[0] == std::pair<int64_t, int64_t>{1, 1});
+    CHECK(ctx.pos[1] == std::pair<int64_t, int64_t>{3, 2});
+    CHECK(ctx.pos[2] == std::pair<int64_t, int64_t>{4, 3});
+  }
+
+  SUBCASE("unterminated quote") {
+    context_t ctx{"a|b\n\"cd|e\nf", true};
+    CHECK(-1 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+    CHECK(strstr(ctx.csv.errmsg, "unterminated quote"));
+  }
+
+  SUBCASE("same result as onerow()") {
+    std::mt19937 rng(1);
+    for (int i = 0; i < 50; i++) {
+      std::string doc = random_doc(rng, 100);
+      int chunk = 1 + rng() % 200;
+      context_t x{doc.c_str(), false, chunk};
+      context_t y{doc.c_str(), true, chunk};
+      CHECK(0 == csv_parse(&x.csv, &x, feed, perrow));
+      CHECK(0 == csv_parse(&y.csv, &y, feed, perrow));
+      CHECK(x.result == y.result);
+      CHECK(x.pos == y.pos);
+    }
+  }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <random>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace int64_1 {
+
+// The kernels the cpu supports.
+static vector<const scan_kernel_t *> kernels() {
+  vector<const scan_kernel_t *> ret;
+  for (csv_kernel_t id : {CSV_KERNEL_SSE2, CSV_KERNEL_AVX2,
+                          CSV_KERNEL_AVX512BW, CSV_KERNEL_NEON}) {
+    if (scan_kernel(id)) {
+      ret.push_back(scan_kernel(id));
+    }
+  }
+  return ret;
+}
+
+// A digit-by-digit decoder to check the kernels against.
+static int reference(const string &s, int64_t *ret) {
+  size_t i = 0;
+  bool neg = false;
+  if (i < s.size() && (s[i] == '+' || s[i] == '-')) {
+    neg = (s[i++] == '-');
+  }
+  if (i == s.size()) {
+    return -1;
+  }
+  __int128 val = 0;
+  for (; i < s.size(); i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return -1;
+    }
+    val = val * 10 + (s[i] - '0');
+    if (val > (__int128)INT64_MAX + 1) {
+      return -1;
+    }
+  }
+  val = neg ? -val : val;
+  if (val > INT64_MAX) {
+    return -1;
+  }
+  *ret = (int64_t)val;
+  return 0;
+}
+
+// Check every kernel on s against the reference.
+static void check(const string &s) {
+  int64_t want = 0;
+  int rc = reference(s, &want);
+  for (const scan_kernel_t *k : kernels()) {
+    int64_t got = 0;
+    CAPTURE(s);
+    CAPTURE(k->name);
+    REQUIRE(rc == k->int64(s.data(), s.size(), &got));
+    if (rc == 0) {
+      REQUIRE(got == want);
+    }
+  }
+}
+
+} // namespace int64_1
+
+TEST_CASE("int64_1") {
+  using namespace int64_1;
+
+  SUBCASE("basic") {
+    int64_t v = 1;
+    CHECK(0 == csv_parse_int64("0", 1, &v));
+    CHECK(v == 0);
+    CHECK(0 == csv_parse_int64("-0", 2, &v));
+    CHECK(v == 0);
+    CHECK(0 == csv_parse_int64("+12", 3, &v));
+    CHECK(v == 12);
+    CHECK(0 == csv_parse_int64("-1234567890", 11, &v));
+    CHECK(v == -1234567890);
+    CHECK(0 == csv_parse_int64("9223372036854775807", 19, &v));
+    CHECK(v == INT64_MAX);
+    CHECK(0 == csv_parse_int64("-9223372036854775808", 20, &v));
+    CHECK(v == INT64_MIN);
+    CHECK(0 == csv_parse_int64("0000000000000000000000042", 25, &v));
+    CHECK(v == 42);
+    // not NUL-terminated
+    CHECK(0 == csv_parse_int64("12345,678", 5, &v));
+    CHECK(v == 12345);
+
+    v = 7;
+    CHECK(-1 == csv_parse_int64("", 0, &v));
+    CHECK(-1 == csv_parse_int64("-", 1, &v));
+    CHECK(-1 == csv_parse_int64("+-1", 3, &v));
+    CHECK(-1 == csv_parse_int64(" 1", 2, &v));
+    CHECK(-1 == csv_parse_int64("1 ", 2, &v));
+    CHECK(-1 == csv_parse_int64("1.0", 3, &v));
+    CHECK(-1 == csv_parse_int64("9223372036854775808", 19, &v));
+    CHECK(-1 == csv_parse_int64("-9223372036854775809", 20, &v));
+    CHECK(-1 == csv_parse_int64("10000000000000000000", 20, &v));
+    CHECK(-1 == csv_parse_int64("99999999999999999999", 20, &v));
+    CHECK(v == 7); // untouched
+  }
+
+  SUBCASE("every length") {
+    const string sign[] = {"", "-", "+"};
+    for (int n = 1; n <= 22; n++) {
+      for (const string &sg : sign) {
+        check(sg + string(n, '9'));
+        check(sg + string(n, '0'));
+        check(sg + "1" + string(n - 1, '0'));
+        check(sg + string(n - 1, '0') + "1");
+        // a bad char at every position
+        for (int i = 0; i < n; i++) {
+          for (char c : {'/', ':', ' ', '.', 'a', '\xb0', '\xff', '\0'}) {
+            string s = string(n, '5');
+            s[i] = c;
+            check(sg + s);
+          }
+        }
+      }
+    }
+  }
+
+  SUBCASE("random") {
+    std::mt19937_64 rng(23);
+    for (int i = 0; i < 200000; i++) {
+      uint64_t x = rng();
+      string s = to_string(x >> (rng() % 64));
+      switch (rng() % 4) {
+      case 0:
+        s = "-" + s;
+        break;
+      case 1:
+        s = string(rng() % 5, '0') + s;
+        break;
+      }
+      check(s);
+    }
+    for (int64_t x : {INT64_MAX, INT64_MIN, INT64_MAX - 1, INT64_MIN + 1}) {
+      check(to_string(x));
+    }
+  }
+
+  SUBCASE("page boundary") {
+    // Digits that end right before a page that cannot be read.
+    const long page = sysconf(_SC_PAGESIZE);
+    char *p = (char *)mmap(0, 2 * page, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    REQUIRE(p != MAP_FAILED);
+    REQUIRE(0 == mprotect(p + page, page, PROT_NONE));
+    for (const scan_kernel_t *k : kernels()) {
+      for (int n = 1; n <= 20; n++) {
+        char *ptr = p + page - n;
+        memset(ptr, '7', n);
+        int64_t v;
+        CAPTURE(k->name);
+        CAPTURE(n);
+        CHECK((n <= 19) == (0 == k->int64(ptr, n, &v)));
+      }
+    }
+    munmap(p, 2 * page);
+  }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+using namespace std;
+
+namespace kernel1 {
+
+const csv_kernel_t ALL[] = {CSV_KERNEL_SSE2, CSV_KERNEL_AVX2,
+                            CSV_KERNEL_AVX512BW, CSV_KERNEL_NEON};
+
+struct context_t {
+  csv_t csv;
+  const char *doc;
+  std::vector<std::vector<std::string>> result;
+  context_t(const char *doc_, csv_kernel_t kernel) : doc(doc_) {
+    auto conf = csv_default_config();
+    conf.kernel = kernel;
+    conf.initbufsz = 100;
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = std::min((int)strlen(ctx->doc), bufsz);
+  memcpy(buf, ctx->doc, len);
+  ctx->doc += len;
+  return len;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? value[i].ptr : "(null)");
+  }
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+} // namespace kernel1
+
+TEST_CASE("kernel1") {
+
+  using namespace kernel1;
+
+  SUBCASE("auto") {
+    context_t ctx{"", CSV_KERNEL_AUTO};
+    CHECK(ctx.csv.ok);
+    CHECK(strlen(csv_kernel_name(&ctx.csv)) > 0);
+  }
+
+  SUBCASE("unsupported") {
+    int nsupported = 0;
+    for (auto k : ALL) {
+      context_t ctx{"", k};
+      if (scan_kernel(k)) {
+        nsupported++;
+        CHECK(ctx.csv.ok);
+      } else {
+        CHECK(!ctx.csv.ok);
+      }
+    }
+    CHECK(nsupported > 0);
+  }
+
+  SUBCASE("all kernels agree") {
+    std::string doc;
+    for (int i = 0; i < 200; i++) {
+      doc += "abc,\"d,e\"\"f\",," + std::to_string(i * 7919) + ",\"g\nh\"";
+      doc += std::string(i % 70, 'x') + "\r\n";
+    }
+    context_t ref{doc.c_str(), CSV_KERNEL_SSE2};
+    CHECK(0 == csv_parse(&ref.csv, &ref, feed, perrow));
+    CHECK(ref.result.size() == 200);
+    for (auto k : ALL) {
+      if (!scan_kernel(k)) {
+        continue;
+      }
+      context_t x{doc.c_str(), k};
+      CHECK(0 == csv_parse(&x.csv, &x, feed, perrow));
+      CHECK(x.result == ref.result);
+
+      // ... and without the structural index.
+      context_t y{doc.c_str(), k};
+      ((csvx_t *)y.csv.__internal)->indexed = false;
+      CHECK(0 == csv_parse(&y.csv, &y, feed, perrow));
+      CHECK(y.result == ref.result);
+    }
+  }
+}
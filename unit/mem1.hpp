@@ -0,0 +1,231 @@
+#pragma once
+
+#include "../src/csv.hpp"
+#include <sys/mman.h>
+
+using namespace std;
+namespace mem1 {
+
+struct context_t {
+  csv_t csv;
+  std::vector<std::vector<std::string>> result;
+  bool nomalloc = true; // the scratch space of every row was on the stack
+  context_t(const csv_config_t *conf = 0) { csv = csv_open(conf); }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+// Note: values are not NUL-terminated.
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  csvx_t *cb = (csvx_t *)ctx->csv.__internal;
+  REQUIRE(cb->mem);
+  if (!in_mem(cb, cb->value.ptr) ||
+      (cb->sidx.ptr && !in_mem(cb, cb->sidx.ptr)) ||
+      (cb->tmp.ptr && !in_mem(cb, cb->tmp.ptr)) ||
+      (!cb->buf.mapped && !in_mem(cb, cb->buf.ptr))) {
+    ctx->nomalloc = false;
+  }
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? string(value[i].ptr, value[i].len)
+                               : "(null)");
+  }
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+// Parse s using csv_parse_file() for the expected result.
+static vector<vector<string>> expected(const string &s,
+                                       const csv_config_t &conf,
+                                       int *ret = 0) {
+  vector<vector<string>> result;
+  csv_t csv = csv_open(&conf);
+  FILE *fp = fmemopen((void *)s.data(), s.size(), "r");
+  REQUIRE(fp);
+  auto fn = [](void *ctx, int n, csv_value_t value[], int64_t, int64_t,
+               char *, int) -> int {
+    vector<string> row;
+    for (int i = 0; i < n; i++) {
+      row.push_back(value[i].ptr ? string(value[i].ptr, value[i].len)
+                                 : "(null)");
+    }
+    ((vector<vector<string>> *)ctx)->push_back(std::move(row));
+    return 0;
+  };
+  int rc = csv_parse_file(&csv, fp, &result, fn);
+  if (ret) {
+    *ret = rc;
+  } else {
+    CHECK(0 == rc);
+  }
+  csv_close(&csv);
+  return result;
+}
+
+// Parse s with csv_parse_mem(), and check it against csv_parse_file().
+// Return true if no scratch space came from the heap.
+static bool check(const string &s, const csv_config_t &conf) {
+  context_t ctx(&conf);
+  int ret = csv_parse_mem(&ctx.csv, s.data(), s.size(), &ctx, perrow);
+  int want;
+  CHECK(ctx.result == expected(s, conf, &want));
+  CHECK(ret == want);
+  // nothing points into the stack of csv_parse_mem()
+  csvx_t *cb = (csvx_t *)ctx.csv.__internal;
+  CHECK(cb->mem == 0);
+  CHECK(!in_mem(cb, cb->buf.ptr));
+  return ctx.nomalloc;
+}
+
+class parser_t : public csv_parser_t {
+public:
+  vector<vector<string>> result;
+  static int perrow(void *ctx, int n, csv_value_t value[], int64_t lineno,
+                    int64_t rowno, char *errbuf, int errsz) {
+    (void)lineno;
+    (void)rowno;
+    (void)errbuf;
+    (void)errsz;
+    vector<string> row;
+    for (int i = 0; i < n; i++) {
+      row.push_back(string(value[i].ptr, value[i].len));
+    }
+    ((parser_t *)ctx)->result.push_back(std::move(row));
+    return 0;
+  }
+};
+
+}; // namespace mem1
+
+TEST_CASE("mem1") {
+
+  using namespace mem1;
+  const csv_config_t dflt = csv_default_config();
+
+  SUBCASE("basic") {
+    csv_config_t bslash = dflt;
+    bslash.esc = '\\';
+    for (auto conf : {dflt, bslash}) {
+      CHECK(check("", conf));
+      CHECK(check("abc,def\n", conf));
+      CHECK(check("abc,def", conf)); // last row not terminated
+      CHECK(check("abc,\"d,e\"\r\n\"x\ny\",\n,last", conf));
+      CHECK(check("a,\"b\"\"c\",\"d\\\"\"\"e\"\n", conf));
+      conf.skip_header = true;
+      CHECK(check("h1,h2\n1,2\n3,4", conf));
+    }
+  }
+
+  SUBCASE("larger than the stack") {
+    // These fall back to the heap.
+    string wide;
+    for (int i = 0; i < 100; i++) {
+      wide += to_string(i) + ",";
+    }
+    wide += "x\n";
+    CHECK(!check(wide + wide, dflt));
+    string escaped = "\"" + string(3000, 'a') + "\"\"b\"\n";
+    CHECK(!check(escaped, dflt));
+    CHECK(!check("1,2\n" + string(3000, 'c'), dflt));
+
+    csv_config_t bslash = dflt;
+    bslash.esc = '\\';
+    CHECK(!check("\"" + string(3000, 'a') + "\\\"b\"\n", bslash));
+
+    string big;
+    for (int i = 0; i < 10000; i++) {
+      big += '"';
+      big += to_string(i) + "\"\"\",abc,\"x\ny\"\n";
+    }
+    check(big, dflt);
+    check(big, bslash);
+  }
+
+  SUBCASE("page boundary") {
+    // A document that ends right before a page that cannot be read.
+    // The scan of its tail must not touch that page.
+    const long page = sysconf(_SC_PAGESIZE);
+    char *p = (char *)mmap(0, 2 * page, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    REQUIRE(p != MAP_FAILED);
+    REQUIRE(0 == mprotect(p + page, page, PROT_NONE));
+    const string docs[] = {"a,b\n1,2\n", "a,\"b\"\"\",c", "x",
+                           "abc,def,ghi,jkl,mno,pqr,stu,vwx,yz\n" +
+                               string(100, 'z')};
+    csv_config_t bslash = dflt;
+    bslash.esc = '\\';
+    for (const string &doc : docs) {
+      for (auto conf : {dflt, bslash}) {
+        for (int k = 0; k < 3; k++) {
+          char *ptr = p + page - doc.size() - k;
+          memcpy(ptr, doc.data(), doc.size());
+          context_t ctx(&conf);
+          CHECK(0 == csv_parse_mem(&ctx.csv, ptr, doc.size(), &ctx, perrow));
+          CHECK(ctx.result == expected(doc, conf));
+        }
+      }
+    }
+    munmap(p, 2 * page);
+  }
+
+  SUBCASE("scan tail") {
+    // match() with len < 64 against a full copy of the tail.
+    std::mt19937 rng(17);
+    std::vector<const scan_kernel_t *> kernels;
+    for (int id : {CSV_KERNEL_SSE2, CSV_KERNEL_AVX2, CSV_KERNEL_AVX512BW,
+                   CSV_KERNEL_NEON}) {
+      if (scan_kernel(id)) {
+        kernels.push_back(scan_kernel(id));
+      }
+    }
+    char buf[256];
+    for (int i = 0; i < 1000; i++) {
+      for (char &c : buf) {
+        c = ",\"\nab"[rng() % 5];
+      }
+      int off = rng() % 128;
+      int len = rng() % 64 + 1;
+      uint64_t want = 0;
+      for (int j = 0; j < len; j++) {
+        if (buf[off + j] == ',' || buf[off + j] == '\n') {
+          want |= 1ULL << j;
+        }
+      }
+      for (auto k : kernels) {
+        CHECK(k->match(buf + off, len, ",\n", 2) == want);
+      }
+    }
+  }
+
+  SUBCASE("errors") {
+    context_t ctx;
+    string s = "a,\"b\n";
+    CHECK(-1 == csv_parse_mem(&ctx.csv, s.data(), s.size(), &ctx, perrow));
+    CHECK(string(ctx.csv.errmsg).find("unterminated quote") != string::npos);
+    csvx_t *cb = (csvx_t *)ctx.csv.__internal;
+    CHECK(cb->mem == 0);
+    CHECK(cb->value.ptr == 0);
+    // a used handle
+    CHECK(-1 == csv_parse_mem(&ctx.csv, s.data(), s.size(), &ctx, perrow));
+  }
+
+  SUBCASE("c++") {
+    parser_t p;
+    CHECK(p.parse_mem("a,b\nc,\"d\"\"e\"", parser_t::perrow));
+    CHECK(p.result ==
+          vector<vector<string>>{{"a", "b"}, {"c", "d\"e"}});
+    // a second parse on the same parser
+    p.result.clear();
+    CHECK(p.parse_mem("x\n", parser_t::perrow));
+    CHECK(p.result == vector<vector<string>>{{"x"}});
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+using namespace std;
+namespace mmap1 {
+
+const char *PATH = "/tmp/csv_mmap_test.csv";
+
+struct context_t {
+  csv_t csv;
+  std::vector<std::vector<std::string>> result;
+  std::vector<int64_t> lineno;
+  context_t(const csv_config_t *conf = 0) { csv = csv_open(conf); }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+// Note: values are not NUL-terminated in mmap mode.
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  row.resize(n);
+  for (int i = 0; i < n; i++) {
+    row[i] = value[i].ptr ? string(value[i].ptr, value[i].len) : "(null)";
+  }
+  ctx->result.push_back(std::move(row));
+  ctx->lineno.push_back(lineno);
+  return 0;
+}
+
+static void write_file(const string &s) {
+  std::ofstream out(PATH, std::ios::binary);
+  out << s;
+}
+
+// Parse s using csv_parse_file() for the expected result.
+static vector<vector<string>> expected(const string &s, csv_config_t conf) {
+  conf.maxbufsz = 1024 * 1024;
+  context_t ctx(&conf);
+  FILE *fp = fmemopen((void *)s.data(), s.size(), "r");
+  REQUIRE(fp);
+  REQUIRE(0 == csv_parse_file(&ctx.csv, fp, &ctx, perrow));
+  return ctx.result;
+}
+
+}; // namespace mmap1
+
+TEST_CASE("mmap1") {
+
+  using namespace mmap1;
+
+  SUBCASE("basic") {
+    write_file("abc,def,hij\r\n"
+               "\"x,1\",\"y\"\"2\",\n"
+               "\"multi\nline\",,zzz");
+    context_t ctx;
+    CHECK(0 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+    REQUIRE(ctx.result.size() == 3);
+    CHECK(ctx.result[0] == vector<string>{"abc", "def", "hij"});
+    CHECK(ctx.result[1] == vector<string>{"x,1", "y\"2", "(null)"});
+    CHECK(ctx.result[2] == vector<string>{"multi\nline", "(null)", "zzz"});
+    CHECK(ctx.lineno == vector<int64_t>{1, 2, 4});
+  }
+
+  SUBCASE("escape") {
+    csv_config_t conf = csv_default_config();
+    conf.esc = '\\';
+    write_file("\"a\\\"b\",\"c\\\\d\"\n\"e\"");
+    context_t ctx(&conf);
+    CHECK(0 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+    REQUIRE(ctx.result.size() == 2);
+    CHECK(ctx.result[0] == vector<string>{"a\"b", "c\\d"});
+    CHECK(ctx.result[1] == vector<string>{"e"});
+  }
+
+  SUBCASE("empty file") {
+    write_file("");
+    context_t ctx;
+    CHECK(0 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+    CHECK(ctx.result.size() == 0);
+  }
+
+  SUBCASE("no such file") {
+    context_t ctx;
+    CHECK(-1 == csv_parse_mmap(&ctx.csv, "/tmp/no/such/file", &ctx, perrow));
+    CHECK(string(ctx.csv.errmsg).find("open failed") == 0);
+  }
+
+  SUBCASE("unterminated quote") {
+    write_file("a,b\n\"c,d\n");
+    context_t ctx;
+    CHECK(-1 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+    CHECK(string(ctx.csv.errmsg).find("unterminated quote") != string::npos);
+  }
+
+  SUBCASE("sliding window") {
+    // A window much smaller than the file and some of its rows makes
+    // the window slide and widen many times.
+    for (char esc : {'"', '\\'}) {
+      srand(7);
+      string s;
+      for (int i = 0; i < 2000; i++) {
+        int n = rand() % 5 + 1;
+        for (int j = 0; j < n; j++) {
+          if (j) {
+            s += ',';
+          }
+          int len = rand() % (i % 100 == 0 ? 300 : 12);
+          bool quoted = rand() % 2;
+          if (quoted) {
+            s += '"';
+          }
+          for (int k = 0; k < len; k++) {
+            int r = rand() % 16;
+            s += (r == 0 && quoted) ? '\n'
+                 : (r == 1 && quoted) ? ','
+                 : (char)('a' + r);
+          }
+          if (quoted) {
+            s += '"';
+          }
+        }
+        s += (i % 3 == 0) ? "\r\n" : "\n";
+      }
+      s += "last,row";
+
+      write_file(s);
+      for (bool unquote_values : {true, false}) {
+        csv_config_t conf = csv_default_config();
+        conf.esc = esc;
+        conf.unquote_values = unquote_values;
+        auto expect = expected(s, conf);
+
+        conf.maxbufsz = 64;
+        context_t ctx(&conf);
+        CHECK(0 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+        CHECK(ctx.result == expect);
+        CHECK(ctx.result.back() == vector<string>{"last", "row"});
+      }
+    }
+  }
+
+  SUBCASE("reused handle") {
+    write_file("a,b\n");
+    context_t ctx;
+    CHECK(0 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+    CHECK(-1 == csv_parse_mmap(&ctx.csv, PATH, &ctx, perrow));
+  }
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+namespace parallel1 {
+
+const char *PATH = "/tmp/csv_parallel_test.csv";
+
+// The rows of one chunk.
+struct result_t {
+  vector<vector<string>> rows;
+  vector<int64_t> lineno;
+  vector<int64_t> rowno;
+  bool operator==(const result_t &) const = default;
+};
+
+static int perrow(void *ctx, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  result_t *r = (result_t *)ctx;
+  vector<string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? string(value[i].ptr, value[i].len)
+                               : "(null)");
+  }
+  r->rows.push_back(std::move(row));
+  r->lineno.push_back(lineno);
+  r->rowno.push_back(rowno);
+  return 0;
+}
+
+// Parse PATH on nthread threads, and concat the results of all chunks.
+static int parse(const csv_config_t &conf, int nthread, result_t &ret,
+                 string *errmsg = 0) {
+  vector<result_t> result(nthread);
+  vector<void *> context(nthread);
+  for (int i = 0; i < nthread; i++) {
+    context[i] = &result[i];
+  }
+  csv_t csv = csv_open(&conf);
+  int rc = csv_parse_parallel(&csv, PATH, nthread, context.data(), perrow);
+  if (errmsg) {
+    *errmsg = csv.errmsg;
+  }
+  csv_close(&csv);
+  for (auto &r : result) {
+    ret.rows.insert(ret.rows.end(), r.rows.begin(), r.rows.end());
+    ret.lineno.insert(ret.lineno.end(), r.lineno.begin(), r.lineno.end());
+    ret.rowno.insert(ret.rowno.end(), r.rowno.begin(), r.rowno.end());
+  }
+  return rc;
+}
+
+// Parse PATH on nthread threads with a perrow() that fails on row
+// failrow. Return the number of rows passed to perrow() once it has
+// failed, and the total in *nrow.
+static int late_rows(const csv_config_t &conf, int nthread, int64_t failrow,
+                     int64_t *nrow, string *errmsg) {
+  static std::atomic<bool> failed;
+  static std::atomic<int> late;
+  static std::atomic<int64_t> count;
+  static int64_t fail;
+  failed = false;
+  late = 0;
+  count = 0;
+  fail = failrow;
+  vector<void *> context(nthread);
+  csv_t csv = csv_open(&conf);
+  int rc = csv_parse_parallel(
+      &csv, PATH, nthread, context.data(),
+      [](void *, int, csv_value_t[], int64_t, int64_t rowno, char *errbuf,
+         int errsz) {
+        count++;
+        if (rowno == fail) {
+          failed = true;
+          snprintf(errbuf, errsz, "row %" PRId64 " failed", rowno);
+          return -1;
+        }
+        if (failed) {
+          // a row that was on its way; give the failed chunk time to
+          // stop the others
+          if (late++ < 8) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+        }
+        return 0;
+      });
+  CHECK(rc == -1);
+  *errmsg = csv.errmsg;
+  csv_close(&csv);
+  *nrow = count;
+  return late;
+}
+
+// A doc of about 1MB with long quoted values, so that the chunks
+// often start inside quotes.
+static string make_doc(char esc) {
+  srand(11);
+  string s;
+  while (s.size() < 1024 * 1024) {
+    int n = rand() % 4 + 1;
+    for (int j = 0; j < n; j++) {
+      if (j) {
+        s += ',';
+      }
+      bool quoted = rand() % 2;
+      int len = rand() % (quoted && rand() % 50 == 0 ? 200000 : 20);
+      if (quoted) {
+        s += '"';
+      }
+      for (int k = 0; k < len; k++) {
+        int r = rand() % 16;
+        if (quoted && r == 0) {
+          s += '\n';
+        } else if (quoted && r == 1) {
+          s += ',';
+        } else if (quoted && r == 2) {
+          s += esc;
+          s += '"';
+        } else {
+          s += (char)('a' + r);
+        }
+      }
+      if (quoted) {
+        s += '"';
+      }
+    }
+    s += "\n";
+  }
+  s += "last,row";
+  return s;
+}
+
+}; // namespace parallel1
+
+TEST_CASE("parallel1") {
+
+  using namespace parallel1;
+
+  SUBCASE("same as serial") {
+    for (char esc : {'"', '\\'}) {
+      std::ofstream(PATH, std::ios::binary) << make_doc(esc);
+      for (bool skip_header : {false, true}) {
+        csv_config_t conf = csv_default_config();
+        conf.esc = esc;
+        conf.skip_header = skip_header;
+
+        result_t expect;
+        {
+          csv_t csv = csv_open(&conf);
+          CHECK(0 == csv_parse_mmap(&csv, PATH, &expect, perrow));
+          csv_close(&csv);
+        }
+        CHECK(expect.rows.back() == vector<string>{"last", "row"});
+
+        for (int nthread : {1, 2, 3, 7, 16}) {
+          result_t result;
+          CHECK(0 == parse(conf, nthread, result));
+          CHECK(result == expect);
+        }
+      }
+    }
+  }
+
+  SUBCASE("error has global lineno") {
+    string s(200000, '\n');
+    s += "a,\"b\n";
+    std::ofstream(PATH, std::ios::binary) << s;
+    result_t result;
+    string errmsg;
+    CHECK(-1 == parse(csv_default_config(), 4, result, &errmsg));
+    CHECK(result.rows.size() <= 200000);
+    CHECK(errmsg.find("(line 200002, row 200001, col 2)") == 0);
+    CHECK(errmsg.find("unterminated quote") != string::npos);
+  }
+
+  SUBCASE("perrow error stops the other chunks") {
+    string s;
+    for (int i = 0; i < 400000; i++) {
+      s += to_string(i) + ",abc\n";
+    }
+    std::ofstream(PATH, std::ios::binary) << s;
+    for (int nthread : {2, 4}) {
+      CAPTURE(nthread);
+      int64_t nrow;
+      string errmsg;
+      CHECK(late_rows(csv_default_config(), nthread, 1000, &nrow, &errmsg) <=
+            nthread - 1);
+      CHECK(nrow < 400000);
+      CHECK(errmsg == "row 1000 failed");
+    }
+  }
+
+  SUBCASE("bad nthread") {
+    result_t result;
+    string errmsg;
+    CHECK(-1 == parse(csv_default_config(), 0, result, &errmsg));
+    CHECK(errmsg == "nthread must be positive");
+  }
+}
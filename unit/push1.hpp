@@ -0,0 +1,178 @@
+#pragma once
+
+#include <random>
+
+using namespace std;
+
+namespace push1 {
+
+struct context_t {
+  csv_t csv;
+  std::vector<std::vector<std::string>> result;
+  std::string doc; // for feed()
+  size_t off = 0;
+  context_t(char esc, bool skip_header = false, int initbufsz = 0) {
+    auto conf = csv_default_config();
+    conf.esc = esc;
+    conf.delim = '|';
+    conf.skip_header = skip_header;
+    if (initbufsz) {
+      conf.initbufsz = initbufsz;
+    }
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+
+  // push doc[] in pieces of random sizes up to maxpiece
+  int push(const std::string &doc, std::mt19937 &rng, int maxpiece);
+};
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? value[i].ptr : "(null)");
+  }
+  row.push_back(std::to_string(lineno) + ":" + std::to_string(rowno));
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+int context_t::push(const std::string &doc, std::mt19937 &rng, int maxpiece) {
+  size_t off = 0;
+  while (off < doc.size()) {
+    int n = std::min(doc.size() - off, (size_t)(rng() % maxpiece + 1));
+    if (csv_push(&csv, doc.data() + off, n, this, perrow)) {
+      return -1;
+    }
+    off += n;
+  }
+  return csv_finish(&csv, this, perrow);
+}
+
+// csv_parse() reads the doc from here.
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = std::min(ctx->doc.size() - ctx->off, (size_t)bufsz);
+  memcpy(buf, ctx->doc.data() + ctx->off, len);
+  ctx->off += len;
+  return len;
+}
+
+// Parse doc with csv_parse() for the expected result.
+static std::vector<std::vector<std::string>>
+parse_whole(const std::string &doc, char esc, bool skip_header) {
+  context_t ctx{esc, skip_header};
+  ctx.doc = doc;
+  CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+  return ctx.result;
+}
+
+} // namespace push1
+
+TEST_CASE("push1") {
+
+  using namespace push1;
+
+  SUBCASE("pieces") {
+    // quote as escape, and backslash as escape
+    const std::pair<const char *, char> docs[] = {
+        {"abc|\"d|e\"\"f\"|\"\"\r\n\"x\ny\"|z\n|\nlast|row", '"'},
+        {"a\\b|\"c\\\"d\\\\\"|\"e\nf\"|g\n\"\\\\\"|h\nx\ny|z", '\\'},
+    };
+    std::mt19937 rng(11);
+    for (auto [doc, esc] : docs) {
+      for (bool skip_header : {false, true}) {
+        auto expected = parse_whole(doc, esc, skip_header);
+        CHECK(expected.size() == 4u - skip_header);
+        for (int maxpiece : {1, 3, 7, 100}) {
+          context_t ctx{esc, skip_header};
+          CHECK(0 == ctx.push(doc, rng, maxpiece));
+          CHECK(ctx.result == expected);
+        }
+      }
+    }
+  }
+
+  SUBCASE("rows are delivered as they complete") {
+    context_t ctx{'"'};
+    CHECK(0 == csv_push(&ctx.csv, "a|b", 3, &ctx, perrow));
+    CHECK(ctx.result.size() == 0);
+    CHECK(0 == csv_push(&ctx.csv, "|c\nd|\"e\n", 8, &ctx, perrow));
+    CHECK(ctx.result.size() == 1);
+    CHECK(ctx.result[0] == std::vector<std::string>{"a", "b", "c", "1:1"});
+    CHECK(0 == csv_push(&ctx.csv, "f\"", 2, &ctx, perrow));
+    CHECK(ctx.result.size() == 1);
+    CHECK(0 == csv_finish(&ctx.csv, &ctx, perrow));
+    CHECK(ctx.result.size() == 2);
+    CHECK(ctx.result[1] == std::vector<std::string>{"d", "e\nf", "3:2"});
+  }
+
+  SUBCASE("long row grows the buffer") {
+    std::string doc = "a|\"";
+    for (int i = 0; i < 10000; i++) {
+      doc += "xy\"\"z\n";
+    }
+    doc += "\"|b\nc\n";
+    std::mt19937 rng(12);
+    for (char esc : {'"', '\\'}) {
+      auto expected = parse_whole(doc, esc, false);
+      context_t ctx{esc, false, 64};
+      CHECK(0 == ctx.push(doc, rng, 500));
+      CHECK(ctx.result == expected);
+    }
+  }
+
+  SUBCASE("errors") {
+    {
+      context_t ctx{'"'};
+      CHECK(0 == csv_push(&ctx.csv, "a|\"b\n", 5, &ctx, perrow));
+      CHECK(-1 == csv_finish(&ctx.csv, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "unterminated quote"));
+    }
+    {
+      context_t ctx{'"'};
+      CHECK(0 == csv_push(&ctx.csv, "a\n", 2, &ctx, perrow));
+      CHECK(0 == csv_finish(&ctx.csv, &ctx, perrow));
+      CHECK(-1 == csv_push(&ctx.csv, "b\n", 2, &ctx, perrow));
+      CHECK(ctx.result.size() == 1);
+    }
+    {
+      // each reason is told apart
+      context_t ctx{'"'};
+      CHECK(0 == csv_parse_mem(&ctx.csv, "a\n", 2, &ctx, perrow));
+      CHECK(-1 == csv_push(&ctx.csv, "b\n", 2, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "mapping or memory"));
+      CHECK(0 == csv_reset(&ctx.csv));
+      CHECK(0 == csv_parse_mem(&ctx.csv, "a\n", 2, &ctx, perrow));
+      CHECK(-1 == csv_finish(&ctx.csv, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "csv_finish() cannot continue"));
+      CHECK(0 == csv_reset(&ctx.csv));
+
+      FILE *fp = tmpfile();
+      REQUIRE(fp);
+      fputs("a\n", fp);
+      rewind(fp);
+      CHECK(0 == csv_parse_file(&ctx.csv, fp, &ctx, perrow));
+      CHECK(-1 == csv_push(&ctx.csv, "b\n", 2, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "parse of a FILE")); // owns fp
+      CHECK(0 == csv_reset(&ctx.csv));
+
+      CHECK(0 == csv_finish(&ctx.csv, &ctx, perrow));
+      CHECK(-1 == csv_push(&ctx.csv, "b\n", 2, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "not at EOF"));
+      CHECK(0 == csv_reset(&ctx.csv));
+      CHECK(-1 == csv_push(&ctx.csv, "b\n", -1, &ctx, perrow));
+      CHECK(strstr(ctx.csv.errmsg, "negative"));
+    }
+  }
+}
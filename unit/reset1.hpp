@@ -0,0 +1,210 @@
+#pragma once
+
+#include "alloc1.hpp"
+
+using namespace std;
+
+namespace reset1 {
+
+using alloc1::arena_t;
+using alloc1::feeder_t;
+using alloc1::result_t;
+
+static string make_doc(int nrow) {
+  string doc;
+  for (int i = 0; i < nrow; i++) {
+    doc += to_string(i) + ",\"a\"\"b\",\"x\ny\"," + string(i % 70, 'z') +
+           "\n";
+  }
+  return doc;
+}
+
+// Parse doc with csv_parse() on an open handle.
+static int parse(csv_t *csv, const string &doc, result_t *result) {
+  feeder_t f;
+  f.doc = doc;
+  int ret = csv_parse(csv, &f, feeder_t::feed, alloc1::perrow);
+  *result = std::move(f.result);
+  return ret;
+}
+
+} // namespace reset1
+
+TEST_CASE("reset1") {
+  using namespace reset1;
+  const string doc = make_doc(300);
+  result_t want;
+  {
+    csv_t csv = csv_open(0);
+    REQUIRE(0 == parse(&csv, doc, &want));
+    csv_close(&csv);
+  }
+
+  SUBCASE("no allocation after warm-up") {
+    for (char esc : {'"', '\\'}) {
+      arena_t arena;
+      csv_config_t conf = arena.config();
+      conf.esc = esc;
+      csv_t csv = csv_open(&conf);
+      csvx_t *cb = (csvx_t *)csv.__internal;
+      result_t want;
+      REQUIRE(0 == parse(&csv, doc, &want));
+      result_t result;
+      const int64_t nalloc = arena.nalloc;
+      const char *buf = cb->buf.ptr;
+      for (int i = 0; i < 5; i++) {
+        CHECK(0 == csv_reset(&csv));
+        CHECK(cb->buf.ptr == buf);
+        CHECK(0 == parse(&csv, doc, &result));
+        CHECK(result == want);
+        CHECK(arena.nalloc == nalloc);
+      }
+      csv_close(&csv);
+      CHECK(arena.live.empty());
+    }
+  }
+
+  SUBCASE("batch and select") {
+    const int sel[] = {2, 0};
+    csv_config_t conf = csv_default_config();
+    conf.select = sel;
+    conf.nselect = 2;
+    conf.batchsz = 7;
+    csv_t csv = csv_open(&conf);
+    result_t first;
+    for (int i = 0; i < 3; i++) {
+      feeder_t f;
+      f.doc = doc;
+      CHECK(0 == csv_parse_batch(&csv, &f.result, feeder_t::feed,
+                                 alloc1::perbatch));
+      CHECK(f.result.size() == want.size());
+      if (i == 0) {
+        first = f.result;
+      }
+      CHECK(f.result == first);
+      CHECK(0 == csv_reset(&csv));
+    }
+    csv_close(&csv);
+  }
+
+  SUBCASE("after an error") {
+    csv_t csv = csv_open(0);
+    result_t result;
+    CHECK(-1 == parse(&csv, "a,\"b\n", &result));
+    CHECK(!csv.ok);
+    // a parse in the middle of a row
+    CHECK(0 == csv_reset(&csv));
+    CHECK(csv.ok);
+    CHECK(csv.errmsg[0] == 0);
+    CHECK(0 == parse(&csv, doc, &result));
+    CHECK(result == want);
+    csv_close(&csv);
+  }
+
+  SUBCASE("other parses") {
+    // Each of these requires a new handle, which csv_reset() gives.
+    csv_t csv = csv_open(0);
+    result_t result;
+    CHECK(0 == parse(&csv, doc, &result));
+    CHECK(-1 == csv_parse_mem(&csv, doc.data(), doc.size(), &result,
+                              alloc1::perrow));
+    CHECK(0 == csv_reset(&csv));
+
+    result.clear();
+    string tail = doc + "last,row";
+    CHECK(0 == csv_parse_mem(&csv, tail.data(), tail.size(), &result,
+                             alloc1::perrow));
+    CHECK(result.size() == want.size() + 1);
+    CHECK(0 == csv_reset(&csv));
+
+    char path[] = "/tmp/reset1_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE((ssize_t)doc.size() == write(fd, doc.data(), doc.size()));
+    close(fd);
+    for (int i = 0; i < 2; i++) {
+      result.clear();
+      CHECK(0 == csv_parse_mmap(&csv, path, &result, alloc1::perrow));
+      CHECK(result == want);
+      CHECK(0 == csv_reset(&csv));
+      result.clear();
+      CHECK(0 == csv_parse_file_ex(&csv, path, &result, alloc1::perrow));
+      CHECK(result == want);
+      CHECK(0 == csv_reset(&csv));
+    }
+    unlink(path);
+
+    // push, then push again after a reset
+    for (int i = 0; i < 2; i++) {
+      result.clear();
+      CHECK(0 == csv_push(&csv, doc.data(), 100, &result, alloc1::perrow));
+      CHECK(0 == csv_push(&csv, doc.data() + 100, doc.size() - 100, &result,
+                          alloc1::perrow));
+      CHECK(0 == csv_finish(&csv, &result, alloc1::perrow));
+      CHECK(result == want);
+      CHECK(0 == csv_reset(&csv));
+    }
+    csv_close(&csv);
+  }
+
+  SUBCASE("failed open") {
+    const int sel[] = {-1};
+    csv_config_t conf = csv_default_config();
+    conf.select = sel;
+    conf.nselect = 1;
+    csv_t csv = csv_open(&conf);
+    CHECK(!csv.ok);
+    CHECK(-1 == csv_reset(&csv));
+    CHECK(!csv.ok);
+    CHECK(string(csv.errmsg).find("invalid column") != string::npos);
+    csv_close(&csv);
+  }
+
+  SUBCASE("c++") {
+    struct counter_t : std::pmr::memory_resource {
+      int64_t ncall = 0;
+      void *do_allocate(size_t size, size_t align) override {
+        ncall++;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+      }
+      void do_deallocate(void *p, size_t size, size_t align) override {
+        std::pmr::new_delete_resource()->deallocate(p, size, align);
+      }
+      bool do_is_equal(const memory_resource &o) const noexcept override {
+        return this == &o;
+      }
+    } counter;
+    struct parser_t : csv_parser_t {
+      using csv_parser_t::csv_parser_t;
+      feeder_t f;
+      static int feed(void *ctx, char *buf, int bufsz, char *errbuf,
+                      int errsz) {
+        return feeder_t::feed(&((parser_t *)ctx)->f, buf, bufsz, errbuf,
+                              errsz);
+      }
+      static int perrow(void *ctx, int n, csv_value_t value[], int64_t,
+                        int64_t, char *, int) {
+        return alloc1::perrow(&((parser_t *)ctx)->f.result, n, value, 0, 0,
+                              0, 0);
+      }
+      bool run(const string &doc) {
+        f = feeder_t();
+        f.doc = doc;
+        return parse(feed, perrow);
+      }
+    };
+    parser_t p(&counter);
+    CHECK(p.run(doc));
+    CHECK(p.f.result == want);
+    const int64_t ncall = counter.ncall;
+    CHECK(p.run(doc));
+    CHECK(p.f.result == want);
+    CHECK(counter.ncall == ncall); // nothing allocated
+
+    // a change of config opens the handle again
+    p.set_delim('|');
+    CHECK(p.run("a|b\n"));
+    CHECK(p.f.result == result_t{{"a", "b"}});
+    CHECK(counter.ncall > ncall);
+  }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace resume1 {
+
+// A kernel that counts the bytes it classifies.
+static int64_t nscanned = 0;
+static const scan_kernel_t *base_kernel = scan_kernel(CSV_KERNEL_SSE2);
+
+static uint64_t match(const char *p, int64_t len, const char *accept, int n) {
+  nscanned += len;
+  return base_kernel->match(p, len, accept, n);
+}
+
+static int index(const char *buf, int *off, int end, char qte, char delim,
+                 uint64_t *inquote, uint32_t *out, int max) {
+  int start = *off;
+  int n = base_kernel->index(buf, off, end, qte, delim, inquote, out, max);
+  nscanned += *off - start;
+  return n;
+}
+
+static const scan_kernel_t COUNTING = {
+    CSV_KERNEL_SSE2, "counting", match,     index,
+    count_sse2,      unquote_sse2, int64_sse2};
+
+struct context_t {
+  csv_t csv;
+  std::string doc;
+  size_t off = 0;
+  int chunk;
+  std::vector<std::vector<std::string>> result;
+  context_t(std::string doc_, int chunk_, char esc, bool indexed = true,
+            int initbufsz = 0)
+      : doc(doc_), chunk(chunk_) {
+    auto conf = csv_default_config();
+    conf.esc = esc;
+    conf.delim = '|';
+    if (initbufsz) {
+      conf.initbufsz = initbufsz;
+    }
+    csv = csv_open(&conf);
+    ((csvx_t *)csv.__internal)->indexed = indexed && (esc == conf.qte);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = std::min(ctx->doc.size() - ctx->off, (size_t)ctx->chunk);
+  len = std::min(len, bufsz);
+  memcpy(buf, ctx->doc.data() + ctx->off, len);
+  ctx->off += len;
+  return len;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? value[i].ptr : "(null)");
+  }
+  row.push_back(std::to_string(lineno) + ":" + std::to_string(rowno));
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+} // namespace resume1
+
+TEST_CASE("resume1") {
+
+  using namespace resume1;
+
+  SUBCASE("one byte at a time") {
+    // quote as escape, and backslash as escape
+    const std::pair<const char *, char> docs[] = {
+        {"abc|\"d|e\"\"f\"|\"\"\r\n\"x\ny\"|z\n|\n", '"'},
+        {"a\\b|\"c\\\"d\\\\\"|\"e\nf\"|g\n\"\\\\\"|h\nx\n", '\\'},
+    };
+    for (auto [doc, esc] : docs) {
+      for (bool indexed : {true, false}) {
+        context_t whole{doc, 1 << 30, esc, indexed};
+        context_t bytes{doc, 1, esc, indexed};
+        CHECK(0 == csv_parse(&whole.csv, &whole, feed, perrow));
+        CHECK(0 == csv_parse(&bytes.csv, &bytes, feed, perrow));
+        CHECK(whole.result.size() == 3);
+        CHECK(whole.result == bytes.result);
+      }
+    }
+  }
+
+  SUBCASE("ring") {
+    // Rows of all sizes wrap around buf[] at every offset.
+    std::string doc;
+    for (int i = 0; i < 20000; i++) {
+      doc += std::to_string(i) + "|\"" + std::string(i * 7 % 500, 'x') +
+             "\"\"y\n\"|z\n";
+    }
+    for (char esc : {'"', '\\'}) {
+      for (bool indexed : {true, false}) {
+        context_t whole{doc, 1 << 30, esc, indexed};
+        context_t ring{doc, 777, esc, indexed, RING_MINSZ};
+        CHECK(0 == csv_parse(&whole.csv, &whole, feed, perrow));
+        CHECK(0 == csv_parse(&ring.csv, &ring, feed, perrow));
+        CHECK(whole.result.size() == 20000);
+        CHECK(whole.result == ring.result);
+      }
+    }
+
+    // buf[] is a ring if memfd_create() is available, and it is still
+    // RING_MINSZ after all the rows above.
+    context_t ctx{doc, 777, '"', true, RING_MINSZ};
+    CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+    csvx_t *cb = (csvx_t *)ctx.csv.__internal;
+    if (cb->buf.ring) {
+      CHECK(cb->buf.max == RING_MINSZ);
+    } else {
+      MESSAGE("memfd_create() is not available; no ring");
+    }
+
+    // a small buf[] is never a ring
+    context_t small{doc, 777, '"'};
+    CHECK(0 == csv_parse(&small.csv, &small, feed, perrow));
+    cb = (csvx_t *)small.csv.__internal;
+    CHECK(!cb->buf.ring);
+    CHECK(cb->buf.max == 4096);
+    CHECK(small.result == ctx.result);
+  }
+
+  SUBCASE("ring fallback") {
+    // memfd_create() fails with EMFILE; buf[] comes from the heap.
+    std::string doc;
+    for (int i = 0; i < 20000; i++) {
+      doc += std::to_string(i) + "|\"" + std::string(i * 7 % 500, 'x') +
+             "\"\n";
+    }
+    context_t whole{doc, 1 << 30, '"'};
+    CHECK(0 == csv_parse(&whole.csv, &whole, feed, perrow));
+    context_t ctx{doc, 777, '"', true, RING_MINSZ};
+
+    // use up every fd under a low limit
+    struct rlimit old, low;
+    REQUIRE(0 == getrlimit(RLIMIT_NOFILE, &old));
+    low = old;
+    low.rlim_cur = 64;
+    REQUIRE(0 == setrlimit(RLIMIT_NOFILE, &low));
+    std::vector<int> fds;
+    for (int fd; (fd = dup(0)) >= 0;) {
+      fds.push_back(fd);
+    }
+    const int err = errno;
+    int rc = csv_parse(&ctx.csv, &ctx, feed, perrow);
+    for (int fd : fds) {
+      close(fd);
+    }
+    REQUIRE(0 == setrlimit(RLIMIT_NOFILE, &old));
+
+    CHECK(err == EMFILE);
+    CHECK(0 == rc);
+    CHECK(!((csvx_t *)ctx.csv.__internal)->buf.ring);
+    CHECK(ctx.result == whole.result);
+  }
+
+  SUBCASE("long row is scanned once") {
+    // a 1MB quoted value spanning many refills
+    std::string doc = "a|\"";
+    for (int i = 0; i < 1024 * 16; i++) {
+      doc += "{\"\"k\"\": 1,\n \"\"v\"\": [1, 2, 3, 4, 5, 6, 7, 8]}";
+    }
+    doc += "\"|b\n";
+    for (char esc : {'"', '\\'}) {
+      for (bool indexed : {true, false}) {
+        context_t ctx{doc, 1000, esc, indexed};
+        csvx_t *cb = (csvx_t *)ctx.csv.__internal;
+        cb->kernel = &COUNTING;
+        cb->scan_row.kernel = cb->scan_unquote.kernel = &COUNTING;
+        cb->conf.unquote_values = false;
+        nscanned = 0;
+        CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+        CHECK(ctx.result.size() == 1);
+        CHECK(ctx.result[0].size() == 4);
+        CHECK(nscanned >= (int64_t)doc.size());
+        CHECK(nscanned < (int64_t)doc.size() * 11 / 10);
+      }
+    }
+  }
+}
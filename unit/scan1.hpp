@@ -9,7 +9,7 @@ TEST_CASE("scan1") {
   accept[1] = '\\';
   accept[2] = '|';
   accept[3] = '\n';
-  scan_t scan = scan_init(accept);
+  scan_t scan = scan_init(accept, scan_kernel(CSV_KERNEL_AUTO));
 
   SUBCASE("simple") {
 
@@ -62,6 +62,18 @@ TEST_CASE("scan1") {
     CHECK(nullptr == scan_next(&scan));
   }
 
+  SUBCASE("special char at the tail") {
+    // exercise the partial block at the end of the scan
+    char buf[200];
+    for (int len = 1; len < (int)sizeof(buf); len++) {
+      memset(buf, 'x', len);
+      buf[len - 1] = '|';
+      scan_reset(&scan, buf, len);
+      CHECK(scan_next(&scan) == buf + len - 1);
+      CHECK(nullptr == scan_next(&scan));
+    }
+  }
+
   SUBCASE("random") {
     char buf[1025];
     memset(buf, 'x', sizeof(buf));
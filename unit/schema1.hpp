@@ -0,0 +1,306 @@
+#pragma once
+
+#include "../src/csv.hpp"
+#include <ctime>
+
+using namespace std;
+
+namespace schema1 {
+
+// Row r of a column: the decoded value, or "null" or "error".
+static string typed(csv_type_t type, const csv_column_t &col, int r) {
+  if (type == CSV_TYPE_TEXT) {
+    CHECK(!col.flag);
+    return col.ptr[r] ? string(col.ptr[r], col.len[r]) : "(null)";
+  }
+  if (col.flag[r] & CSV_FLAG_NULL) {
+    return "null";
+  }
+  if (col.flag[r] & CSV_FLAG_ERROR) {
+    return "error";
+  }
+  char s[40];
+  switch (type) {
+  case CSV_TYPE_DOUBLE:
+    snprintf(s, sizeof(s), "%.17g", col.f64[r]);
+    break;
+  case CSV_TYPE_BOOL:
+    snprintf(s, sizeof(s), "%s", col.b[r] ? "true" : "false");
+    break;
+  case CSV_TYPE_DATE:
+    snprintf(s, sizeof(s), "%d", (int)col.date[r]);
+    break;
+  default:
+    snprintf(s, sizeof(s), "%" PRId64, col.i64[r]);
+    break;
+  }
+  return s;
+}
+
+struct context_t {
+  vector<csv_type_t> schema;
+  vector<vector<string>> result;
+  const char *p = 0; // the rest of the doc to feed
+
+  // Feed 5 bytes at a time.
+  static int feed(void *ctx, char *buf, int bufsz, char *, int) {
+    context_t *c = (context_t *)ctx;
+    int len = std::min<int>(strlen(c->p), std::min(bufsz, 5));
+    memcpy(buf, c->p, len);
+    c->p += len;
+    return len;
+  }
+};
+
+// The text of the values; perrow() gets no decoded values.
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t, int64_t,
+                  char *, int) {
+  context_t *ctx = (context_t *)ctx_;
+  vector<string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? string(value[i].ptr, value[i].len)
+                               : "(null)");
+  }
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+static int perbatch(void *ctx_, const csv_batch_t *batch, char *, int) {
+  context_t *ctx = (context_t *)ctx_;
+  for (int r = 0; r < batch->nrow; r++) {
+    vector<string> row;
+    for (int c = 0; c < batch->ncol; c++) {
+      csv_type_t type =
+          c < (int)ctx->schema.size() ? ctx->schema[c] : CSV_TYPE_TEXT;
+      row.push_back(typed(type, batch->column[c], r));
+    }
+    ctx->result.push_back(std::move(row));
+  }
+  return 0;
+}
+
+enum api_t { PARSE, BATCH, MEM };
+
+// Parse doc with the schema, and return the decoded rows.
+static vector<vector<string>>
+parse(const string &doc, vector<csv_type_t> schema, api_t mode = PARSE,
+      csv_config_t conf = csv_default_config()) {
+  context_t ctx;
+  ctx.schema = schema;
+  ctx.p = doc.c_str();
+  conf.schema = schema.data();
+  conf.nschema = schema.size();
+  conf.batchsz = 3;
+  csv_t csv = csv_open(&conf);
+  REQUIRE(csv.ok);
+  int ret = -1;
+  switch (mode) {
+  case PARSE:
+    ret = csv_parse(&csv, &ctx, context_t::feed, perrow);
+    break;
+  case BATCH:
+    ret = csv_parse_batch(&csv, &ctx, context_t::feed, perbatch);
+    break;
+  case MEM:
+    ret = csv_parse_mem(&csv, doc.data(), doc.size(), &ctx, perrow);
+    break;
+  }
+  CHECK(ret == 0);
+  csv_close(&csv);
+  return ctx.result;
+}
+
+// Decode a single value of the given type.
+static string one(csv_type_t type, const string &s) {
+  string doc = s + "\n";
+  auto b = parse(doc, {type}, BATCH);
+  // perrow() gets the text as without a schema
+  CHECK(parse(doc, {type}) == parse(doc, {}));
+  REQUIRE(b.size() == 1);
+  REQUIRE(b[0].size() == 1);
+  return b[0][0];
+}
+
+// Days since 1970-01-01 by timegm().
+static int days(int y, int m, int d) {
+  struct tm tm = {};
+  tm.tm_year = y - 1900;
+  tm.tm_mon = m - 1;
+  tm.tm_mday = d;
+  return timegm(&tm) / 86400;
+}
+
+} // namespace schema1
+
+TEST_CASE("schema1") {
+  using namespace schema1;
+
+  SUBCASE("int64") {
+    CHECK(one(CSV_TYPE_INT64, "0") == "0");
+    CHECK(one(CSV_TYPE_INT64, "-0") == "0");
+    CHECK(one(CSV_TYPE_INT64, "+17") == "17");
+    CHECK(one(CSV_TYPE_INT64, "\"-42\"") == "-42");
+    CHECK(one(CSV_TYPE_INT64, "9223372036854775807") ==
+          "9223372036854775807");
+    CHECK(one(CSV_TYPE_INT64, "-9223372036854775808") ==
+          "-9223372036854775808");
+    CHECK(one(CSV_TYPE_INT64, "9223372036854775808") == "error");
+    CHECK(one(CSV_TYPE_INT64, "-9223372036854775809") == "error");
+    CHECK(one(CSV_TYPE_INT64, "99999999999999999999") == "error");
+    CHECK(one(CSV_TYPE_INT64, "") == "null");
+    CHECK(one(CSV_TYPE_INT64, "\"\"") == "error");
+    for (const char *s : {"-", "+", "1a", " 1", "1 ", "1.0", "0x1"}) {
+      CHECK(one(CSV_TYPE_INT64, s) == "error");
+    }
+  }
+
+  SUBCASE("double") {
+    CHECK(one(CSV_TYPE_DOUBLE, "1.5") == "1.5");
+    CHECK(one(CSV_TYPE_DOUBLE, "-2e10") == "-20000000000");
+    CHECK(one(CSV_TYPE_DOUBLE, ".25") == "0.25");
+    CHECK(one(CSV_TYPE_DOUBLE, "0.1") == "0.10000000000000001");
+    CHECK(one(CSV_TYPE_DOUBLE, "") == "null");
+    for (const char *s : {"abc", " 1", "1 ", "1e", "--1"}) {
+      CHECK(one(CSV_TYPE_DOUBLE, s) == "error");
+    }
+  }
+
+  SUBCASE("bool") {
+    for (const char *s :
+         {"true", "TRUE", "True", "yes", "on", "t", "Y", "1"}) {
+      CHECK(one(CSV_TYPE_BOOL, s) == "true");
+    }
+    for (const char *s : {"false", "No", "OFF", "f", "n", "0"}) {
+      CHECK(one(CSV_TYPE_BOOL, s) == "false");
+    }
+    for (const char *s : {"tru", "yess", "2", "-1", "nope"}) {
+      CHECK(one(CSV_TYPE_BOOL, s) == "error");
+    }
+  }
+
+  SUBCASE("date") {
+    CHECK(one(CSV_TYPE_DATE, "1970-01-01") == "0");
+    CHECK(one(CSV_TYPE_DATE, "1969-12-31") == "-1");
+    CHECK(one(CSV_TYPE_DATE, "2000-03-01") == "11017");
+    CHECK(one(CSV_TYPE_DATE, "0000-03-01") == "-719468");
+    CHECK(one(CSV_TYPE_DATE, "0000-02-29") == "-719469");
+    CHECK(one(CSV_TYPE_DATE, "2024-02-29") == to_string(days(2024, 2, 29)));
+    for (const char *s : {"2023-02-29", "2024-13-01", "2024-00-10",
+                          "2024-01-32", "2024-1-1", "2024-01-01 ",
+                          "2024/01/01"}) {
+      CHECK(one(CSV_TYPE_DATE, s) == "error");
+    }
+    // every day of some years
+    for (int y : {1900, 1968, 1999, 2000, 2024, 2100}) {
+      string doc;
+      vector<vector<string>> want;
+      for (int m = 1; m <= 12; m++) {
+        for (int d = 1; d <= 31; d++) {
+          struct tm tm = {};
+          tm.tm_year = y - 1900;
+          tm.tm_mon = m - 1;
+          tm.tm_mday = d;
+          time_t t = timegm(&tm);
+          gmtime_r(&t, &tm);
+          char s[20];
+          snprintf(s, sizeof(s), "%04d-%02d-%02d", y, m, d);
+          doc += string(s) + "\n";
+          want.push_back(
+              {tm.tm_mday == d ? to_string(days(y, m, d)) : "error"});
+        }
+      }
+      CHECK(parse(doc, {CSV_TYPE_DATE}, BATCH) == want);
+    }
+  }
+
+  SUBCASE("timestamp") {
+    CHECK(one(CSV_TYPE_TIMESTAMP, "1970-01-01 00:00:01.5") == "1500000");
+    CHECK(one(CSV_TYPE_TIMESTAMP, "1969-12-31T23:59:59") == "-1000000");
+    CHECK(one(CSV_TYPE_TIMESTAMP, "2024-02-29 12:34:56.000789") ==
+          to_string(((int64_t)days(2024, 2, 29) * 86400 + 45296) * 1000000 +
+                    789));
+    for (const char *s : {"2024-02-29", "2024-02-29 24:00:00",
+                          "2024-02-29 12:60:00", "2024-02-30 00:00:00",
+                          "2024-02-29 12:00:00+00:00"}) {
+      CHECK(one(CSV_TYPE_TIMESTAMP, s) == "error");
+    }
+  }
+
+  SUBCASE("rows") {
+    const string doc = "id,price,ok,day,name\n"
+                       "1,2.5,true,2024-01-02,abc\n"
+                       "2,,no,,\n"
+                       "x,1e3,maybe,2024-13-01,\"q,r\"\n"
+                       "3,4\n"
+                       "4,5,1,1970-01-01,z,extra\n";
+    const vector<csv_type_t> schema = {CSV_TYPE_INT64, CSV_TYPE_DOUBLE,
+                                       CSV_TYPE_BOOL, CSV_TYPE_DATE};
+    csv_config_t conf = csv_default_config();
+    conf.skip_header = true;
+    const vector<vector<string>> want = {
+        {"1", "2.5", "true", "19724", "abc"},
+        {"2", "null", "false", "null", "(null)"},
+        {"error", "1000", "error", "error", "q,r"},
+        {"3", "4"},
+        {"4", "5", "true", "0", "z", "extra"}};
+    CHECK(parse(doc, schema, BATCH, conf) == want);
+    CHECK(parse(doc, schema, PARSE, conf) == parse(doc, {}, PARSE, conf));
+    CHECK(parse(doc, schema, MEM, conf) == parse(doc, {}, MEM, conf));
+
+    // backslash escapes
+    conf.esc = '\\';
+    conf.skip_header = false;
+    const string quoted = "\"12\",\"3\\\"\",\"yes\",\"1970-01-02\"\n";
+    const vector<vector<string>> qwant = {{"12", "error", "true", "1"}};
+    CHECK(parse(quoted, schema, BATCH, conf) == qwant);
+  }
+
+  SUBCASE("select") {
+    // the schema applies to the projected values
+    const int sel[] = {2, 0};
+    csv_config_t conf = csv_default_config();
+    conf.select = sel;
+    conf.nselect = 2;
+    const string doc = "1,a,true\n2,b,x\n";
+    const vector<vector<string>> want = {{"true", "1"}, {"error", "2"}};
+    CHECK(parse(doc, {CSV_TYPE_BOOL, CSV_TYPE_INT64}, BATCH, conf) == want);
+  }
+
+  SUBCASE("open errors") {
+    csv_type_t bad[] = {CSV_TYPE_INT64, (csv_type_t)7};
+    csv_config_t conf = csv_default_config();
+    conf.schema = bad;
+    conf.nschema = 2;
+    csv_t csv = csv_open(&conf);
+    CHECK(!csv.ok);
+    CHECK(string(csv.errmsg) == "invalid type 7 in schema");
+    csv_close(&csv);
+
+    conf.nschema = 1;
+    conf.unquote_values = false;
+    csv = csv_open(&conf);
+    CHECK(!csv.ok);
+    CHECK(string(csv.errmsg) == "schema requires unquote_values");
+    csv_close(&csv);
+  }
+
+  SUBCASE("c++") {
+    struct parser_t : csv_parser_t {
+      context_t ctx;
+      static int feed(void *p, char *buf, int bufsz, char *errbuf,
+                      int errsz) {
+        return context_t::feed(&((parser_t *)p)->ctx, buf, bufsz, errbuf,
+                               errsz);
+      }
+      static int perbatch(void *p, const csv_batch_t *batch, char *errbuf,
+                          int errsz) {
+        return schema1::perbatch(&((parser_t *)p)->ctx, batch, errbuf, errsz);
+      }
+    } p;
+    p.ctx.schema = {CSV_TYPE_TEXT, CSV_TYPE_DOUBLE};
+    p.ctx.p = "a,1.25\nb,-3\n";
+    p.set_schema(p.ctx.schema);
+    CHECK(p.parse_batch(parser_t::feed, parser_t::perbatch));
+    CHECK(p.ctx.result == vector<vector<string>>{{"a", "1.25"}, {"b", "-3"}});
+  }
+}
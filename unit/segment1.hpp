@@ -0,0 +1,226 @@
+#pragma once
+
+#include <random>
+
+using namespace std;
+
+namespace segment1 {
+
+struct context_t {
+  csv_t csv;
+  std::vector<std::vector<std::string>> result;
+  std::vector<std::string> segs; // the input, one segment each
+  size_t next = 0;               // segs[next] is fed next
+  std::vector<char *> held;      // segments not yet released, in order
+  int nreleased = 0;
+  int ninplace = 0; // #values that point into a held segment
+  int failat = -1;  // feed() fails at this segment
+  context_t(char esc = '"', bool skip_header = false, int maxbufsz = 0) {
+    auto conf = csv_default_config();
+    conf.esc = esc;
+    conf.skip_header = skip_header;
+    if (maxbufsz) {
+      conf.maxbufsz = maxbufsz;
+    }
+    csv = csv_open(&conf);
+  }
+  ~context_t() {
+    csv_close(&csv);
+    for (char *p : held) {
+      free(p);
+    }
+  }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+// Hand over a copy of segs[next] in memory of its own.
+static int feed(void *ctx_, const char **ptr, int64_t *len, char *errbuf,
+                int errsz) {
+  context_t *ctx = (context_t *)ctx_;
+  if ((int)ctx->next == ctx->failat) {
+    snprintf(errbuf, errsz, "%s", "feed failed");
+    return -1;
+  }
+  if (ctx->next == ctx->segs.size()) {
+    return 0;
+  }
+  const std::string &s = ctx->segs[ctx->next++];
+  char *p = (char *)malloc(s.size() + 1);
+  memcpy(p, s.data(), s.size());
+  ctx->held.push_back(p);
+  *ptr = p;
+  *len = s.size();
+  return 1;
+}
+
+static void release(void *ctx_, const char *ptr, int64_t len) {
+  context_t *ctx = (context_t *)ctx_;
+  // released in order, once each
+  REQUIRE(!ctx->held.empty());
+  CHECK(ctx->held.front() == ptr);
+  CHECK(ctx->segs[ctx->nreleased].size() == (size_t)len);
+  // scribble over it to catch a use after release
+  memset(ctx->held.front(), '#', len);
+  free(ctx->held.front());
+  ctx->held.erase(ctx->held.begin());
+  ctx->nreleased++;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  std::vector<std::string> row;
+  for (int i = 0; i < n; i++) {
+    const char *p = value[i].ptr;
+    row.push_back(p ? std::string(p, value[i].len) : "(null)");
+    const std::string &s = ctx->segs[ctx->nreleased];
+    const char *seg = ctx->held.empty() ? 0 : ctx->held.front();
+    if (p && seg && seg <= p && p + value[i].len <= seg + s.size()) {
+      ctx->ninplace++;
+    }
+  }
+  row.push_back(std::to_string(lineno) + ":" + std::to_string(rowno));
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+// Parse doc with csv_parse_segments() using a single segment.
+static std::vector<std::vector<std::string>>
+parse_whole(const std::string &doc, char esc, bool skip_header) {
+  context_t ctx{esc, skip_header};
+  ctx.segs.push_back(doc);
+  CHECK(0 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+  return ctx.result;
+}
+
+// Split doc into segments of random sizes up to maxseg.
+static std::vector<std::string> split(const std::string &doc,
+                                      std::mt19937 &rng, int maxseg) {
+  std::vector<std::string> segs;
+  for (size_t off = 0; off < doc.size();) {
+    size_t n = std::min(doc.size() - off, (size_t)(rng() % maxseg + 1));
+    segs.push_back(doc.substr(off, n));
+    off += n;
+  }
+  return segs;
+}
+
+} // namespace segment1
+
+TEST_CASE("segment1") {
+
+  using namespace segment1;
+
+  SUBCASE("basic") {
+    context_t ctx;
+    ctx.segs = {"abc,\"d,e", "\"\"f\",\r", "\n\"x\ny\",z\nla", "st"};
+    CHECK(0 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+    REQUIRE(ctx.result.size() == 3);
+    CHECK(ctx.result[0] ==
+          std::vector<std::string>{"abc", "d,e\"f", "(null)", "1:1"});
+    CHECK(ctx.result[1] == std::vector<std::string>{"x\ny", "z", "3:2"});
+    CHECK(ctx.result[2] == std::vector<std::string>{"last", "4:3"});
+    CHECK(ctx.nreleased == 4);
+  }
+
+  SUBCASE("same as csv_parse") {
+    std::mt19937 rng(16);
+    std::string docs[2];
+    for (int i = 0; i < 2000; i++) {
+      std::string v = std::string(rng() % 20, 'x');
+      docs[0] += std::to_string(i) + ",\"a\"\"b\n\"," + v + "\n";
+      docs[1] += std::to_string(i) + ",\"a\\\"b\n\\\\\"," + v + "\n";
+    }
+    docs[0] += "last,row";
+    for (int k = 0; k < 2; k++) {
+      char esc = k ? '\\' : '"';
+      for (bool skip_header : {false, true}) {
+        // csv_parse() for the expected result
+        std::vector<std::vector<std::string>> expected;
+        {
+          context_t ref{esc, skip_header};
+          ref.segs = {docs[k]};
+          REQUIRE(0 == csv_parse_segments(&ref.csv, &ref, feed, release,
+                                          perrow));
+          expected = ref.result;
+          CHECK(ref.ninplace > 0);
+        }
+        CHECK(expected == parse_whole(docs[k], esc, skip_header));
+        CHECK(expected.size() == 2001u - k - skip_header);
+        for (int maxseg : {1, 10, 100, 5000}) {
+          context_t ctx{esc, skip_header};
+          ctx.segs = split(docs[k], rng, maxseg);
+          CHECK(0 == csv_parse_segments(&ctx.csv, &ctx, feed, release,
+                                        perrow));
+          CHECK(ctx.result == expected);
+          CHECK(ctx.nreleased == (int)ctx.segs.size());
+          if (maxseg == 5000) {
+            // most values are scanned in place
+            CHECK(ctx.ninplace > 3500);
+          }
+        }
+      }
+    }
+  }
+
+  SUBCASE("windows") {
+    // Segments larger than the window are scanned a window at a time,
+    // with the rows across windows finished in the heap.
+    std::mt19937 rng(15);
+    std::string doc;
+    for (int i = 0; i < 3000; i++) {
+      doc += std::to_string(i) + ",\"a\"\"b\n\"," +
+             std::string(rng() % 40, 'x') + "\n";
+    }
+    const auto expected = parse_whole(doc, '"', false);
+    REQUIRE(expected.size() == 3000);
+    const int64_t save = seg_window;
+    for (int64_t window : {1, 7, 64, 1000}) {
+      CAPTURE(window);
+      seg_window = window;
+      context_t ctx;
+      ctx.segs = split(doc, rng, 20000);
+      CHECK(0 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+      CHECK(ctx.result == expected);
+      CHECK(ctx.nreleased == (int)ctx.segs.size());
+      if (window == 1000) {
+        CHECK(ctx.ninplace > 0);
+      }
+    }
+    seg_window = save;
+  }
+
+  SUBCASE("errors") {
+    {
+      // the segment held is released
+      context_t ctx;
+      ctx.segs = {"a,b\n", "c,d\n", "e,f\n"};
+      ctx.failat = 2;
+      CHECK(-1 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+      CHECK(string(ctx.csv.errmsg) == "feed failed");
+      CHECK(ctx.nreleased == 2);
+      CHECK(ctx.result.size() == 2);
+    }
+    {
+      context_t ctx;
+      ctx.segs = {"a,\"b\n", "c"};
+      CHECK(-1 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+      CHECK(string(ctx.csv.errmsg).find("unterminated quote") !=
+            string::npos);
+      CHECK(ctx.nreleased == 2);
+    }
+    {
+      // a row that straddles segments is limited by maxbufsz
+      context_t ctx{'"', false, 8192};
+      ctx.segs = {"a,\"" + std::string(6000, 'x'), std::string(6000, 'y'),
+                  "\"\n"};
+      CHECK(-1 == csv_parse_segments(&ctx.csv, &ctx, feed, release, perrow));
+      CHECK(string(ctx.csv.errmsg).find("maxbufsz") != string::npos);
+    }
+  }
+}
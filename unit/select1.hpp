@@ -0,0 +1,123 @@
+#pragma once
+
+#include <random>
+
+using namespace std;
+
+namespace select1 {
+
+struct context_t {
+  csv_t csv;
+  const char *doc;
+  int chunk; // max #bytes returned per feed() call
+  vector<vector<string>> result;
+  context_t(const char *doc_, const vector<int> &select, char esc = '"',
+            int chunk_ = 1 << 30)
+      : doc(doc_), chunk(chunk_) {
+    auto conf = csv_default_config();
+    conf.esc = esc;
+    conf.initbufsz = 64;
+    conf.select = select.empty() ? nullptr : select.data();
+    conf.nselect = select.size();
+    csv = csv_open(&conf);
+  }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int feed(void *ctx_, char *buf, int bufsz, char *errbuf, int errsz) {
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  int len = strlen(ctx->doc);
+  len = std::min(len, std::min(bufsz, ctx->chunk));
+  memcpy(buf, ctx->doc, len);
+  ctx->doc += len;
+  return len;
+}
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)rowno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  vector<string> row;
+  for (int i = 0; i < n; i++) {
+    row.push_back(value[i].ptr ? value[i].ptr : "(null)");
+  }
+  ctx->result.push_back(std::move(row));
+  return 0;
+}
+
+static vector<vector<string>> parse(const char *doc, const vector<int> &select,
+                                    char esc = '"', int chunk = 1 << 30) {
+  context_t ctx(doc, select, esc, chunk);
+  CHECK(0 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+  return ctx.result;
+}
+
+} // namespace select1
+
+TEST_CASE("select1") {
+
+  using namespace select1;
+
+  SUBCASE("order and missing fields") {
+    const char *doc = "a,b,c,d\n"
+                      "e,\"f,g\",h\n"
+                      "i\n";
+    auto result = parse(doc, {2, 0, 1, 0});
+    REQUIRE(result.size() == 3);
+    CHECK(result[0] == vector<string>{"c", "a", "b", "a"});
+    CHECK(result[1] == vector<string>{"h", "e", "f,g", "e"});
+    CHECK(result[2] == vector<string>{"(null)", "i", "(null)", "i"});
+  }
+
+  SUBCASE("same as full parse") {
+    std::mt19937 rng(3);
+    const char *pieces[] = {"x", "yz", "\"p,q\"", "\"a\"\"b\"", "",
+                            "\"m\nn\"", "\"\\\\\"", "\"c\\\"d\""};
+    for (int iter = 0; iter < 20; iter++) {
+      string doc;
+      for (int i = 0; i < 100; i++) {
+        int n = rng() % 8 + 1;
+        for (int j = 0; j < n; j++) {
+          doc += j ? "," : "";
+          // escaped quotes only match the escape char in use
+          doc += pieces[rng() % (iter % 2 ? 8 : 6)];
+        }
+        doc += "\n";
+      }
+      char esc = iter % 2 ? '\\' : '"';
+      vector<int> select = {(int)(rng() % 8), (int)(rng() % 8), 5};
+      auto full = parse(doc.c_str(), {}, esc);
+      for (auto &row : full) {
+        vector<string> p;
+        for (int c : select) {
+          p.push_back(c < (int)row.size() ? row[c] : "(null)");
+        }
+        row = p;
+      }
+      for (int chunk : {1, 5, 1 << 30}) {
+        CHECK(parse(doc.c_str(), select, esc, chunk) == full);
+      }
+    }
+  }
+
+  SUBCASE("error reports the field") {
+    context_t ctx("a,b,c,\"d", {0});
+    CHECK(-1 == csv_parse(&ctx.csv, &ctx, feed, perrow));
+    CHECK(string(ctx.csv.errmsg).find("col 4") != string::npos);
+  }
+
+  SUBCASE("invalid column") {
+    context_t ctx("a\n", {1, -1});
+    CHECK(!ctx.csv.ok);
+    CHECK(string(ctx.csv.errmsg) == "invalid column -1 in select");
+  }
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+
+using namespace std;
+namespace unframe1 {
+
+using parallel1::PATH;
+using parallel1::result_t;
+
+static void put_le16(string &s, uint32_t x) {
+  s += (char)(x & 0xff);
+  s += (char)(x >> 8 & 0xff);
+}
+
+static void put_le32(string &s, uint32_t x) {
+  put_le16(s, x & 0xffff);
+  put_le16(s, x >> 16);
+}
+
+#ifdef CSV_HAVE_ZLIB
+// One BGZF member holding s.
+static string bgzf_member(const string &s) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // -15: raw deflate; the gzip header is written below
+  REQUIRE(Z_OK == deflateInit2(&zs, 6, Z_DEFLATED, -15, 8,
+                               Z_DEFAULT_STRATEGY));
+  string data(deflateBound(&zs, s.size()), '\0');
+  zs.next_in = (Bytef *)s.data();
+  zs.avail_in = s.size();
+  zs.next_out = (Bytef *)data.data();
+  zs.avail_out = data.size();
+  REQUIRE(Z_STREAM_END == deflate(&zs, Z_FINISH));
+  data.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  string out = string("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+  put_le16(out, 6); // XLEN
+  out += "BC";
+  put_le16(out, 2);
+  put_le16(out, 18 + data.size() + 8 - 1); // BSIZE
+  out += data;
+  put_le32(out, crc32(0, (const Bytef *)s.data(), s.size()));
+  put_le32(out, s.size());
+  return out;
+}
+
+// s in BGZF, with the empty member at the end.
+static string bgzf(const string &s, int *nmember = 0) {
+  string out;
+  int n = 0;
+  for (size_t off = 0; off < s.size(); off += 65280, n++) {
+    out += bgzf_member(s.substr(off, 65280));
+  }
+  out += bgzf_member("");
+  if (nmember) {
+    *nmember = n + 1;
+  }
+  return out;
+}
+#endif
+
+// A seekable zstd file of the given frames, each of which decodes to
+// outlen[i] bytes.
+static string seekable(const vector<string> &frame,
+                       const vector<uint32_t> &outlen) {
+  string out;
+  for (auto &f : frame) {
+    out += f;
+  }
+  string tab;
+  for (size_t i = 0; i < frame.size(); i++) {
+    put_le32(tab, frame[i].size());
+    put_le32(tab, outlen[i]);
+  }
+  put_le32(tab, frame.size());
+  tab += '\0'; // no checksums
+  put_le32(tab, DECODE_ZSTD_SEEKABLE);
+  put_le32(out, DECODE_ZSTD_SKIPPABLE);
+  put_le32(out, tab.size());
+  return out + tab;
+}
+
+// Parse PATH on nthread threads in batches of about nthread frames.
+// The rows of a context come from every batch; put them back in order.
+static int parse_batched(const csv_config_t &conf, int nthread,
+                         result_t &ret, string *errmsg = 0) {
+  const int64_t save = unframe_batch;
+  unframe_batch = 1;
+  result_t all;
+  int rc = parallel1::parse(conf, nthread, all, errmsg);
+  unframe_batch = save;
+  vector<size_t> idx(all.rows.size());
+  for (size_t i = 0; i < idx.size(); i++) {
+    idx[i] = i;
+  }
+  sort(idx.begin(), idx.end(),
+       [&](size_t a, size_t b) { return all.rowno[a] < all.rowno[b]; });
+  for (size_t i : idx) {
+    ret.rows.push_back(all.rows[i]);
+    ret.lineno.push_back(all.lineno[i]);
+    ret.rowno.push_back(all.rowno[i]);
+  }
+  return rc;
+}
+
+static string parse_serial(const csv_config_t &conf, result_t &ret) {
+  csv_t csv = csv_open(&conf);
+  csv_parse_file_ex(&csv, PATH, &ret, parallel1::perrow);
+  string errmsg = csv.errmsg;
+  csv_close(&csv);
+  return errmsg;
+}
+
+} // namespace unframe1
+
+TEST_CASE("unframe1") {
+
+  using namespace unframe1;
+
+  const string doc = parallel1::make_doc('"');
+  const csv_config_t conf = csv_default_config();
+  result_t expect;
+  std::ofstream(PATH, std::ios::binary) << doc;
+  REQUIRE(0 == parallel1::parse(conf, 1, expect));
+
+#ifdef CSV_HAVE_ZLIB
+  SUBCASE("bgzf") {
+    int nmember;
+    const string gz = bgzf(doc, &nmember);
+    {
+      int kind;
+      REQUIRE(nmember == decode_frames(gz.data(), gz.size(), &kind, 0));
+      vector<decode_frame_t> frame(nmember);
+      CHECK(nmember == decode_frames(gz.data(), gz.size(), &kind,
+                                     frame.data()));
+      CHECK(kind == DECODE_GZIP);
+      CHECK(frame[1].outoff == 65280);
+      CHECK(frame[nmember - 1].outlen == 0);
+    }
+
+    std::ofstream(PATH, std::ios::binary) << gz;
+    for (int nthread : {1, 3, 8}) {
+      result_t result;
+      CHECK(0 == parallel1::parse(conf, nthread, result));
+      CHECK(result == expect);
+    }
+    // Rows and quoted values that span frames and batches; some values
+    // are longer than a batch.
+    for (int nthread : {1, 2, 5}) {
+      result_t result;
+      CHECK(0 == parse_batched(conf, nthread, result));
+      CHECK(result == expect);
+    }
+    {
+      csv_config_t hdr = conf;
+      hdr.skip_header = true;
+      result_t want, result;
+      std::ofstream(PATH, std::ios::binary) << doc;
+      REQUIRE(0 == parallel1::parse(hdr, 1, want));
+      std::ofstream(PATH, std::ios::binary) << gz;
+      CHECK(0 == parse_batched(hdr, 3, result));
+      CHECK(result == want);
+    }
+
+    {
+      // perrow fails in the middle, while the next batch decodes
+      static std::atomic<int> nrow;
+      static int limit;
+      nrow = 0;
+      limit = expect.rows.size() / 2;
+      const int64_t save = unframe_batch;
+      unframe_batch = 1;
+      csv_t csv = csv_open(&conf);
+      void *context[2] = {0, 0};
+      CHECK(-1 == csv_parse_parallel(
+                      &csv, PATH, 2, context,
+                      [](void *, int, csv_value_t[], int64_t, int64_t,
+                         char *errbuf, int errsz) {
+                        if (++nrow < limit) {
+                          return 0;
+                        }
+                        snprintf(errbuf, errsz, "%s", "stop");
+                        return -1;
+                      }));
+      unframe_batch = save;
+      CHECK(string(csv.errmsg) == "stop");
+      csv_close(&csv);
+
+      // and the other chunks of its batch stop too
+      unframe_batch = 1;
+      int64_t ndone;
+      string errmsg;
+      CHECK(parallel1::late_rows(conf, 3, limit, &ndone, &errmsg) <= 2);
+      unframe_batch = save;
+      CHECK(ndone < (int64_t)expect.rows.size());
+      CHECK(errmsg == "row " + to_string(limit) + " failed");
+    }
+
+    // a serial parse reads it as concatenated gzip members
+    result_t result;
+    CHECK(parse_serial(conf, result) == "");
+    CHECK(result == expect);
+
+    // a bad member
+    string bad = gz;
+    bad[65280 * 3 / 2] ^= 0x55;
+    std::ofstream(PATH, std::ios::binary) << bad;
+    string errmsg;
+    CHECK(-1 == parallel1::parse(conf, 4, result, &errmsg));
+    CHECK(errmsg == "corrupt gzip input");
+    errmsg.clear();
+    CHECK(-1 == parse_batched(conf, 2, result, &errmsg));
+    CHECK(errmsg == "corrupt gzip input");
+  }
+
+  SUBCASE("plain gzip") {
+    // not blocked; parsed serially
+    std::ofstream(PATH, std::ios::binary) << decode1::gzip(doc);
+    result_t result;
+    CHECK(0 == parallel1::parse(conf, 4, result));
+    CHECK(result == expect);
+  }
+#endif
+
+  SUBCASE("zstd seek table") {
+    const string zmagic = "\x28\xb5\x2f\xfd";
+    const string z = seekable({zmagic + "abc", zmagic + "defgh", zmagic},
+                              {100, 0, 7});
+    int kind;
+    REQUIRE(3 == decode_frames(z.data(), z.size(), &kind, 0));
+    vector<decode_frame_t> frame(3);
+    CHECK(3 == decode_frames(z.data(), z.size(), &kind, frame.data()));
+    CHECK(kind == DECODE_ZSTD);
+    CHECK(frame[1].inoff == 7);
+    CHECK(frame[1].inlen == 9);
+    CHECK(frame[2].outoff == 100);
+    CHECK(frame[2].outlen == 7);
+
+    // a seek table that does not add up is ignored
+    string bad = z;
+    bad[z.size() - 17 - 8] ^= 1;
+    CHECK(0 == decode_frames(bad.data(), bad.size(), &kind, 0));
+
+#ifndef CSV_HAVE_ZSTD
+    std::ofstream(PATH, std::ios::binary) << z;
+    result_t result;
+    string errmsg;
+    CHECK(-1 == parallel1::parse(conf, 4, result, &errmsg));
+    CHECK(errmsg == "zstd input requires libzstd");
+#endif
+  }
+
+#ifdef CSV_HAVE_ZSTD
+  SUBCASE("zstd seekable") {
+    vector<string> frame;
+    vector<uint32_t> outlen;
+    for (size_t off = 0; off < doc.size(); off += 100000) {
+      string piece = doc.substr(off, 100000);
+      frame.push_back(decode1::zstd(piece));
+      outlen.push_back(piece.size());
+    }
+    std::ofstream(PATH, std::ios::binary) << seekable(frame, outlen);
+    for (int nthread : {1, 3, 8}) {
+      result_t result;
+      CHECK(0 == parallel1::parse(conf, nthread, result));
+      CHECK(result == expect);
+    }
+  }
+#endif
+
+  remove(PATH);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <random>
+
 using namespace std;
 
 static char *do_unquote(std::string s, bool quoted = true) {
@@ -11,7 +13,7 @@ static char *do_unquote(std::string s, bool quoted = true) {
     accept[i++] = (conf.esc != conf.qte ? conf.esc : 0);
     accept[i] = 0;
   }
-  scan_t scan = scan_init(accept);
+  scan_t scan = scan_init(accept, scan_kernel(CSV_KERNEL_AUTO));
   csv_value_t value;
   value.ptr = s.data();
   value.len = s.length();
@@ -20,6 +22,35 @@ static char *do_unquote(std::string s, bool quoted = true) {
   return value.ptr;
 }
 
+// Unquote s the slow way, one char at a time.
+static std::string ref_unquote(const std::string &s, char qte, char esc) {
+  std::string out;
+  bool inquote = false;
+  for (size_t i = 0; i < s.size(); i++) {
+    char c = s[i];
+    if (c == esc && inquote && i + 1 < s.size() &&
+        (s[i + 1] == esc || s[i + 1] == qte)) {
+      out += s[++i];
+    } else if (c == qte) {
+      inquote = !inquote;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+// A random string of n chars heavy with qte and esc.
+static std::string random_quoted(std::mt19937 &rng, int n, char qte,
+                                 char esc) {
+  const char chars[] = {'a', 'b', ',', '\n', qte, qte, esc};
+  std::string s;
+  for (int i = 0; i < n; i++) {
+    s += chars[rng() % sizeof(chars)];
+  }
+  return s;
+}
+
 TEST_CASE("unquote1") {
 
   // quote: "
@@ -77,6 +108,79 @@ TEST_CASE("unquote1") {
     }
   }
 
+  SUBCASE("kernels") {
+    std::mt19937 rng(9);
+    for (int iter = 0; iter < 2000; iter++) {
+      std::string raw = random_quoted(rng, rng() % 300, '"', '"');
+      std::string expected = ref_unquote(raw, '"', '"');
+      for (auto k : {CSV_KERNEL_SSE2, CSV_KERNEL_AVX2, CSV_KERNEL_AVX512BW,
+                     CSV_KERNEL_NEON}) {
+        const scan_kernel_t *kernel = scan_kernel(k);
+        if (!kernel) {
+          continue;
+        }
+        // guard bytes catch writes past the end
+        std::string buf = raw + "ZZZZZZZZ";
+        int len = kernel->unquote(buf.data(), raw.size(), '"');
+        CHECK(std::string(buf.data(), len) == expected);
+        CHECK(buf.substr(raw.size()) == "ZZZZZZZZ");
+      }
+    }
+  }
+
+  SUBCASE("backslash") {
+    csv_config_t conf = csv_default_config();
+    conf.esc = '\\';
+    scan_t scan = scan_init("\"\\", scan_kernel(CSV_KERNEL_AUTO));
+    std::mt19937 rng(10);
+    for (int iter = 0; iter < 2000; iter++) {
+      std::string raw = '"' + random_quoted(rng, rng() % 300, '"', '\\');
+      std::string expected = ref_unquote(raw, '"', '\\');
+      if (raw.size() >= 2 && raw.back() == '"' &&
+          raw.find('\\') == std::string::npos) {
+        // "xxxx" without an esc only has its outer quotes removed
+        expected = raw.substr(1, raw.size() - 2);
+      }
+      csv_value_t value;
+      value.ptr = raw.data();
+      value.len = raw.size();
+      value.quoted = true;
+      unquote(&scan, &value, &conf);
+      CHECK(std::string(value.ptr, value.len) == expected);
+    }
+  }
+
+  SUBCASE("readonly") {
+    // unquote_readonly() agrees with unquote(), and leaves raw alone
+    csv_config_t conf = csv_default_config();
+    conf.esc = '\\';
+    csv_t csv = csv_open(&conf);
+    REQUIRE(csv.ok);
+    csvx_t *cb = (csvx_t *)csv.__internal;
+    scan_t scan = scan_init("\"\\", scan_kernel(CSV_KERNEL_AUTO));
+    std::mt19937 rng(9);
+    for (int iter = 0; iter < 2000; iter++) {
+      std::string raw = '"' + random_quoted(rng, rng() % 300, '"', '\\');
+      std::string copy = raw;
+      csv_value_t value;
+      value.ptr = copy.data();
+      value.len = copy.size();
+      value.quoted = true;
+      unquote(&scan, &value, &conf);
+      const std::string expected(value.ptr, value.len);
+
+      copy = raw;
+      REQUIRE(0 == ensure_tmp(cb, raw.size() + 1));
+      value.ptr = raw.data();
+      value.len = raw.size();
+      value.quoted = true;
+      unquote_readonly(cb, &scan, &value);
+      CHECK(std::string(value.ptr, value.len) == expected);
+      CHECK(raw == copy);
+    }
+    csv_close(&csv);
+  }
+
   SUBCASE("multiline") {
     {
       string raw = "\"abcd\n\n\n\n\nefg\"";
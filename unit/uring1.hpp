@@ -0,0 +1,130 @@
+#pragma once
+
+using namespace std;
+namespace uring1 {
+
+const char *PATH = "/tmp/csv_uring_test.csv";
+
+struct context_t {
+  csv_t csv;
+  int64_t nrow = 0;
+  int64_t nbyte = 0; // sum of value lengths
+  int64_t lastno = 0;
+  context_t() { csv = csv_open(0); }
+  ~context_t() { csv_close(&csv); }
+  context_t(context_t &) = delete;
+  context_t &operator=(context_t &) = delete;
+  context_t(context_t &&) = delete;
+  context_t &operator=(context_t &&) = delete;
+};
+
+static int perrow(void *ctx_, int n, csv_value_t value[], int64_t lineno,
+                  int64_t rowno, char *errbuf, int errsz) {
+  (void)lineno;
+  (void)errbuf;
+  (void)errsz;
+  context_t *ctx = (context_t *)ctx_;
+  ctx->nrow++;
+  ctx->lastno = rowno;
+  for (int i = 0; i < n; i++) {
+    ctx->nbyte += value[i].len;
+  }
+  return 0;
+}
+
+// A document larger than all the slots together, so that every slot
+// is recycled a few times.
+static string make_doc() {
+  string s;
+  int64_t target = (int64_t)URING_NBUF * URING_BUFSZ * 2 + 12345;
+  for (int i = 0; (int64_t)s.size() < target; i++) {
+    s += to_string(i) + ",\"quoted, " + to_string(i * 7) + "\",xyz\n";
+  }
+  return s;
+}
+
+static void write_file(const string &s) {
+  std::ofstream out(PATH, std::ios::binary);
+  out << s;
+}
+
+} // namespace uring1
+
+TEST_CASE("uring1") {
+
+  using namespace uring1;
+
+  const string doc = make_doc();
+  write_file(doc);
+
+  SUBCASE("reader") {
+    uring_t ur;
+    if (uring_open(&ur, PATH)) {
+      MESSAGE("io_uring is not available; skipped");
+      return;
+    }
+    // odd sizes, so that reads straddle the slots
+    string out;
+    char buf[100000];
+    char errbuf[100];
+    for (int i = 0;; i++) {
+      int bufsz = (i * 7919) % sizeof(buf) + 1;
+      int n = uring_read(&ur, buf, bufsz, errbuf, sizeof(errbuf));
+      REQUIRE(n >= 0);
+      CHECK(n <= bufsz);
+      if (n == 0) {
+        break;
+      }
+      out.append(buf, n);
+    }
+    CHECK(out == doc);
+    uring_close(&ur);
+  }
+
+  SUBCASE("parse") {
+    context_t stdio, uring;
+    FILE *fp = fmemopen((void *)doc.data(), doc.size(), "r");
+    REQUIRE(fp);
+    CHECK(0 == csv_parse_file(&stdio.csv, fp, &stdio, perrow));
+    CHECK(0 == csv_parse_file_ex(&uring.csv, PATH, &uring, perrow));
+    CHECK(uring.nrow > 100000);
+    CHECK(uring.nrow == stdio.nrow);
+    CHECK(uring.nbyte == stdio.nbyte);
+    CHECK(uring.lastno == stdio.lastno);
+
+    // read through io_uring if it is available
+    uring_t probe;
+    bool avail = (0 == uring_open(&probe, PATH));
+    if (avail) {
+      uring_close(&probe);
+    }
+    CHECK(avail == (((csvx_t *)uring.csv.__internal)->uring != 0));
+  }
+
+  SUBCASE("fallback") {
+    // not a regular file; read with stdio
+    context_t ctx;
+    CHECK(0 == csv_parse_file_ex(&ctx.csv, "/dev/null", &ctx, perrow));
+    CHECK(ctx.nrow == 0);
+    CHECK(((csvx_t *)ctx.csv.__internal)->uring == 0);
+    CHECK(((csvx_t *)ctx.csv.__internal)->fp != 0);
+  }
+
+  SUBCASE("small file") {
+    // less than one slot; read with stdio
+    write_file(doc.substr(0, doc.rfind('\n', URING_BUFSZ - 2) + 1));
+    uring_t ur;
+    CHECK(-1 == uring_open(&ur, PATH));
+    context_t ctx;
+    CHECK(0 == csv_parse_file_ex(&ctx.csv, PATH, &ctx, perrow));
+    CHECK(ctx.nrow > 1000);
+    CHECK(((csvx_t *)ctx.csv.__internal)->uring == 0);
+    CHECK(((csvx_t *)ctx.csv.__internal)->fp != 0);
+  }
+
+  SUBCASE("no such file") {
+    context_t ctx;
+    CHECK(-1 == csv_parse_file_ex(&ctx.csv, "/tmp/no/such/file", &ctx, perrow));
+    CHECK(string(ctx.csv.errmsg).find("fopen failed") == 0);
+  }
+}